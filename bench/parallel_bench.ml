@@ -0,0 +1,72 @@
+(* Measures how [Pcre2.Parallel] scales with the number of domains, by
+   matching a handful of patterns against many generated subjects with pools
+   of every size up to the recommended domain count. Run with
+
+     dune exec --profile release bench/parallel_bench.exe [-- SUBJECTS]
+
+   Throughput should increase near-linearly with the number of domains, up to
+   the number of cores. *)
+
+let patterns =
+  [|
+    {|\b[A-Z][a-z]+ing\b|};
+    {|[0-9]{3}-[0-9]{4}|};
+    {|(?i)error|warn(?:ing)?|};
+    {|\w+@\w+\.com|};
+    {|(\w+)\s+\1|};
+  |]
+
+let words =
+  [|
+    "the"; "Running"; "error"; "555-0199"; "Warning"; "user@example.com";
+    "lorem"; "ipsum"; "dolor"; "sit"; "amet"; "Testing"; "again"; "again";
+  |]
+
+(* Deterministic subjects of about 4 KiB each. *)
+let subjects (n : int) : string array =
+  let rand = Random.State.make [| 42 |] in
+  Array.init n (fun _ ->
+      let b = Buffer.create 4096 in
+      while Buffer.length b < 4096 do
+        Buffer.add_string b words.(Random.State.int rand (Array.length words));
+        Buffer.add_char b (if Random.State.int rand 12 = 0 then '\n' else ' ')
+      done;
+      Buffer.contents b)
+
+(* The best of several runs, in seconds. *)
+let time (f : unit -> 'a) : float =
+  let run () =
+    let start = Unix.gettimeofday () in
+    ignore (Sys.opaque_identity (f ()));
+    Unix.gettimeofday () -. start
+  in
+  List.fold_left min infinity (List.init 3 (fun _ -> run ()))
+
+let () =
+  let n =
+    if Array.length Sys.argv > 1 then int_of_string Sys.argv.(1) else 20_000
+  in
+  let res =
+    Array.map
+      (fun p ->
+        match Pcre2.Jit.compile p with
+        | Ok re -> re
+        | Error e -> failwith (Pcre2.show_compile_error e))
+      patterns
+  in
+  let subjects = subjects n in
+  let bytes = Array.fold_left (fun acc s -> acc + String.length s) 0 subjects in
+  let megabytes = float_of_int bytes /. 1e6 in
+  Printf.printf "%d patterns, %d subjects (%.1f MB)\n%!" (Array.length res) n
+    megabytes;
+  let baseline = ref 0. in
+  for domains = 1 to Domain.recommended_domain_count () do
+    let pool = Pcre2.Parallel.create ~domains () in
+    let t =
+      time (fun () -> Pcre2.Parallel.Jit.find_all_many pool res subjects)
+    in
+    Pcre2.Parallel.shutdown pool;
+    if domains = 1 then baseline := t;
+    Printf.printf "%3d domains: %8.3fs %8.1f MB/s %6.2fx\n%!" domains t
+      (megabytes /. t) (!baseline /. t)
+  done
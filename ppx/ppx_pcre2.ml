@@ -0,0 +1,56 @@
+(* Compiles the pattern of each [%pcre2 "..."] (or [%pcre2.interp "..."]) when
+   the program is built, reporting invalid patterns as errors then, and embeds
+   the compiled pattern, marshalled, in a binding added to the start of the
+   structure, which the expression is replaced by. The program need then only
+   decode each pattern once, when the module is initialized, and JIT compile
+   it for [%pcre2], rather than parse and compile the pattern. The marshalled
+   pattern includes its source, so a program run with another version of
+   PCRE2 than it was built with compiles the pattern again instead. *)
+
+open Ppxlib
+
+let compile ~(loc : location) (pattern : string) : string =
+  match Pcre2.Interp.compile pattern with
+  | Error e ->
+      Location.raise_errorf ~loc "invalid pattern %S: %s" pattern
+        (Pcre2.show_compile_error e)
+  | Ok re -> Marshal.to_string re []
+
+let hoist (str : structure) : structure =
+  let bindings = ref [] in
+  let rewrite =
+    object
+      inherit Ast_traverse.map as super
+
+      method! expression e =
+        match e.pexp_desc with
+        | Pexp_extension
+            ({ txt = ("pcre2" | "pcre2.interp") as name; _ }, payload) ->
+            let loc = e.pexp_loc in
+            let pattern =
+              Ast_pattern.(parse (single_expr_payload (estring __)))
+                loc
+                ~on_error:(fun () ->
+                  Location.raise_errorf ~loc "[%%%s] expects a string literal"
+                    name)
+                payload Fun.id
+            in
+            let compiled =
+              Ast_builder.Default.estring ~loc (compile ~loc pattern)
+            in
+            let decode =
+              if name = "pcre2" then [%expr Pcre2.Embedded.jit [%e compiled]]
+              else [%expr Pcre2.Embedded.interp [%e compiled]]
+            in
+            let var = Printf.sprintf "__ppx_pcre2_%d" (List.length !bindings) in
+            bindings :=
+              [%stri let [%p Ast_builder.Default.pvar ~loc var] = [%e decode]]
+              :: !bindings;
+            Ast_builder.Default.evar ~loc var
+        | _ -> super#expression e
+    end
+  in
+  let str = rewrite#structure str in
+  List.rev_append !bindings str
+
+let () = Driver.register_transformation "pcre2" ~impl:hoist
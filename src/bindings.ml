@@ -6,25 +6,77 @@ let unset = (-1, -1)
 (* Since -1 == PCRE2_UNSET.
    TODO: obtain this value as part of the bindings, rather than like so *)
 
+type match_data
+(** Match data (notably the offset vector) which may be reused across matches
+    for any regex. The matching functions take a [match_data option]; given
+    [None], they use match data private to the calling thread (or, when
+    capturing, temporary match data). *)
+
+type cancel_flag
+(** A flag, set from any thread or domain, which cancels the matches guarded by
+    it. *)
+
+external cancel_flag_create : unit -> cancel_flag = "cancel_flag_create"
+external cancel_flag_set : cancel_flag -> unit = "cancel_flag_set"
+external cancel_flag_is_set : cancel_flag -> bool = "cancel_flag_is_set"
+
+type match_context
+(** Limits on the resources a match may consume, and optionally a timeout and
+    cancellation flag guarding it. The matching functions take a
+    [match_context option]; given [None], they use PCRE2's default limits. *)
+
+(* Each limit is negative for PCRE2's default. The heap limit is in KiB, and the
+   timeout (which is negative for none) in nanoseconds. *)
+external match_context_create :
+  int -> int -> int -> int -> cancel_flag option -> match_context
+  = "match_context_create"
+
+type bigstring =
+  (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
+
+type subject
+(** A subject to be matched against, which is either a [string] or a
+    [bigstring]. The stubs distinguish the two by the tag of the block, so
+    matching is the same for both, but a [bigstring] is never moved by the GC
+    and so need not be copied to be matched. *)
+
+external subject_of_string : string -> subject = "%identity"
+external subject_of_bigstring : bigstring -> subject = "%identity"
+
+external subject_length : subject -> (int[@untagged])
+  = "subject_length" "subject_length_unboxed"
+[@@noalloc]
+
+external subject_sub : subject -> int -> int -> string = "subject_sub"
+(** [subject_sub s start len] is a copy of the [len] bytes of [s] starting at
+    [start], which must be within the bounds of [s]. *)
+
 external pcre2_ocaml_init : unit -> unit = "pcre2_ocaml_init"
 
 external pcre2_compile :
   string -> (int32[@unboxed]) -> (interp regex, int) Result.t
   = "compile" "compile_unboxed"
 
+external pcre2_match_data_create : _ regex -> int -> match_data
+  = "match_data_create"
+
 external pcre2_match :
   _ regex ->
-  string ->
+  match_data option ->
+  match_context option ->
+  subject ->
   (int[@untagged]) ->
   (int32[@unboxed]) ->
   ((int * int) option, int) Result.t = "match" "match_unboxed"
 
 external pcre2_capture :
   _ regex ->
-  string ->
+  match_data option ->
+  match_context option ->
+  subject ->
   (int[@untagged]) ->
   (int32[@unboxed]) ->
-  (((int * int) array * (string * int) array) option, int) Result.t
+  (int array option, int) Result.t
   = "capture" "capture_unboxed"
 
 external pcre2_jit_compile :
@@ -33,20 +85,347 @@ external pcre2_jit_compile :
 
 external pcre2_jit_match :
   jit regex ->
-  string ->
+  match_data option ->
+  match_context option ->
+  subject ->
   (int[@untagged]) ->
   (int32[@unboxed]) ->
   ((int * int) option, int) Result.t = "jit_match" "jit_match_unboxed"
 
 external pcre2_jit_capture :
   jit regex ->
-  string ->
+  match_data option ->
+  match_context option ->
+  subject ->
   (int[@untagged]) ->
   (int32[@unboxed]) ->
-  (((int * int) array * (string * int) array) option, int) Result.t
+  (int array option, int) Result.t
   = "jit_capture" "jit_capture_unboxed"
 
+(* The following return a positive number if there is a match, 0 if there is
+   none and a negative error code otherwise. *)
+
+external pcre2_is_match :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) = "is_match" "is_match_unboxed"
+[@@noalloc]
+
+external pcre2_find_into :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  int array ->
+  (int[@untagged]) = "find_into" "find_into_unboxed"
+[@@noalloc]
+
+external pcre2_jit_is_match :
+  jit regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) = "jit_is_match" "jit_is_match_unboxed"
+[@@noalloc]
+
+(* As [pcre2_find_into], but a partial match (as requested by the options) is
+   stored in the buffer as well, and reported as [-2] (PCRE2_ERROR_PARTIAL).
+   This uses the JIT where the regex was JIT compiled for the partial mode
+   requested, and otherwise interprets it. *)
+external pcre2_find_partial_into :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  int array ->
+  (int[@untagged]) = "find_partial_into" "find_partial_into_unboxed"
+[@@noalloc]
+
+external pcre2_jit_find_into :
+  jit regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  int array ->
+  (int[@untagged]) = "jit_find_into" "jit_find_into_unboxed"
+[@@noalloc]
+
+(* Return the flattened ranges of every match ([start0; end0; start1; ...]) and
+   either 0 or the error code which ended matching early. *)
+
+external pcre2_find_all :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) ->
+  bool ->
+  int array * int = "find_all" "find_all_unboxed"
+
+external pcre2_jit_find_all :
+  jit regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) ->
+  bool ->
+  int array * int = "jit_find_all" "jit_find_all_unboxed"
+
+(* Return the flattened offsets of every capture group of every match, the
+   number of pairs of offsets per match and either 0 or the error code which
+   ended matching early. *)
+
+external pcre2_captures_all :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) ->
+  bool ->
+  int array * int * int = "captures_all" "captures_all_unboxed"
+
+external pcre2_jit_captures_all :
+  jit regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) ->
+  bool ->
+  int array * int * int = "jit_captures_all" "jit_captures_all_unboxed"
+
+(* The same, matching with the DFA. Each alternative match at a position is
+   reported in place of the capture groups, which the DFA does not support. A
+   workspace for the DFA is kept with the match data (or, given [None], private
+   to the calling thread) and grown as needed. *)
+
+external pcre2_dfa_match_data_create : _ regex -> int -> match_data
+  = "dfa_match_data_create"
+
+external pcre2_dfa_match :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  ((int * int) option, int) Result.t = "dfa_match" "dfa_match_unboxed"
+
+external pcre2_dfa_capture :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  (int array option, int) Result.t = "dfa_capture" "dfa_capture_unboxed"
+
+external pcre2_dfa_is_match :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) = "dfa_is_match" "dfa_is_match_unboxed"
+[@@noalloc]
+
+external pcre2_dfa_find_into :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  int array ->
+  (int[@untagged]) = "dfa_find_into" "dfa_find_into_unboxed"
+[@@noalloc]
+
+external pcre2_dfa_find_partial_into :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  int array ->
+  (int[@untagged]) = "dfa_find_partial_into" "dfa_find_partial_into_unboxed"
+[@@noalloc]
+
+external pcre2_dfa_find_all :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) ->
+  bool ->
+  int array * int = "dfa_find_all" "dfa_find_all_unboxed"
+
+external pcre2_dfa_captures_all :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  subject ->
+  (int[@untagged]) ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) ->
+  bool ->
+  int array * int * int = "dfa_captures_all" "dfa_captures_all_unboxed"
+
+(* Finds every match in a file, which is mapped into memory rather than read,
+   annotating each with the line and column at which it starts: the offsets
+   are flattened as [start0; end0; line0; column0; start1; ...], with the error
+   code which ended matching early (or 0). Raises [Sys_error] if the file
+   cannot be opened or mapped. The runtime lock is released meanwhile. *)
+
+external pcre2_scan_file :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  string ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) ->
+  int array * int = "scan_file" "scan_file_unboxed"
+
+external pcre2_jit_scan_file :
+  jit regex ->
+  match_data option ->
+  match_context option ->
+  string ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) ->
+  int array * int = "jit_scan_file" "jit_scan_file_unboxed"
+
+external pcre2_dfa_scan_file :
+  _ regex ->
+  match_data option ->
+  match_context option ->
+  string ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) ->
+  int array * int = "dfa_scan_file" "dfa_scan_file_unboxed"
+
+(* The size from which off-heap subjects are matched without the runtime lock,
+   or -1 for never. *)
+
+external set_release_lock_threshold : int -> unit
+  = "set_release_lock_threshold"
+
+external get_release_lock_threshold : unit -> int
+  = "get_release_lock_threshold"
+
+(* The number of subjects rejected by prefilters, by reason: too short, lacking
+   the first code unit and lacking the last. *)
+external get_prefilter_rejections : unit -> int array
+  = "get_prefilter_rejections"
+
+external reset_prefilter_rejections : unit -> unit
+  = "reset_prefilter_rejections"
+
+(* The bounds on the size of the JIT stack of each thread. *)
+
+external set_jit_stack_sizes : int -> int -> unit = "set_jit_stack_sizes"
+external get_jit_stack_sizes : unit -> int * int = "get_jit_stack_sizes"
 external get_version : unit -> int * int = "get_version"
 
 external get_capture_groups : _ regex -> (string * int) array
   = "get_capture_groups"
+
+(* The byte index at which the (non-empty) literal first occurs in the subject
+   from the offset, which must be within it, or -1. With [caseless], ASCII
+   letters match either case. *)
+external literal_find :
+  string -> bool -> string -> (int[@untagged]) -> (int[@untagged])
+  = "literal_find" "literal_find_unboxed"
+[@@noalloc]
+
+(* The number of bytes before a match which matching may examine. *)
+external max_lookbehind : _ regex -> (int[@untagged])
+  = "max_lookbehind" "max_lookbehind_unboxed"
+[@@noalloc]
+
+(* Finds the leftmost match of every pattern of a set combined into a regex,
+   returning their ranges (-1 for those which did not match) and either 0 or an
+   error code. *)
+external set_match :
+  _ regex -> subject -> (int[@untagged]) -> (int[@untagged]) -> int array * int
+  = "set_match" "set_match_unboxed"
+
+(* An ASCII code unit every match contains, per PCRE2, or -1. *)
+external required_code_unit : _ regex -> (int[@untagged])
+  = "required_code_unit" "required_code_unit_unboxed"
+[@@noalloc]
+
+type literal_set
+(** An Aho-Corasick automaton over the literals required by a set of rules. *)
+
+(* Takes the literals, whether each is caseless, the rule of each and the
+   number of rules. *)
+external literal_set_create :
+  string array -> bool array -> int array -> int -> literal_set
+  = "literal_set_create"
+
+(* The rules, in increasing order, whose literals occur in the subject. *)
+external literal_set_scan : literal_set -> subject -> int array
+  = "literal_set_scan"
+
+type mutex
+(** A mutex which may be shared by threads and domains alike. While [lock]
+    blocks, the runtime lock is released. *)
+
+external mutex_create : unit -> mutex = "mutex_create"
+external mutex_lock : mutex -> unit = "mutex_lock"
+external mutex_unlock : mutex -> unit = "mutex_unlock" [@@noalloc]
+
+(* Compiles and JIT compiles every pattern on threads of its own, given the
+   compile options, the JIT options and the number of threads (0 for one per
+   processor), returning the results and seconds taken in order. *)
+external pcre2_compile_many :
+  string array ->
+  (int32[@unboxed]) ->
+  (int32[@unboxed]) ->
+  (int[@untagged]) ->
+  (jit regex, int) Result.t array * float array
+  = "compile_many" "compile_many_unboxed"
+
+(* A copy of the regex, without any JIT compiled code. *)
+external code_copy : _ regex -> interp regex = "code_copy"
+
+(* Saves the regexes to the file, returning 0 or the error code of
+   pcre2_serialize_encode. Raises [Sys_error] if it cannot be written. *)
+external serialized_save : string -> _ regex array -> int = "serialized_save"
+
+(* The pattern, options and regex of each of those saved in the file, or [None]
+   if it is absent, invalid or for another version of PCRE2. *)
+external serialized_load :
+  string -> (string * int32 * interp regex) array option = "serialized_load"
+
+(* The size of the JIT compiled code of the regex, or 0 if it has none. *)
+external regex_jit_size : _ regex -> int = "regex_jit_size" [@@noalloc]
+
+(* The number of regexes alive, and the total size of their code and of their
+   JIT compiled code. *)
+external memory_usage : unit -> int * int * int = "memory_usage"
+
+external jit_free_unused_memory : unit -> unit = "jit_free_unused_memory"
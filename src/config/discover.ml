@@ -11,4 +11,5 @@ let () =
             Option.value (C.Pkg_config.query pc ~package:"libpcre2-8") ~default
       in
       C.Flags.write_sexp "c_flags.sexp" conf.cflags;
-      C.Flags.write_sexp "c_library_flags.sexp" conf.libs)
+      (* The stubs use pthreads for mutexes. *)
+      C.Flags.write_sexp "c_library_flags.sexp" (conf.libs @ [ "-lpthread" ]))
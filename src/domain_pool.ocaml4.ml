@@ -0,0 +1,24 @@
+(* A stand-in for the pool of domains used by [Pcre2.Parallel] on OCaml 5 (see
+   domain_pool.ocaml5.ml), for versions of OCaml without domains. Every job
+   is run sequentially by the caller, so that the same interface is
+   available. *)
+
+type pool = { mutable closed : bool }
+
+let create ?(domains : int option) () : pool =
+  (match domains with
+  | Some n when n <= 0 ->
+      invalid_arg "Parallel.create: domains must be positive"
+  | _ -> ());
+  { closed = false }
+
+let domains (_ : pool) : int = 1
+let shutdown (pool : pool) : unit = pool.closed <- true
+
+let init (pool : pool) (n : int) ~(state : unit -> 's) (f : 's -> int -> 'a) :
+    'a array =
+  if pool.closed then invalid_arg "Parallel: the pool has been shut down";
+  if n = 0 then [||]
+  else
+    let s = state () in
+    Array.init n (f s)
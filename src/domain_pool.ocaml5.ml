@@ -0,0 +1,127 @@
+(* A pool of domains which cooperate on jobs, for [Pcre2.Parallel].
+
+   This is selected by dune for OCaml 5; see domain_pool.ocaml4.ml for the
+   sequential stand-in used before domains were available. *)
+
+type pool = {
+  mutex : Mutex.t;
+  work_available : Condition.t;
+  work_done : Condition.t;
+  mutable job : unit -> unit;
+  mutable generation : int;
+      (* Incremented for each job, so that a worker can tell a new job from
+         one it has already run. *)
+  mutable running : int;  (* The number of workers yet to finish the job *)
+  mutable closed : bool;
+  mutable workers : unit Domain.t list;
+  busy : Mutex.t;  (* Held while a job runs, so that only one runs at once *)
+}
+
+let rec worker (pool : pool) (generation : int) : unit =
+  Mutex.lock pool.mutex;
+  while (not pool.closed) && pool.generation = generation do
+    Condition.wait pool.work_available pool.mutex
+  done;
+  if pool.closed then Mutex.unlock pool.mutex
+  else
+    let generation = pool.generation and job = pool.job in
+    Mutex.unlock pool.mutex;
+    job ();
+    Mutex.lock pool.mutex;
+    pool.running <- pool.running - 1;
+    if pool.running = 0 then Condition.signal pool.work_done;
+    Mutex.unlock pool.mutex;
+    worker pool generation
+
+let create ?(domains : int option) () : pool =
+  let domains =
+    match domains with
+    | None -> Domain.recommended_domain_count ()
+    | Some n when n > 0 -> n
+    | Some _ -> invalid_arg "Parallel.create: domains must be positive"
+  in
+  let pool =
+    {
+      mutex = Mutex.create ();
+      work_available = Condition.create ();
+      work_done = Condition.create ();
+      job = ignore;
+      generation = 0;
+      running = 0;
+      closed = false;
+      workers = [];
+      busy = Mutex.create ();
+    }
+  in
+  (* The domain which runs a job takes part in it, so needs no worker. *)
+  pool.workers <-
+    List.init (domains - 1) (fun _ -> Domain.spawn (fun () -> worker pool 0));
+  pool
+
+let domains (pool : pool) : int = List.length pool.workers + 1
+
+let shutdown (pool : pool) : unit =
+  Mutex.lock pool.busy;
+  Mutex.lock pool.mutex;
+  pool.closed <- true;
+  Condition.broadcast pool.work_available;
+  Mutex.unlock pool.mutex;
+  List.iter Domain.join pool.workers;
+  pool.workers <- [];
+  Mutex.unlock pool.busy
+
+(* Runs [job] on every domain of the pool, returning once all have finished.
+   [job] must not raise. *)
+let run (pool : pool) (job : unit -> unit) : unit =
+  Mutex.lock pool.busy;
+  Mutex.lock pool.mutex;
+  if pool.closed then (
+    Mutex.unlock pool.mutex;
+    Mutex.unlock pool.busy;
+    invalid_arg "Parallel: the pool has been shut down");
+  pool.job <- job;
+  pool.generation <- pool.generation + 1;
+  pool.running <- List.length pool.workers;
+  Condition.broadcast pool.work_available;
+  Mutex.unlock pool.mutex;
+  job ();
+  Mutex.lock pool.mutex;
+  while pool.running > 0 do
+    Condition.wait pool.work_done pool.mutex
+  done;
+  pool.job <- ignore;
+  Mutex.unlock pool.mutex;
+  Mutex.unlock pool.busy
+
+let init (pool : pool) (n : int) ~(state : unit -> 's) (f : 's -> int -> 'a) :
+    'a array =
+  let results = Array.make n None in
+  (* Rather than dividing the indices between the domains up front, each takes
+     the next chunk of them whenever it is done with its last, so that domains
+     which finish early (e.g., since their subjects were smaller) take on more
+     of the work. Chunks are small enough for this to balance the load, but
+     large enough that the counter is not contended. *)
+  let next = Atomic.make 0 in
+  let chunk = max 1 (n / (8 * domains pool)) in
+  let failure = Atomic.make None in
+  let job () =
+    try
+      let s = state () in
+      let rec loop () =
+        let start = Atomic.fetch_and_add next chunk in
+        if start < n && Option.is_none (Atomic.get failure) then (
+          for i = start to min n (start + chunk) - 1 do
+            results.(i) <- Some (f s i)
+          done;
+          loop ())
+      in
+      loop ()
+    with e ->
+      let bt = Printexc.get_raw_backtrace () in
+      ignore (Atomic.compare_and_set failure None (Some (e, bt)))
+  in
+  if n > 0 then run pool job;
+  Option.iter
+    (fun (e, bt) -> Printexc.raise_with_backtrace e bt)
+    (Atomic.get failure);
+  Array.map Option.get results
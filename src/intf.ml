@@ -32,7 +32,9 @@ module type Matcher = sig
       and end byte offsets. *)
 
   val captures_length : captures -> int
-  (** [captures_length c] is the number of matches contained in [c]. *)
+  (** [captures_length c] is the number of capture groups of the matcher which
+      created [c], counting the whole match as group 0, whether or not they
+      matched. *)
 
   val match_of_captures : captures -> int -> match_ option
   (** [match_of_captures c i] is either [Some m], if the capture group numbered
@@ -44,6 +46,18 @@ module type Matcher = sig
       *)
   (* TODO: see comment on [captures]; unclear of generality of this *)
 
+  type captures_batch [@@deriving show]
+  (** The [captures] of several successive matches, stored together. *)
+
+  val captures_batch_length : captures_batch -> int
+  (** [captures_batch_length b] is the number of matches in [b]. *)
+
+  val captures_of_batch : captures_batch -> int -> captures
+  (** [captures_of_batch b i] is the [captures] of the [i]th match in [b]
+      (numbered from 0). It shares its storage with [b] rather than copying it.
+
+      @raise Invalid_argument if [i] is not a valid index of a match in [b]. *)
+
   type compile_option [@@deriving show, eq]
   type match_option [@@deriving show, eq]
   type compile_error [@@deriving show, eq]
@@ -61,6 +75,12 @@ module type Matcher = sig
       associated with that capture group. Note that numbers may be skipped or
       out of order. *)
 
+  val group_index : t -> string -> int option
+  (** [group_index re n] is either [Some i], where [i] is the number of the
+      capture group named [n] in [re] (the lowest such number, if names may be
+      duplicated), or [None] if there is no such group. It is computed once
+      when [re] is compiled, so repeated lookups are cheap. *)
+
   val find :
     ?options:match_option list ->
     ?subject_offset:int ->
@@ -96,10 +116,35 @@ module type Matcher = sig
       The sequence ends when no more matches are found (so no matches in
       [subject] means an empty sequence) or a fatal error is encountered. In
       the latter case the error is returned as the last element of the
-      sequence. 
+      sequence. Empty matches are handled as for [find_all].
     *)
   (* TODO: Are there any errors which should be non-fatal? *)
 
+  val find_all :
+    ?options:match_option list ->
+    ?subject_offset:int ->
+    ?max_count:int ->
+    t ->
+    string ->
+    (int array, match_error) Result.t
+  (** [find_all re subject] is the ranges of all disjoint matches of [re] in
+      [subject], flattened into a single array of byte offsets
+      [[|start0; end0; start1; end1; ...|]]. See [match_option] for details on
+      how [options] may affect matching. If [subject_offset] is provided then
+      the initial match will be searched for from that byte offset in
+      [subject]. If [max_count] is provided then at most that many matches are
+      found.
+
+      After an empty match, a non-empty match at the same position is searched
+      for before advancing by a character, so that iteration always makes
+      progress.
+
+      Unlike [find_iter], all matching is done eagerly and without allocating
+      a value for each match. If an error is encountered it is returned as
+      [Error e] (and the matches found before it are discarded).
+
+      @raise Invalid_argument if [max_count] is negative. *)
+
   val captures :
     ?options:match_option list ->
     ?subject_offset:int ->
@@ -137,14 +182,29 @@ module type Matcher = sig
       The sequence ends when no more matches are found (so no matches in
       [subject] means an empty sequence) or a fatal error is encountered. In
       the latter case the error is returned as the last element of the
-      sequence. 
+      sequence.
 
       NOTE: This function may be less efficient than [find_iter] depending on
       the underlying implementation. If you don't need capture groups, you
-      should use [find_iter] instead.
+      should use [find_iter] instead. Empty matches are handled as for
+      [find_all].
     *)
   (* TODO: see [find_iter] *)
 
+  val captures_all :
+    ?options:match_option list ->
+    ?subject_offset:int ->
+    ?max_count:int ->
+    t ->
+    string ->
+    (captures_batch, match_error) Result.t
+  (** [captures_all re subject] is like [find_all re subject], but binds the
+      capture groups of every match. The offsets of all groups of all matches
+      are stored in a single flat buffer, rather than allocating for each
+      match; use [captures_of_batch] to access them.
+
+      @raise Invalid_argument if [max_count] is negative. *)
+
   val split :
     ?options:match_option list ->
     ?subject_offset:int ->
@@ -170,3 +230,352 @@ module type Matcher = sig
   (** [is_match re subject] is equivalent to [find re subject |> Result.map
       Option.is_some] but may be implemented more efficiently. *)
 end
+
+module type Matcher_handle = sig
+  type t
+  type match_
+  type captures
+  type match_option
+  type match_error
+
+  type limits
+  (** Bounds on the work a single match may do, beyond which it fails with an
+      error rather than running on. *)
+
+  val with_limits : limits -> t -> t
+  (** [with_limits limits re] is [re], but with every match bounded by
+      [limits] unless overridden by a handle. [re] itself is unchanged. *)
+
+  val limits : t -> limits
+  (** [limits re] is the limits every match with [re] is bounded by. *)
+
+  type handle
+  (** A reusable handle for matching with a particular matcher. The handle
+      owns whatever state the underlying engine needs to perform a match (e.g.,
+      the offset vector), so that successive matches do not allocate it anew,
+      and carries its matching options in a pre-processed form.
+
+      NOTE: A handle must not be used by more than one thread or domain at a
+      time. *)
+
+  val handle :
+    ?options:match_option list ->
+    ?captures:bool ->
+    ?limits:limits ->
+    t ->
+    handle
+  (** [handle re] is a new handle for matching with [re]. See [match_option]
+      for details on how [options] affect matching with the handle. If
+      [captures] is [false] the handle only retains space for the range of
+      the whole match, which is all [find_with] and [is_match_with] need;
+      [captures_with] will then only report the whole match. If [limits] is
+      provided, matches with the handle are bounded by it rather than by
+      [limits re]. *)
+
+  val find_with :
+    ?subject_offset:int ->
+    handle ->
+    string ->
+    (match_ option, match_error) Result.t
+  (** [find_with h subject] is equivalent to [find re subject], where [h] is a
+      handle for [re], but reuses the state held by [h]. *)
+
+  val captures_with :
+    ?subject_offset:int ->
+    handle ->
+    string ->
+    (captures option, match_error) Result.t
+  (** [captures_with h subject] is equivalent to [captures re subject], where
+      [h] is a handle for [re], but reuses the state held by [h]. *)
+
+  val is_match_with :
+    ?subject_offset:int -> handle -> string -> (bool, match_error) Result.t
+  (** [is_match_with h subject] is equivalent to [is_match re subject], where
+      [h] is a handle for [re], but reuses the state held by [h]. It does not
+      allocate unless an error occurs. *)
+
+  val find_all_with :
+    ?subject_offset:int ->
+    ?max_count:int ->
+    handle ->
+    string ->
+    (int array, match_error) Result.t
+  (** [find_all_with h subject] is equivalent to [find_all re subject], where
+      [h] is a handle for [re], but reuses the state held by [h]. *)
+
+  val find_into :
+    ?subject_offset:int ->
+    handle ->
+    string ->
+    int array ->
+    (bool, match_error) Result.t
+  (** [find_into h subject buffer] searches for a match like [find_with h
+      subject], but rather than allocating the match it stores its start and
+      end byte offsets in [buffer.(0)] and [buffer.(1)] and is [Ok true] (or
+      [Ok false], leaving [buffer] untouched, if there is no match). It does
+      not allocate unless an error occurs.
+
+      @raise Invalid_argument if [buffer] has fewer than 2 elements. *)
+end
+
+module type Matcher_bigstring = sig
+  type t
+  type match_
+  type captures
+  type captures_batch
+  type match_option
+  type match_error
+
+  type bigstring =
+    (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
+  (** A subject outside of the OCaml heap, such as one mapped from a file with
+      [Unix.map_file]. *)
+
+  (** The following are equivalent to the functions of [Matcher] of the same
+      name without the [_bigstring] suffix, except that the subject is the
+      window of [len] bytes from [pos] in a [bigstring] (by default, all of
+      it). The window is matched as though it were the entire subject: byte
+      offsets, both [subject_offset] and those of the matches found, are
+      relative to [pos], and nothing outside of the window is examined (e.g.,
+      by a lookbehind). Neither is copied in order to be matched.
+
+      NOTE: Matches refer to the [bigstring] rather than a copy of it, so
+      [substring_of_match] reflects its contents when it is called.
+
+      Each raises [Invalid_argument] if the window is not within the
+      [bigstring]. *)
+
+  val find_bigstring :
+    ?options:match_option list ->
+    ?subject_offset:int ->
+    ?pos:int ->
+    ?len:int ->
+    t ->
+    bigstring ->
+    (match_ option, match_error) Result.t
+
+  val find_iter_bigstring :
+    ?options:match_option list ->
+    ?subject_offset:int ->
+    ?pos:int ->
+    ?len:int ->
+    t ->
+    bigstring ->
+    (match_, match_error) Result.t Seq.t
+
+  val find_all_bigstring :
+    ?options:match_option list ->
+    ?subject_offset:int ->
+    ?max_count:int ->
+    ?pos:int ->
+    ?len:int ->
+    t ->
+    bigstring ->
+    (int array, match_error) Result.t
+
+  val captures_bigstring :
+    ?options:match_option list ->
+    ?subject_offset:int ->
+    ?pos:int ->
+    ?len:int ->
+    t ->
+    bigstring ->
+    (captures option, match_error) Result.t
+
+  val captures_iter_bigstring :
+    ?options:match_option list ->
+    ?subject_offset:int ->
+    ?pos:int ->
+    ?len:int ->
+    t ->
+    bigstring ->
+    (captures, match_error) Result.t Seq.t
+
+  val captures_all_bigstring :
+    ?options:match_option list ->
+    ?subject_offset:int ->
+    ?max_count:int ->
+    ?pos:int ->
+    ?len:int ->
+    t ->
+    bigstring ->
+    (captures_batch, match_error) Result.t
+
+  val is_match_bigstring :
+    ?options:match_option list ->
+    ?subject_offset:int ->
+    ?pos:int ->
+    ?len:int ->
+    t ->
+    bigstring ->
+    (bool, match_error) Result.t
+end
+
+module type Matcher_file = sig
+  type t
+  type range
+  type match_option
+  type match_error
+
+  type located_match = {
+    range : range;  (** The byte offsets of the match in the file. *)
+    line : int;  (** The line the match starts on, counted from 1. *)
+    column : int;
+        (** The column the match starts at, in bytes and counted from 1. *)
+  }
+  [@@deriving show, eq]
+  (** A match in a file, with the position at which it starts. *)
+
+  val scan_file :
+    ?options:match_option list ->
+    ?max_count:int ->
+    t ->
+    string ->
+    (located_match array, match_error) Result.t
+  (** [scan_file re path] is the matches of [re] in the file at [path], in
+      order, as for [find_all] (at most [max_count] of them). The file is
+      mapped into memory rather than read, and searched without holding the
+      runtime lock. Lines are ended by ['\n'], which is found once per file
+      rather than per match.
+
+      NOTE: As with any mapping, should the file be truncated while it is
+      searched, the process may be killed by [SIGBUS].
+
+      @raise Sys_error if the file cannot be opened or mapped.
+      @raise Invalid_argument if [max_count] is negative. *)
+end
+
+module type Matcher_stream = sig
+  type t
+  type range
+  type match_option
+  type match_error
+
+  type stream
+  (** A search for the matches of a matcher in a subject which arrives in
+      chunks, such as from a channel or socket, without ever holding all of it.
+      Only the tail of the subject which a later match may still need is
+      retained between chunks: that from the start of a partial match at the
+      end of the last chunk, if there is one, and otherwise only as many bytes
+      as the longest lookbehind of the matcher examines, and at least two so
+      that a multiline [^] sees a newline before it. A match spanning
+      chunks is found just as though the subject were one string.
+
+      NOTE: Memory is bounded only where partial matches are. A partial match
+      of, e.g., [a.*b] which never completes retains everything after its
+      start.
+
+      NOTE: A stream must not be used by more than one thread or domain at a
+      time. *)
+
+  val stream : ?options:match_option list -> t -> stream
+  (** [stream re] is a new stream for matching with [re], having been fed
+      nothing. Partial matching options in [options] are ignored; the stream
+      does its own. *)
+
+  val feed :
+    ?pos:int ->
+    ?len:int ->
+    stream ->
+    string ->
+    (range list, match_error) Result.t
+  (** [feed s chunk] appends the [len] bytes of [chunk] from [pos] (by default,
+      all of it) to the subject of [s], and is the ranges of the matches which
+      are thereby certain, in order. Offsets are from the start of the whole
+      subject. A match which reaches the end of [chunk] is not reported until
+      later chunks show that it can be extended no further. After an error,
+      [s] is finished.
+
+      @raise Invalid_argument if [s] is finished, or if the range is not
+      within [chunk]. *)
+
+  val finish : stream -> (range list, match_error) Result.t
+  (** [finish s] marks the end of the subject of [s], and is the ranges of
+      the matches which remain to be reported. [s] is then finished.
+
+      @raise Invalid_argument if [s] is already finished. *)
+
+  val stream_position : stream -> int
+  (** [stream_position s] is the number of bytes fed to [s] so far. *)
+
+  val stream_retained : stream -> int
+  (** [stream_retained s] is the number of bytes [s] retains. *)
+
+  val scan_channel :
+    ?options:match_option list ->
+    ?chunk_size:int ->
+    t ->
+    in_channel ->
+    (range -> unit) ->
+    (unit, match_error) Result.t
+  (** [scan_channel re channel f] reads [channel] to its end, [chunk_size]
+      bytes at a time (by default, 65536), and applies [f] to the range of
+      each match of [re] in turn.
+
+      @raise Invalid_argument if [chunk_size] is not positive. *)
+
+  val scan_reader :
+    ?options:match_option list ->
+    ?chunk_size:int ->
+    t ->
+    (bytes -> int -> int -> int) ->
+    (range -> unit) ->
+    (unit, match_error) Result.t
+  (** [scan_reader re read f] is [scan_channel] for any source, such as a
+      socket or an Eio flow: [read buf pos len] reads at most [len] bytes into
+      [buf] at [pos], returning how many it read, or 0 at the end. For
+      instance, [scan_reader re (Unix.read fd) f] scans a socket [fd].
+
+      @raise Invalid_argument if [chunk_size] is not positive. *)
+end
+
+module type Parallel_matcher = sig
+  type pool
+  type t
+  type match_option
+  type match_error
+
+  (** The following each match every subject of an array, spreading the work
+      across the domains of [pool], and return the results in the same order
+      as the subjects. Each domain uses handles of its own, so nothing is
+      shared between them but the compiled patterns. If matching raises an
+      exception (e.g., [Invalid_argument] for a negative [max_count]), the
+      remaining work is abandoned and the exception is raised once every
+      domain has stopped. *)
+
+  val is_match :
+    ?options:match_option list ->
+    pool ->
+    t ->
+    string array ->
+    (bool, match_error) Result.t array
+  (** [is_match pool re subjects] is [Array.map (is_match re) subjects]. *)
+
+  val find_all :
+    ?options:match_option list ->
+    ?max_count:int ->
+    pool ->
+    t ->
+    string array ->
+    (int array, match_error) Result.t array
+  (** [find_all pool re subjects] is [Array.map (find_all re) subjects]. *)
+
+  val is_match_many :
+    ?options:match_option list ->
+    pool ->
+    t array ->
+    string array ->
+    (bool, match_error) Result.t array array
+  (** [is_match_many pool res subjects] is an array [a] such that [a.(i).(j)]
+      is [is_match res.(j) subjects.(i)]. *)
+
+  val find_all_many :
+    ?options:match_option list ->
+    ?max_count:int ->
+    pool ->
+    t array ->
+    string array ->
+    (int array, match_error) Result.t array array
+  (** [find_all_many pool res subjects] is an array [a] such that [a.(i).(j)]
+      is [find_all res.(j) subjects.(i)]. *)
+end
@@ -10,41 +10,92 @@ let ( let* ) = Result.bind
    for various PCRE2 matching flavours, since they all share the same offset
    vector (ovector) representation. *)
 module Match = struct
-  type match_ = string * int * int (* need only ovec? *) [@@deriving show, eq]
+  (* Subjects are printed and compared by their contents, whether they are
+     strings or bigstrings. *)
+  type subject = Bindings.subject
+
+  let string_of_subject (s : subject) : string =
+    Bindings.subject_sub s 0 (Bindings.subject_length s)
+
+  let pp_subject (fmt : Format.formatter) (s : subject) : unit =
+    Format.fprintf fmt "%S" (string_of_subject s)
+
+  let equal_subject (a : subject) (b : subject) : bool =
+    a == b || String.equal (string_of_subject a) (string_of_subject b)
+
+  type match_ = subject * int * int (* need only ovec? *) [@@deriving show, eq]
   type range = { start : int; end_ : int } [@@deriving show, eq]
 
-  type captures = string * (int * int) array * (string * int) array
+  type located_match = { range : range; line : int; column : int }
   [@@deriving show, eq]
 
+  (* The capture groups of a match are a view into a flat array of offsets
+     ([start0; end0; start1; end1; ...], with -1 for unset groups) which may be
+     shared with other matches; see [captures_batch]. *)
+  type captures = {
+    subject : subject;
+    ovector : int array;
+    base : int;  (** The index in [ovector] of the start of group 0. *)
+    pairs : int;  (** The number of groups, including group 0. *)
+    names : (string, int) Hashtbl.t; [@opaque]
+        (** Shared with the regex which created the match; see [compiled]. *)
+  }
+  [@@deriving show]
+
+  (* The captures of successive matches, laid out one after another in the
+     same offset array. [first] is the captures of the first match (if any);
+     the others differ only in [base]. *)
+  type captures_batch = { first : captures; count : int } [@@deriving show]
+
   let range_of_match (_, start, end_) = { start; end_ }
 
   let substring_of_match (subject, start, end_) =
-    String.sub subject start (end_ - start)
+    Bindings.subject_sub subject start (end_ - start)
 
-  let range_of_captures (_, matches, _) =
-    (* Array should always be at least length 1 *)
-    let start, end_ = matches.(0) in
-    { start; end_ }
+  let range_of_captures (c : captures) =
+    (* There should always be at least one pair *)
+    { start = c.ovector.(c.base); end_ = c.ovector.(c.base + 1) }
 
-  let captures_length ((_, matches, _) : captures) : int = Array.length matches
+  let captures_length (c : captures) : int = c.pairs
 
-  let get_match i matches =
-    if 0 <= i && i < Array.length matches then
-      let ((start, end_) as match_) = matches.(i) in
-      if match_ = Bindings.unset then None else Some (start, end_)
+  let get_match i (c : captures) =
+    if 0 <= i && i < c.pairs then
+      let start = c.ovector.(c.base + (2 * i)) in
+      if start < 0 then None else Some (start, c.ovector.(c.base + (2 * i) + 1))
     else None
 
-  let match_of_captures ((subject, matches, _) : captures) (i : int) :
+  (* Compares the offsets of the groups, rather than the representation, since
+     equal captures may be views into different arrays. *)
+  let equal_captures (a : captures) (b : captures) : bool =
+    equal_subject a.subject b.subject
+    && a.pairs = b.pairs
+    && (a.names == b.names
+       || Hashtbl.length a.names = Hashtbl.length b.names
+          && Hashtbl.fold
+               (fun name i acc ->
+                 acc && List.mem i (Hashtbl.find_all b.names name))
+               a.names true)
+    && List.for_all
+         (fun i -> get_match i a = get_match i b)
+         (List.init a.pairs Fun.id)
+
+  let match_of_captures (c : captures) (i : int) : match_ option =
+    get_match i c >+= fun (start, end_) -> (c.subject, start, end_)
+
+  let named_match_of_captures (c : captures) (group_name : string) :
       match_ option =
-    get_match i matches >+= fun (start, end_) -> (subject, start, end_)
-
-  let named_match_of_captures ((subject, matches, names) : captures)
-      (group_name : string) : match_ option =
-    Array.find_map
-      (fun (s, i) ->
-        if String.equal group_name s then get_match i matches else None)
-      names
-    >+= fun (start, end_) -> (subject, start, end_)
+    (* With [DUPNAMES] several groups may share a name, in which case the first
+       of them that is set is used. *)
+    List.find_map
+      (fun i -> get_match i c)
+      (Hashtbl.find_all c.names group_name)
+    >+= fun (start, end_) -> (c.subject, start, end_)
+
+  let captures_batch_length (b : captures_batch) : int = b.count
+
+  let captures_of_batch (b : captures_batch) (i : int) : captures =
+    if 0 <= i && i < b.count then { b.first with base = 2 * b.first.pairs * i }
+    else invalid_arg "captures_of_batch: index out of bounds"
 end
 
 include Match
@@ -331,6 +382,8 @@ module Error = struct
     | INTERNAL_DUPMATCH
     | DFA_UINVALID_UTF
     | INVALIDOFFSET
+    | TIMEOUT
+    | CANCELLED
   [@@deriving show, eq]
 
   let match_error_of_int : int -> match_error = function
@@ -404,6 +457,9 @@ module Error = struct
     | -65 -> INTERNAL_DUPMATCH
     | -66 -> DFA_UINVALID_UTF
     | -67 -> INVALIDOFFSET
+    (* Not PCRE2's own, but returned by the bindings for guarded matches. *)
+    | -1000 -> TIMEOUT
+    | -1001 -> CANCELLED
     | n -> invalid_arg (Printf.sprintf "%d is not a valid PCRE2 match error" n)
 end
 
@@ -446,8 +502,8 @@ module Options = struct
       | `NOTEOL           -> 0x00000002l
       | `NOTEMPTY         -> 0x00000004l
       | `NOTEMPTY_ATSTART -> 0x00000008l
-      | `PARTIAL_HARD     -> 0x00000010l
-      | `PARTIAL_SOFT     -> 0x00000020l
+      | `PARTIAL_SOFT     -> 0x00000010l
+      | `PARTIAL_HARD     -> 0x00000020l
     [@@ocamlformat "disable"]
 
     let bitvector_of_match_options (opts : match_option list) : int32 =
@@ -623,11 +679,30 @@ type dfa_match_option =
   | `DFA_SHORTEST ]
 [@@deriving show, eq]
 
+let int32_of_dfa_match_option : dfa_match_option -> int32 = function
+  | #Options.Jit.match_option as o -> Options.Jit.int32_of_match_option o
+  | #Options.Interp.compile_match_options as o ->
+      Options.Interp.int32_of_compile_match_option o
+  | `COPY_MATCHED_SUBJECT -> 0x00004000l
+  | `DISABLE_RECURSELOOP_CHECK -> 0x00040000l
+  | `DFA_RESTART -> 0x00000040l
+  | `DFA_SHORTEST -> 0x00000080l
+
+let bitvector_of_dfa_match_options (opts : dfa_match_option list) : int32 =
+  opts |> List.map int32_of_dfa_match_option |> List.fold_left Int32.logor 0l
+
 let version : int * int = Bindings.get_version ()
 (* FIXME?: depends on the header, instead of what is actually dynamically loaded. *)
 
 let config_unicode : bool = true
 
+type memory_usage = { regexes : int; code_bytes : int; jit_bytes : int }
+[@@deriving show, eq]
+
+let memory_usage () : memory_usage =
+  let regexes, code_bytes, jit_bytes = Bindings.memory_usage () in
+  { regexes; code_bytes; jit_bytes }
+
 (** Default limit for calls to internal matching function *)
 let config_match_limit : int = -1
 
@@ -637,63 +712,681 @@ let config_depth_limit : int = -1
 (** Indicates use of stack recursion in matching function *)
 let config_stackrecurse : bool = true
 
-module Interp = struct
-  include Options.Interp
-  include Match
-  include Error
+module Cancel = struct
+  type t = Bindings.cancel_flag
 
-  type t = Bindings.interp Bindings.regex
+  let create : unit -> t = Bindings.cancel_flag_create
+  let cancel : t -> unit = Bindings.cancel_flag_set
+  let is_cancelled : t -> bool = Bindings.cancel_flag_is_set
+end
 
-  let compile ?(options : compile_option list = []) (pattern : string) :
-      (t, compile_error) Result.t =
-    let options = bitvector_of_compile_options options in
-    (* TODO: error location? *)
-    Bindings.pcre2_compile pattern options
-    |> Result.map_error compile_error_of_int
+type limits = {
+  match_limit : int option;
+  depth_limit : int option;
+  heap_limit : int option;
+  timeout : float option;
+  cancel : Cancel.t option;
+}
+
+let no_limits : limits =
+  {
+    match_limit = None;
+    depth_limit = None;
+    heap_limit = None;
+    timeout = None;
+    cancel = None;
+  }
+
+(* The match context enforcing [limits], which is [None] when there are none,
+   so that the default match context is used. *)
+let match_context_of_limits (limits : limits) : Bindings.match_context option
+    =
+  let int_of_limit = function
+    | None -> -1
+    | Some n when n >= 0 -> n
+    | Some _ -> invalid_arg "limits: a limit must not be negative"
+  in
+  let ns_of_timeout = function
+    | None -> -1
+    | Some t when t >= 0. -> int_of_float (Float.min (t *. 1e9) 1e18)
+    | Some _ -> invalid_arg "limits: a limit must not be negative"
+  in
+  match limits with
+  | {
+   match_limit = None;
+   depth_limit = None;
+   heap_limit = None;
+   timeout = None;
+   cancel = None;
+  } ->
+      None
+  | _ ->
+      Some
+        (Bindings.match_context_create
+           (int_of_limit limits.match_limit)
+           (int_of_limit limits.depth_limit)
+           (int_of_limit limits.heap_limit)
+           (ns_of_timeout limits.timeout)
+           limits.cancel)
+
+(* A literal which every match of a pattern contains, compared caselessly (for
+   ASCII letters only) if [caseless]. *)
+type required_literal = { bytes : string; caseless : bool }
+
+(* The longest literal which every match of [pattern] contains, if it can be
+   found without compiling the pattern. This errs towards [None]: groups and
+   classes are skipped rather than looked into, and a pattern with alternatives
+   at the top level, ignored whitespace, empty classes, [\Q] or [(*ACCEPT)] has
+   none. *)
+let required_literal (options : int32) (pattern : string) :
+    required_literal option =
+  let has option =
+    Int32.logand options (Options.Interp.int32_of_compile_option option) <> 0l
+  in
+  let n = String.length pattern in
+  (* The first index of [sub] in [pattern] from [i]. *)
+  let rec find ?(i = 0) sub =
+    if i + String.length sub > n then None
+    else if String.sub pattern i (String.length sub) = sub then Some i
+    else find ~i:(i + 1) sub
+  in
+  let occurs sub = find sub <> None in
+  (* Whether an option setting such as [(?i)] or [(?s-x:] includes [c]. *)
+  let rec sets_inline ?(i = 0) c =
+    match String.index_from_opt pattern i '(' with
+    | None -> false
+    | Some i ->
+        let rec letters j =
+          j < n
+          && (pattern.[j] = c
+             ||
+             match pattern.[j] with
+             | 'a' .. 'z' | 'A' .. 'Z' | '-' | '^' -> letters (j + 1)
+             | _ -> false)
+        in
+        (i + 1 < n && pattern.[i + 1] = '?' && letters (i + 2))
+        || sets_inline ~i:(i + 1) c
+  in
+  let caseless = has `CASELESS || sets_inline 'i' in
+  (* With Unicode case folding, [k] and [s] also match the Kelvin sign and the
+     long s. A leading [(*UTF)] or [(*UCP)] turns it on like the options. *)
+  let unicode = has `UTF || has `UCP || occurs "(*UTF" || occurs "(*UCP" in
+  let literal_byte c =
+    (not caseless)
+    || Char.code c < 0x80
+       && not (unicode && String.contains "kKsS" c)
+  in
+  let best = ref "" in
+  let run = Buffer.create 16 in
+  let end_run () =
+    if Buffer.length run > String.length !best then best := Buffer.contents run;
+    Buffer.clear run
+  in
+  (* Whether the run follows an escape which may continue with characters that
+     look like literals, such as the digits of [\x41]. *)
+  let tainted = ref false in
+  let end_run () =
+    if not !tainted then end_run () else Buffer.clear run;
+    tainted := false
+  in
+  let add c = if literal_byte c then Buffer.add_char run c else end_run () in
+  (* Drops the last character of the run, including any UTF-8 continuation
+     bytes, since a quantifier makes it optional. *)
+  let drop_last () =
+    let len = ref (Buffer.length run - 1) in
+    while !len > 0 && Char.code (Buffer.nth run !len) land 0xc0 = 0x80 do
+      decr len
+    done;
+    Buffer.truncate run (max 0 !len)
+  in
+  let rec digits j =
+    if j < n && pattern.[j] >= '0' && pattern.[j] <= '9' then digits (j + 1)
+    else j
+  in
+  (* The end of a quantifier at [i] and whether it allows no repetition. *)
+  let quantifier i =
+    if i >= n then None
+    else
+      match pattern.[i] with
+      | '?' | '*' -> Some (i + 1, true)
+      | '+' -> Some (i + 1, false)
+      | '{' ->
+          let j = digits (i + 1) in
+          let k = if j < n && pattern.[j] = ',' then digits (j + 1) else j in
+          if k < n && pattern.[k] = '}' && (j > i + 1 || k > j + 1) then
+            let min = String.sub pattern (i + 1) (j - i - 1) in
+            Some (k + 1, min = "" || int_of_string_opt min = Some 0)
+          else None
+      | _ -> None
+  in
+  let lazy_or_possessive j =
+    if j < n && (pattern.[j] = '?' || pattern.[j] = '+') then j + 1 else j
+  in
+  (* The end of the class opened at [i], if it is terminated. *)
+  let skip_class i =
+    let j = if i + 1 < n && pattern.[i + 1] = '^' then i + 2 else i + 1 in
+    let j = if j < n && pattern.[j] = ']' then j + 1 else j in
+    let rec go j =
+      if j >= n then None
+      else
+        match pattern.[j] with
+        | '\\' -> go (j + 2)
+        | ']' -> Some (j + 1)
+        | '[' -> (
+            (* A POSIX class such as [[:alpha:]] ends with the first [:]]. *)
+            match (find ~i:j ":]", String.index_from_opt pattern j ']') with
+            | Some k, Some l when pattern.[j + 1] = ':' && k + 1 = l ->
+                go (l + 1)
+            | _ -> go (j + 1))
+        | _ -> go (j + 1)
+    in
+    go j
+  in
+  (* The end of the callout whose argument starts at [i], such as [1)] or
+     ['text')], in which a doubled delimiter stands for itself. *)
+  let callout_end i =
+    if i < n && String.contains "`'\"^%#${" pattern.[i] then
+      let close = if pattern.[i] = '{' then '}' else pattern.[i] in
+      let rec go j =
+        match String.index_from_opt pattern j close with
+        | Some k when k + 1 < n && pattern.[k + 1] = ')' -> Some (k + 2)
+        | Some k when k + 1 < n && pattern.[k + 1] = close && close <> '}' ->
+            go (k + 2)
+        | _ -> None
+      in
+      go (i + 1)
+    else
+      let j = digits i in
+      if j < n && pattern.[j] = ')' then Some (j + 1) else None
+  in
+  (* The end of any comments and callouts at [i], which match nothing, so a
+     quantifier after them applies to the item before them. *)
+  let rec skip_ignored i =
+    if i + 2 < n && pattern.[i] = '(' && pattern.[i + 1] = '?' then (
+      let next =
+        match pattern.[i + 2] with
+        | '#' ->
+            (* A comment, which ends at the first [)]. *)
+            Option.map succ (String.index_from_opt pattern i ')')
+        | 'C' -> callout_end (i + 3)
+        | _ -> None
+      in
+      match next with Some j -> skip_ignored j | None -> i)
+    else i
+  in
+  (* The end of the group opened at [i], if it is terminated. *)
+  let skip_group i =
+    let rec go j depth =
+      if j >= n then None
+      else
+        match pattern.[j] with
+        | '\\' -> go (j + 2) depth
+        | '[' -> Option.bind (skip_class j) (fun k -> go k depth)
+        | '(' when skip_ignored j > j -> go (skip_ignored j) depth
+        | '(' -> go (j + 1) (depth + 1)
+        | ')' when depth = 1 -> Some (j + 1)
+        | ')' -> go (j + 1) (depth - 1)
+        | _ -> go (j + 1) depth
+    in
+    go i 0
+  in
+  (* The end of the escape at [i], and whether it continues with characters
+     (such as the digits of [\x41]) which might be taken for literals. *)
+  let skip_escape i =
+    match pattern.[i + 1] with
+    | ('p' | 'P' | 'x' | 'o' | 'g' | 'k' | 'N')
+      when i + 2 < n && String.contains "{<'" pattern.[i + 2] -> (
+        let close =
+          match pattern.[i + 2] with '{' -> '}' | '<' -> '>' | _ -> '\''
+        in
+        match String.index_from_opt pattern (i + 2) close with
+        | Some k -> (k + 1, false)
+        | None -> (n, true))
+    | c -> (i + 2, not (String.contains "dDwWsSbBhHvVRNAzZGKXCEtnrfea" c))
+  in
+  let rec scan i =
+    if i >= n then true
+    else
+      match pattern.[i] with
+      | '|' -> false
+      | ('.' | '^' | '$') as c ->
+          end_run ();
+          if c = '.' then scan (after_atom (i + 1)) else scan (i + 1)
+      | '[' -> (
+          end_run ();
+          match skip_class i with Some j -> scan (after_atom j) | None -> false)
+      | '(' when skip_ignored i > i -> scan (skip_ignored i)
+      | '(' -> (
+          end_run ();
+          match skip_group i with Some j -> scan (after_atom j) | None -> false)
+      | ')' | '?' | '*' | '+' | '{' -> false
+      | '\\' when i + 1 >= n -> false
+      | '\\' -> (
+          match pattern.[i + 1] with
+          | 'a' .. 'z' | 'A' .. 'Z' | '0' .. '9' ->
+              end_run ();
+              let j, taints = skip_escape i in
+              tainted := taints;
+              scan (after_atom j)
+          | c -> literal c (i + 2))
+      | c -> literal c (i + 1)
+  and literal c j =
+    add c;
+    match quantifier (skip_ignored j) with
+    | Some (k, optional) ->
+        if optional then drop_last ();
+        end_run ();
+        scan (lazy_or_possessive k)
+    | None -> scan j
+  and after_atom j =
+    match quantifier (skip_ignored j) with
+    | Some (k, _) -> lazy_or_possessive k
+    | None -> j
+  in
+  let complete =
+    if has `LITERAL then (
+      String.iter add pattern;
+      true)
+    else
+      (not (List.exists has [ `EXTENDED; `EXTENDED_MORE; `ALLOW_EMPTY_CLASS ]))
+      && (not (sets_inline 'x'))
+      && (not (occurs "\\Q"))
+      && (not (occurs "(*ACCEPT"))
+      && scan 0
+  in
+  end_run ();
+  if complete && !best <> "" then Some { bytes = !best; caseless } else None
+
+(* A compiled pattern alongside information about it which is fixed at
+   compilation, so that it needn't be retrieved from PCRE2 on each use. *)
+type 'code compiled = {
+  code : 'code;
+  names : (string * int) array;
+      (** The name table, i.e. the name and number of each named group. *)
+  group_indices : (string, int) Hashtbl.t;
+      (** The same, indexed by name. Where names are duplicated,
+          [Hashtbl.find_all] returns their numbers in ascending order. *)
+  limits : limits;
+  context : Bindings.match_context option;
+      (** The match context enforcing [limits], created once and shared by
+          every match (in any domain) which does not override them. *)
+  literal : required_literal option;
+      (** A literal which every match contains, if one was found in the
+          pattern. *)
+}
+
+let compiled_of_code (code : 'a Bindings.regex) : 'a Bindings.regex compiled =
+  let names = Bindings.get_capture_groups code in
+  let group_indices = Hashtbl.create (Array.length names) in
+  (* PCRE2 orders entries with the same name by number, and [Hashtbl.find_all]
+     returns the most recently added first. *)
+  for i = Array.length names - 1 downto 0 do
+    let name, n = names.(i) in
+    Hashtbl.add group_indices name n
+  done;
+  {
+    code;
+    names;
+    group_indices;
+    limits = no_limits;
+    context = None;
+    literal = None;
+  }
+
+let with_limits (limits : limits) (re : 'code compiled) : 'code compiled =
+  { re with limits; context = match_context_of_limits limits }
+
+let limits (re : _ compiled) : limits = re.limits
+
+let group_index (re : _ compiled) (name : string) : int option =
+  Hashtbl.find_opt re.group_indices name
+
+type bigstring = Bindings.bigstring
+
+let set_release_lock_threshold (threshold : int option) : unit =
+  match threshold with
+  | Some n when n < 0 ->
+      invalid_arg "set_release_lock_threshold: threshold must not be negative"
+  | Some n -> Bindings.set_release_lock_threshold n
+  | None -> Bindings.set_release_lock_threshold (-1)
+
+let release_lock_threshold () : int option =
+  match Bindings.get_release_lock_threshold () with
+  | -1 -> None
+  | n -> Some n
+
+module Prefilter = struct
+  type stats = {
+    too_short : int;
+    no_first_code_unit : int;
+    no_last_code_unit : int;
+  }
+  [@@deriving show, eq]
 
-  let capture_groups (r : t) = Bindings.get_capture_groups r |> Array.to_list
+  let stats () : stats =
+    match Bindings.get_prefilter_rejections () with
+    | [| too_short; no_first_code_unit; no_last_code_unit |] ->
+        { too_short; no_first_code_unit; no_last_code_unit }
+    | _ -> assert false
 
-  let find ?(options : match_option list = []) ?(subject_offset : int = 0)
-      (re : t) (subject : string) : (match_ option, match_error) Result.t =
-    let options = bitvector_of_match_options options in
-    match Bindings.pcre2_match re subject subject_offset options with
+  let reset_stats : unit -> unit = Bindings.reset_prefilter_rejections
+end
+
+(* The window of [b] of [len] bytes from [pos] (by default, all of it), as a
+   subject. A window smaller than [b] is a view sharing its contents, so this
+   never copies. *)
+let subject_of_window (fn : string) ?(pos : int = 0) ?(len : int option)
+    (b : bigstring) : Bindings.subject =
+  let dim = Bigarray.Array1.dim b in
+  let len = Option.value len ~default:(dim - pos) in
+  if pos < 0 || len < 0 || pos > dim - len then
+    invalid_arg (fn ^ ": invalid window");
+  Bindings.subject_of_bigstring
+    (if pos = 0 && len = dim then b else Bigarray.Array1.sub b pos len)
+
+(* The PCRE2 entrypoints used by a backtracking matcher (i.e., the interpreter
+   or the JIT). *)
+module type Backtracking_engine = sig
+  type code
+  type match_option
+
+  val bitvector_of_match_options : match_option list -> int32
+  val match_data_create : code -> int -> Bindings.match_data
+
+  val match_ :
+    code ->
+    Bindings.match_data option ->
+    Bindings.match_context option ->
+    Bindings.subject ->
+    int ->
+    int32 ->
+    ((int * int) option, int) Result.t
+
+  val capture :
+    code ->
+    Bindings.match_data option ->
+    Bindings.match_context option ->
+    Bindings.subject ->
+    int ->
+    int32 ->
+    (int array option, int) Result.t
+
+  val is_match :
+    code ->
+    Bindings.match_data option ->
+    Bindings.match_context option ->
+    Bindings.subject ->
+    int ->
+    int32 ->
+    int
+
+  val find_into :
+    code ->
+    Bindings.match_data option ->
+    Bindings.match_context option ->
+    Bindings.subject ->
+    int ->
+    int32 ->
+    int array ->
+    int
+
+  val find_partial_into :
+    code ->
+    Bindings.match_data option ->
+    Bindings.match_context option ->
+    Bindings.subject ->
+    int ->
+    int32 ->
+    int array ->
+    int
+
+  val find_all :
+    code ->
+    Bindings.match_data option ->
+    Bindings.match_context option ->
+    Bindings.subject ->
+    int ->
+    int32 ->
+    int ->
+    bool ->
+    int array * int
+
+  val captures_all :
+    code ->
+    Bindings.match_data option ->
+    Bindings.match_context option ->
+    Bindings.subject ->
+    int ->
+    int32 ->
+    int ->
+    bool ->
+    int array * int * int
+
+  val scan_file :
+    code ->
+    Bindings.match_data option ->
+    Bindings.match_context option ->
+    string ->
+    int32 ->
+    int ->
+    int array * int
+end
+
+(* Matching functions shared by the backtracking matchers, which differ only in
+   the PCRE2 entrypoint used. Everything is implemented in terms of handles so
+   that iteration reuses the same match data for every match. *)
+module Make_backtracking (E : Backtracking_engine) = struct
+  type t = E.code compiled
+  type nonrec limits = limits
+
+  type handle = {
+    re : t;
+    data : Bindings.match_data option;
+        (* Always [Some _]; kept as an option since that is what the bindings
+           take, so it needn't be allocated on every match. *)
+    context : Bindings.match_context option;
+    options : int32;
+  }
+
+  let handle ?(options : E.match_option list = []) ?(captures : bool = true)
+      ?(limits : limits option) (re : t) : handle =
+    (* A single pair in the offset vector suffices for the range of the whole
+       match; otherwise size it to the number of capture groups in [re]. *)
+    let pairs = if captures then 0 else 1 in
+    {
+      re;
+      data = Some (E.match_data_create re.code pairs);
+      context =
+        (match limits with
+        | None -> re.context
+        | Some limits -> match_context_of_limits limits);
+      options = E.bitvector_of_match_options options;
+    }
+
+  (* [Ok true] and [Ok false] are static constants, so this only allocates in
+     the case of an error. *)
+  let bool_result_of_code (code : int) : (bool, match_error) Result.t =
+    if code > 0 then Ok true
+    else if code = 0 then Ok false
+    else Error (match_error_of_int code)
+
+  let find_with_subject ?(subject_offset : int = 0) (h : handle)
+      (subject : subject) : (match_ option, match_error) Result.t =
+    match
+      E.match_ h.re.code h.data h.context subject subject_offset h.options
+    with
+    | Ok (Some (start, end_)) -> Ok (Some (subject, start, end_))
+    | Ok None -> Ok None
+    | Error n -> Error (match_error_of_int n)
+
+  let captures_of_ovector (re : t) (subject : subject) (ovector : int array) :
+      captures =
+    {
+      subject;
+      ovector;
+      base = 0;
+      pairs = Array.length ovector / 2;
+      names = re.group_indices;
+    }
+
+  let captures_with_subject ?(subject_offset : int = 0) (h : handle)
+      (subject : subject) : (captures option, match_error) Result.t =
+    match
+      E.capture h.re.code h.data h.context subject subject_offset h.options
+    with
+    | Ok (Some ovector) -> Ok (Some (captures_of_ovector h.re subject ovector))
+    | Ok None -> Ok None
+    | Error n -> Error (match_error_of_int n)
+
+  let is_match_with_subject ?(subject_offset : int = 0) (h : handle)
+      (subject : subject) : (bool, match_error) Result.t =
+    E.is_match h.re.code h.data h.context subject subject_offset h.options
+    |> bool_result_of_code
+
+  let find_into_subject ?(subject_offset : int = 0) (h : handle)
+      (subject : subject) (buffer : int array) : (bool, match_error) Result.t =
+    if Array.length buffer < 2 then
+      invalid_arg "find_into: the buffer must have a length of at least 2";
+    E.find_into h.re.code h.data h.context subject subject_offset h.options
+      buffer
+    |> bool_result_of_code
+
+  let find_subject ?(options : E.match_option list = [])
+      ?(subject_offset : int = 0) (re : t) (subject : subject) :
+      (match_ option, match_error) Result.t =
+    let options = E.bitvector_of_match_options options in
+    match E.match_ re.code None re.context subject subject_offset options with
     | Ok (Some (start, end_)) -> Ok (Some (subject, start, end_))
     | Ok None -> Ok None
     | Error n -> Error (match_error_of_int n)
 
-  let find_iter ?(options : match_option list = []) ?(subject_offset : int = 0)
-      (re : t) (subject : string) : (match_, match_error) Result.t Seq.t =
-    Seq.unfold
-      (fun offset ->
-        match find ~options ~subject_offset:offset re subject with
-        | Ok (Some (m : match_)) -> Some (Ok m, (range_of_match m).end_)
-        | Ok None -> None
-        | Error e -> Some (Error e, String.length subject))
-      subject_offset
-
-  let captures ?(options : match_option list = []) ?(subject_offset : int = 0)
-      (re : t) (subject : string) : (captures option, match_error) Result.t =
-    let options = bitvector_of_match_options options in
-    match Bindings.pcre2_capture re subject subject_offset options with
-    | Ok (Some (arr, names)) -> Ok (Some (subject, arr, names))
+  (* The bindings take a negative count to mean there is no maximum. *)
+  let int_of_max_count (fn : string) : int option -> int = function
+    | None -> -1
+    | Some n when n >= 0 -> n
+    | Some _ -> invalid_arg (fn ^ ": max_count must not be negative")
+
+  let find_all_subject ?(options : E.match_option list = [])
+      ?(subject_offset : int = 0) ?(max_count : int option) (re : t)
+      (subject : subject) :
+      (int array, match_error) Result.t =
+    let max_count = int_of_max_count "find_all" max_count in
+    let options = E.bitvector_of_match_options options in
+    match
+      E.find_all re.code None re.context subject subject_offset options
+        max_count false
+    with
+    | offsets, 0 -> Ok offsets
+    | _, n -> Error (match_error_of_int n)
+
+  let find_all_with_subject ?(subject_offset : int = 0)
+      ?(max_count : int option) (h : handle) (subject : subject) :
+      (int array, match_error) Result.t =
+    let max_count = int_of_max_count "find_all_with" max_count in
+    match
+      E.find_all h.re.code h.data h.context subject subject_offset h.options
+        max_count false
+    with
+    | offsets, 0 -> Ok offsets
+    | _, n -> Error (match_error_of_int n)
+
+  (* The number of matches retrieved by each call to the bindings when
+     iterating lazily. *)
+  let iter_batch_size = 32
+
+  let find_iter_subject ?(options : E.match_option list = [])
+      ?(subject_offset : int = 0) (re : t) (subject : subject) :
+      (match_, match_error) Result.t Seq.t =
+   fun () ->
+    (* Created on traversal, rather than up front, so that each traversal of
+       the sequence has its own handle. *)
+    let h = handle ~options ~captures:false re in
+    let rec batch offset after_empty () =
+      let offsets, status =
+        E.find_all h.re.code h.data h.context subject offset h.options
+          iter_batch_size after_empty
+      in
+      let n = Array.length offsets / 2 in
+      let rec emit i () =
+        if i < n then
+          Seq.Cons
+            (Ok (subject, offsets.(2 * i), offsets.((2 * i) + 1)), emit (i + 1))
+        else if status < 0 then
+          Seq.Cons (Error (match_error_of_int status), Seq.empty)
+        else if n < iter_batch_size then Seq.Nil
+        else
+          (* There may be more matches; resume after the last one. *)
+          let start = offsets.(2 * (n - 1)) and end_ = offsets.((2 * n) - 1) in
+          batch end_ (start = end_) ()
+      in
+      emit 0 ()
+    in
+    batch subject_offset false ()
+
+  let captures_subject ?(options : E.match_option list = [])
+      ?(subject_offset : int = 0) (re : t) (subject : subject) :
+      (captures option, match_error) Result.t =
+    let options = E.bitvector_of_match_options options in
+    match E.capture re.code None re.context subject subject_offset options with
+    | Ok (Some ovector) -> Ok (Some (captures_of_ovector re subject ovector))
     | Ok None -> Ok None
     | Error n -> Error (match_error_of_int n)
 
-  let captures_iter ?(options : match_option list = [])
-      ?(subject_offset : int = 0) (re : t) (subject : string) :
+  let captures_batch_of_ovector (re : t) (subject : subject)
+      (ovector : int array) (pairs : int) : captures_batch =
+    {
+      first =
+        { subject; ovector; base = 0; pairs; names = re.group_indices };
+      count = (if pairs > 0 then Array.length ovector / (2 * pairs) else 0);
+    }
+
+  let captures_all_subject ?(options : E.match_option list = [])
+      ?(subject_offset : int = 0) ?(max_count : int option) (re : t)
+      (subject : subject) : (captures_batch, match_error) Result.t =
+    let max_count = int_of_max_count "captures_all" max_count in
+    let options = E.bitvector_of_match_options options in
+    match
+      E.captures_all re.code None re.context subject subject_offset options
+        max_count false
+    with
+    | ovector, pairs, 0 ->
+        Ok (captures_batch_of_ovector re subject ovector pairs)
+    | _, _, n -> Error (match_error_of_int n)
+
+  let captures_iter_subject ?(options : E.match_option list = [])
+      ?(subject_offset : int = 0) (re : t) (subject : subject) :
       (captures, match_error) Result.t Seq.t =
-    Seq.unfold
-      (fun offset ->
-        match captures ~options ~subject_offset:offset re subject with
-        | Ok (Some (c : captures)) -> Some (Ok c, (range_of_captures c).end_)
-        | Ok None -> None
-        | Error e -> Some (Error e, String.length subject))
-      subject_offset
-
-  let split ?(options : match_option list = []) ?(subject_offset : int = 0)
+   fun () ->
+    let h = handle ~options re in
+    let rec batch offset after_empty () =
+      let ovector, pairs, status =
+        E.captures_all h.re.code h.data h.context subject offset h.options
+          iter_batch_size after_empty
+      in
+      let b = captures_batch_of_ovector h.re subject ovector pairs in
+      let rec emit i () =
+        if i < b.count then Seq.Cons (Ok (captures_of_batch b i), emit (i + 1))
+        else if status < 0 then
+          Seq.Cons (Error (match_error_of_int status), Seq.empty)
+        else if b.count < iter_batch_size then Seq.Nil
+        else
+          (* There may be more matches; resume after the last one. *)
+          let { start; end_ } =
+            range_of_captures (captures_of_batch b (i - 1))
+          in
+          batch end_ (start = end_) ()
+      in
+      emit 0 ()
+    in
+    batch subject_offset false ()
+
+  let split ?(options : E.match_option list = []) ?(subject_offset : int = 0)
       ?(limit : int option) (re : t) (subject : string) :
       (string list, match_error) Result.t =
-    let delims = find_iter ~options ~subject_offset re subject in
+    let delims =
+      find_iter_subject ~options ~subject_offset re
+        (Bindings.subject_of_string subject)
+    in
     let delims =
       match limit with
       | Some n when n > 0 -> Seq.take (n - 1) delims
@@ -723,9 +1416,305 @@ module Interp = struct
          the right order. *)
       |> List.rev)
 
-  let is_match ?(options : match_option list = []) ?(subject_offset : int = 0)
-      (re : t) (subject : string) : (bool, match_error) Result.t =
-    find ~options ~subject_offset re subject |> Result.map Option.is_some
+  let is_match_subject ?(options : E.match_option list = [])
+      ?(subject_offset : int = 0) (re : t) (subject : subject) :
+      (bool, match_error) Result.t =
+    let options = E.bitvector_of_match_options options in
+    E.is_match re.code None re.context subject subject_offset options
+    |> bool_result_of_code
+
+  (* The matching functions above are written for any subject; these are
+     their specializations to strings and bigstrings. *)
+
+  let find_with ?subject_offset h s =
+    find_with_subject ?subject_offset h (Bindings.subject_of_string s)
+
+  let captures_with ?subject_offset h s =
+    captures_with_subject ?subject_offset h (Bindings.subject_of_string s)
+
+  let is_match_with ?subject_offset h s =
+    is_match_with_subject ?subject_offset h (Bindings.subject_of_string s)
+
+  let find_into ?subject_offset h s buffer =
+    find_into_subject ?subject_offset h (Bindings.subject_of_string s) buffer
+
+  let find_all_with ?subject_offset ?max_count h s =
+    find_all_with_subject ?subject_offset ?max_count h
+      (Bindings.subject_of_string s)
+
+  let find ?options ?subject_offset re s =
+    find_subject ?options ?subject_offset re (Bindings.subject_of_string s)
+
+  let find_all ?options ?subject_offset ?max_count re s =
+    find_all_subject ?options ?subject_offset ?max_count re
+      (Bindings.subject_of_string s)
+
+  let find_iter ?options ?subject_offset re s =
+    find_iter_subject ?options ?subject_offset re (Bindings.subject_of_string s)
+
+  let captures ?options ?subject_offset re s =
+    captures_subject ?options ?subject_offset re (Bindings.subject_of_string s)
+
+  let captures_all ?options ?subject_offset ?max_count re s =
+    captures_all_subject ?options ?subject_offset ?max_count re
+      (Bindings.subject_of_string s)
+
+  let captures_iter ?options ?subject_offset re s =
+    captures_iter_subject ?options ?subject_offset re
+      (Bindings.subject_of_string s)
+
+  let is_match ?options ?subject_offset re s =
+    is_match_subject ?options ?subject_offset re (Bindings.subject_of_string s)
+
+  let find_bigstring ?options ?subject_offset ?pos ?len re b =
+    find_subject ?options ?subject_offset re
+      (subject_of_window "find_bigstring" ?pos ?len b)
+
+  let find_all_bigstring ?options ?subject_offset ?max_count ?pos ?len re b =
+    find_all_subject ?options ?subject_offset ?max_count re
+      (subject_of_window "find_all_bigstring" ?pos ?len b)
+
+  let find_iter_bigstring ?options ?subject_offset ?pos ?len re b =
+    find_iter_subject ?options ?subject_offset re
+      (subject_of_window "find_iter_bigstring" ?pos ?len b)
+
+  let captures_bigstring ?options ?subject_offset ?pos ?len re b =
+    captures_subject ?options ?subject_offset re
+      (subject_of_window "captures_bigstring" ?pos ?len b)
+
+  let captures_all_bigstring ?options ?subject_offset ?max_count ?pos ?len re b
+      =
+    captures_all_subject ?options ?subject_offset ?max_count re
+      (subject_of_window "captures_all_bigstring" ?pos ?len b)
+
+  let captures_iter_bigstring ?options ?subject_offset ?pos ?len re b =
+    captures_iter_subject ?options ?subject_offset re
+      (subject_of_window "captures_iter_bigstring" ?pos ?len b)
+
+  (* This goes through [find_subject], rather than the allocation-free
+     [is_match_subject], since the latter may not release the runtime lock. *)
+  let is_match_bigstring ?options ?subject_offset ?pos ?len re b =
+    find_subject ?options ?subject_offset re
+      (subject_of_window "is_match_bigstring" ?pos ?len b)
+    |> Result.map Option.is_some
+
+  let scan_file ?(options : E.match_option list = [])
+      ?(max_count : int option) (re : t) (path : string) :
+      (located_match array, match_error) Result.t =
+    let max_count = int_of_max_count "scan_file" max_count in
+    let options = E.bitvector_of_match_options options in
+    match E.scan_file re.code None re.context path options max_count with
+    | located, 0 ->
+        Ok
+          (Array.init
+             (Array.length located / 4)
+             (fun i ->
+               let field j = located.((4 * i) + j) in
+               {
+                 range = { start = field 0; end_ = field 1 };
+                 line = field 2;
+                 column = field 3;
+               }))
+    | _, n -> Error (match_error_of_int n)
+
+  (* Matching over a stream. The subject searched by each [feed] is the tail
+     retained from earlier chunks followed by the new chunk; [base] is the
+     offset of the tail in the whole stream, and [resume] the offset in the
+     tail at which searching resumes. *)
+
+  type stream = {
+    stream_handle : handle;
+    lookbehind : int;
+    stream_buffer : int array;
+    mutable tail : string;
+    mutable base : int;
+    mutable resume : int;
+    mutable resume_after_empty : bool;
+    mutable fed : int;
+    mutable closed : bool;
+  }
+
+  let notbol = 0x00000001l
+  let notempty_atstart = 0x00000008l
+  let partial_soft = 0x00000010l
+  let partial_hard = 0x00000020l
+
+  let stream ?(options : E.match_option list = []) (re : t) : stream =
+    let h = handle ~options ~captures:false re in
+    (* Partial matching is the business of the stream alone. *)
+    let partial = Int32.logor partial_soft partial_hard in
+    let options = Int32.logand h.options (Int32.lognot partial) in
+    {
+      stream_handle = { h with options };
+      lookbehind = Bindings.max_lookbehind re.code;
+      stream_buffer = [| 0; 0 |];
+      tail = "";
+      base = 0;
+      resume = 0;
+      resume_after_empty = false;
+      fed = 0;
+      closed = false;
+    }
+
+  let stream_position (s : stream) : int = s.fed
+  let stream_retained (s : stream) : int = String.length s.tail
+
+  (* The bytes before the resume point which are kept whatever the
+     lookbehind, so that a multiline [^] or [\R] still sees the newline
+     before it, which may be [\r\n]. *)
+  let newline_context = 2
+
+  (* Drops the bytes of the tail before [keep], less those which a lookbehind
+     or a newline may need. The cut is moved back to the start of a UTF-8
+     character, should it fall within one. *)
+  let retain (s : stream) (subject : string) (keep : int) : unit =
+    let cut = ref (max 0 (keep - max newline_context s.lookbehind)) in
+    let steps = ref 0 in
+    while
+      !cut > 0
+      && !cut < String.length subject
+      && !steps < 3
+      && Char.code subject.[!cut] land 0xC0 = 0x80
+    do
+      decr cut;
+      incr steps
+    done;
+    let cut = !cut in
+    s.tail <- String.sub subject cut (String.length subject - cut);
+    s.base <- s.base + cut;
+    s.resume <- s.resume - cut
+
+  (* Searches [subject] from [s.resume], collecting the matches found in
+     [acc]. With [partial], stops at the first partial match, which may yet be
+     completed by later chunks. *)
+  let rec search (s : stream) ~(partial : bool) (subject : string)
+      (acc : range list) : (range list, match_error) Result.t =
+    let h = s.stream_handle in
+    let options = h.options in
+    let options = if s.base > 0 then Int32.logor options notbol else options in
+    let options =
+      if s.resume_after_empty then Int32.logor options notempty_atstart
+      else options
+    in
+    let options =
+      if partial then Int32.logor options partial_hard else options
+    in
+    let buffer = s.stream_buffer in
+    let code =
+      E.find_partial_into h.re.code h.data h.context
+        (Bindings.subject_of_string subject)
+        s.resume options buffer
+    in
+    match code with
+    | n when n > 0 ->
+        let start = buffer.(0) and end_ = buffer.(1) in
+        s.resume <- end_;
+        s.resume_after_empty <- start = end_;
+        search s ~partial subject
+          ({ start = s.base + start; end_ = s.base + end_ } :: acc)
+    | 0 | -2 (* PCRE2_ERROR_PARTIAL *) ->
+        (* Nothing can match before the partial match, if there is one, or
+           else before the end of the subject. *)
+        let keep = if code = 0 then String.length subject else buffer.(0) in
+        if keep > s.resume then (
+          s.resume <- keep;
+          s.resume_after_empty <- false);
+        retain s subject keep;
+        Ok (List.rev acc)
+    | n -> Error (match_error_of_int n)
+
+  let feed ?(pos : int = 0) ?(len : int option) (s : stream) (chunk : string)
+      : (range list, match_error) Result.t =
+    let len = Option.value len ~default:(String.length chunk - pos) in
+    if pos < 0 || len < 0 || pos > String.length chunk - len then
+      invalid_arg "feed: the range is not within the chunk";
+    if s.closed then invalid_arg "feed: the stream is finished";
+    let tail_length = String.length s.tail in
+    let subject = Bytes.create (tail_length + len) in
+    Bytes.blit_string s.tail 0 subject 0 tail_length;
+    Bytes.blit_string chunk pos subject tail_length len;
+    s.fed <- s.fed + len;
+    let result = search s ~partial:true (Bytes.unsafe_to_string subject) [] in
+    if Result.is_error result then s.closed <- true;
+    result
+
+  let finish (s : stream) : (range list, match_error) Result.t =
+    if s.closed then invalid_arg "finish: the stream is finished";
+    s.closed <- true;
+    let result = search s ~partial:false s.tail [] in
+    s.tail <- "";
+    result
+
+  let scan ~(fn : string) ?(options : E.match_option list option)
+      ?(chunk_size : int = 65536) (re : t)
+      (read : bytes -> int -> int -> int) (f : range -> unit) :
+      (unit, match_error) Result.t =
+    if chunk_size <= 0 then
+      invalid_arg (fn ^ ": chunk_size must be positive");
+    let s = stream ?options re in
+    let chunk = Bytes.create chunk_size in
+    let rec loop () =
+      match read chunk 0 chunk_size with
+      | 0 ->
+          let* ranges = finish s in
+          Ok (List.iter f ranges)
+      | n ->
+          (* SAFETY: [feed] copies the chunk rather than retaining it, so it
+             may be overwritten afterwards. *)
+          let* ranges = feed ~len:n s (Bytes.unsafe_to_string chunk) in
+          List.iter f ranges;
+          loop ()
+    in
+    loop ()
+
+  let scan_reader ?(options : E.match_option list option)
+      ?(chunk_size : int option) (re : t) (read : bytes -> int -> int -> int)
+      (f : range -> unit) : (unit, match_error) Result.t =
+    scan ~fn:"scan_reader" ?options ?chunk_size re read f
+
+  let scan_channel ?(options : E.match_option list option)
+      ?(chunk_size : int option) (re : t) (channel : in_channel)
+      (f : range -> unit) : (unit, match_error) Result.t =
+    scan ~fn:"scan_channel" ?options ?chunk_size re (input channel) f
+end
+
+module Interp = struct
+  include Options.Interp
+  include Match
+  include Error
+
+  include Make_backtracking (struct
+    type code = Bindings.interp Bindings.regex
+    type nonrec match_option = match_option
+
+    let bitvector_of_match_options = bitvector_of_match_options
+    let match_data_create = Bindings.pcre2_match_data_create
+    let match_ = Bindings.pcre2_match
+    let capture = Bindings.pcre2_capture
+    let is_match = Bindings.pcre2_is_match
+    let find_into = Bindings.pcre2_find_into
+    let find_partial_into = Bindings.pcre2_find_partial_into
+    let find_all = Bindings.pcre2_find_all
+    let captures_all = Bindings.pcre2_captures_all
+    let scan_file = Bindings.pcre2_scan_file
+  end)
+
+  let compile ?(options : compile_option list = []) (pattern : string) :
+      (t, compile_error) Result.t =
+    let bitvector = bitvector_of_compile_options options in
+    (* TODO: error location? *)
+    Bindings.pcre2_compile pattern bitvector
+    |> Result.map (fun code ->
+           {
+             (compiled_of_code code) with
+             literal = required_literal bitvector pattern;
+           })
+    |> Result.map_error compile_error_of_int
+
+  let capture_groups (r : t) = Array.to_list r.names
+  let group_index = group_index
+  let with_limits = with_limits
+  let limits = limits
 end
 
 (* Fastpath to JIT match for perf *)
@@ -739,7 +1728,25 @@ module Jit = struct
   include Match
   include Error
 
-  type t = Bindings.jit Bindings.regex
+  include Make_backtracking (struct
+    type code = Bindings.jit Bindings.regex
+    type nonrec match_option = match_option
+
+    let bitvector_of_match_options = bitvector_of_match_options
+    let match_data_create = Bindings.pcre2_match_data_create
+    let match_ = Bindings.pcre2_jit_match
+    let capture = Bindings.pcre2_jit_capture
+    let is_match = Bindings.pcre2_jit_is_match
+    let find_into = Bindings.pcre2_jit_find_into
+
+    (* pcre2_jit_match fails unless the regex was JIT compiled for partial
+       matching, whereas pcre2_match falls back on the interpreter. *)
+    let find_partial_into = Bindings.pcre2_find_partial_into
+
+    let find_all = Bindings.pcre2_jit_find_all
+    let captures_all = Bindings.pcre2_jit_captures_all
+    let scan_file = Bindings.pcre2_jit_scan_file
+  end)
 
   let of_interp ?(options : jit_only_compile_option list = [])
       ?(mode : matching_mode = JIT_COMPLETE) (interp : Interp.t) :
@@ -747,101 +1754,1135 @@ module Jit = struct
     let mode = int32_of_matching_mode mode in
     let options = Int32.logor mode (bitvector_of_compile_options options) in
     (* TODO: error location? *)
-    Bindings.pcre2_jit_compile interp options
+    Bindings.pcre2_jit_compile interp.code options
+    (* The name table is unaffected by JIT compilation. *)
+    |> Result.map (fun code -> { interp with code })
     |> Result.map_error compile_error_of_int
 
+  let split_options (options : compile_option list) :
+      Options.Interp.compile_option list * jit_only_compile_option list =
+    List.partition_map
+      (function
+        | #jit_only_compile_option as x -> Right x
+        | #Options.Interp.compile_option as x -> Left x
+        | _ -> .)
+      options
+
   let compile ?(options : compile_option list = []) (pattern : string) :
       (t, compile_error) Result.t =
-    let interp_options, jit_options =
-      List.partition_map
-        (function
-          | #jit_only_compile_option as x -> Right x
-          | #Options.Interp.compile_option as x -> Left x
-          | _ -> .)
-        options
-    in
+    let interp_options, jit_options = split_options options in
     let* interp = Interp.compile ~options:interp_options pattern in
     of_interp ~options:jit_options ~mode:JIT_COMPLETE interp
   (* TODO: determine best way to support matching mode with uniform interface.
      Probably make options more abstract in the shared interface *)
 
-  let capture_groups (r : t) = Bindings.get_capture_groups r |> Array.to_list
+  let compile_many ?(options : compile_option list = []) ?(threads : int = 0)
+      (patterns : string array) :
+      (t, compile_error) Result.t array * float array =
+    if threads < 0 then
+      invalid_arg "Jit.compile_many: threads must not be negative";
+    let interp_options, jit_options = split_options options in
+    let bitvector =
+      Options.Interp.bitvector_of_compile_options interp_options
+    in
+    let results, timings =
+      Bindings.pcre2_compile_many patterns bitvector
+        (Int32.logor
+           (int32_of_matching_mode JIT_COMPLETE)
+           (bitvector_of_compile_options jit_options))
+        threads
+    in
+    let result_of i r =
+      r
+      |> Result.map (fun code ->
+             {
+               (compiled_of_code code) with
+               literal = required_literal bitvector patterns.(i);
+             })
+      |> Result.map_error compile_error_of_int
+    in
+    (Array.mapi result_of results, timings)
 
-  let find ?(options : match_option list = []) ?(subject_offset : int = 0)
-      (re : t) (subject : string) : (match_ option, match_error) Result.t =
-    let options = bitvector_of_match_options options in
-    match Bindings.pcre2_jit_match re subject subject_offset options with
-    | Ok (Some (start, end_)) -> Ok (Some (subject, start, end_))
-    | Ok None -> Ok None
-    | Error n -> Error (match_error_of_int n)
+  let capture_groups (r : t) = Array.to_list r.names
+  let group_index = group_index
+  let with_limits = with_limits
+  let limits = limits
 
-  (* TODO(cooper): dedup impl with a functor? - entirely derived from find *)
-  let find_iter ?(options : match_option list = []) ?(subject_offset : int = 0)
-      (re : t) (subject : string) : (match_, match_error) Result.t Seq.t =
-    Seq.unfold
-      (fun offset ->
-        match find ~options ~subject_offset:offset re subject with
-        | Ok (Some (m : match_)) -> Some (Ok m, (range_of_match m).end_)
-        | Ok None -> None
-        | Error e -> Some (Error e, String.length subject))
-      subject_offset
-
-  let captures ?(options : match_option list = []) ?(subject_offset : int = 0)
-      (re : t) (subject : string) : (captures option, match_error) Result.t =
-    let options = bitvector_of_match_options options in
-    match Bindings.pcre2_jit_capture re subject subject_offset options with
-    | Ok (Some (arr, names)) -> Ok (Some (subject, arr, names))
-    | Ok None -> Ok None
-    | Error n -> Error (match_error_of_int n)
+  let set_stack_sizes ~(start : int) ~(max : int) : unit =
+    if start <= 0 || max < start then
+      invalid_arg "Jit.set_stack_sizes: require 0 < start <= max";
+    Bindings.set_jit_stack_sizes start max
+
+  let stack_sizes () : int * int = Bindings.get_jit_stack_sizes ()
+  let free_unused_memory () : unit = Bindings.jit_free_unused_memory ()
+end
+
+module Dfa = struct
+  include Match
+  include Error
+
+  type compile_option = Options.Interp.compile_option [@@deriving show, eq]
+  type match_option = dfa_match_option [@@deriving show, eq]
+
+  include Make_backtracking (struct
+    type code = Bindings.interp Bindings.regex
+    type nonrec match_option = match_option
+
+    let bitvector_of_match_options = bitvector_of_dfa_match_options
+    let match_data_create = Bindings.pcre2_dfa_match_data_create
+    let match_ = Bindings.pcre2_dfa_match
+    let capture = Bindings.pcre2_dfa_capture
+
+    (* Any match will do, so the DFA may stop at the first it finds rather than
+       seeking the longest. *)
+    let is_match re data context subject offset options =
+      Bindings.pcre2_dfa_is_match re data context subject offset
+        (Int32.logor options (int32_of_dfa_match_option `DFA_SHORTEST))
+
+    let find_into = Bindings.pcre2_dfa_find_into
+    let find_partial_into = Bindings.pcre2_dfa_find_partial_into
+    let find_all = Bindings.pcre2_dfa_find_all
+    let captures_all = Bindings.pcre2_dfa_captures_all
+    let scan_file = Bindings.pcre2_dfa_scan_file
+  end)
+
+  (* The DFA does not capture groups, so the name table is emptied lest names
+     be looked up among the alternative matches. *)
+  let of_interp (re : Interp.t) : t =
+    { re with names = [||]; group_indices = Hashtbl.create 0 }
+
+  let compile ?(options : compile_option list option) (pattern : string) :
+      (t, compile_error) Result.t =
+    Interp.compile ?options pattern |> Result.map of_interp
 
-  (* TODO(cooper): dedup impl with a functor? - entirely derived from
-     captures *)
-  let captures_iter ?(options : match_option list = [])
-      ?(subject_offset : int = 0) (re : t) (subject : string) :
+  let capture_groups (_ : t) = []
+  let group_index (_ : t) (_ : string) = None
+  let with_limits = with_limits
+  let limits = limits
+end
+
+(* Patterns which are plain literals are searched for without PCRE2, and so
+   without being compiled by it; all others fall through to the JIT. The
+   results are exactly those PCRE2 would give. *)
+module Literal = struct
+  include Match
+  include Error
+
+  type compile_option = Jit.compile_option [@@deriving show, eq]
+  type match_option = Options.Jit.match_option [@@deriving show, eq]
+  type literal = { needle : string; caseless : bool }
+  type t = Literal of literal | Pcre of Jit.t
+
+  (* A literal is non-empty, so the options concerning empty matches do not
+     affect it, nor does partial matching, which [find] and the like report as
+     no match. Nor do [`NOTBOL] and [`NOTEOL], without [^] or [$]. Without
+     [`UTF], PCRE2 only folds the case of ASCII letters. *)
+  let literal_of_pattern (options : compile_option list) (pattern : string) :
+      literal option =
+    let rec plain i =
+      i >= String.length pattern
+      || (not (String.contains "\\^$.|?*+()[]{}" pattern.[i])) && plain (i + 1)
+    in
+    let caseless = List.mem `CASELESS options in
+    if
+      pattern <> ""
+      && plain 0
+      && List.for_all (fun o -> o = `CASELESS) options
+    then Some { needle = pattern; caseless }
+    else None
+
+  let compile ?(options : compile_option list = []) (pattern : string) :
+      (t, compile_error) Result.t =
+    match literal_of_pattern options pattern with
+    | Some literal -> Ok (Literal literal)
+    | None -> Jit.compile ~options pattern |> Result.map (fun re -> Pcre re)
+
+  let is_literal : t -> bool = function Literal _ -> true | Pcre _ -> false
+
+  let capture_groups : t -> (string * int) list = function
+    | Literal _ -> []
+    | Pcre re -> Jit.capture_groups re
+
+  let group_index (re : t) (name : string) : int option =
+    match re with Literal _ -> None | Pcre re -> Jit.group_index re name
+
+  (* The start of the first occurrence of [lit] in [s] from [offset], which
+     must be within [s], or -1. *)
+  let search (lit : literal) (s : string) (offset : int) : int =
+    Bindings.literal_find lit.needle lit.caseless s offset
+
+  let valid_offset (s : string) (offset : int) : bool =
+    offset >= 0 && offset <= String.length s
+
+  let find ?(options : match_option list option) ?(subject_offset : int = 0)
+      (re : t) (s : string) : (match_ option, match_error) Result.t =
+    match re with
+    | Pcre re -> Jit.find ?options ~subject_offset re s
+    | Literal _ when not (valid_offset s subject_offset) -> Error BADOFFSET
+    | Literal lit -> (
+        match search lit s subject_offset with
+        | -1 -> Ok None
+        | start ->
+            Ok
+              (Some
+                 ( Bindings.subject_of_string s,
+                   start,
+                   start + String.length lit.needle )))
+
+  let find_all ?(options : match_option list option)
+      ?(subject_offset : int = 0) ?(max_count : int option) (re : t)
+      (s : string) : (int array, match_error) Result.t =
+    match re with
+    | Pcre re -> Jit.find_all ?options ~subject_offset ?max_count re s
+    | Literal _ when not (valid_offset s subject_offset) -> Error BADOFFSET
+    | Literal lit ->
+        let max_count =
+          match max_count with
+          | None -> max_int
+          | Some n when n >= 0 -> n
+          | Some _ -> invalid_arg "find_all: max_count must not be negative"
+        in
+        let length = String.length lit.needle in
+        let rec collect offset count acc =
+          if count >= max_count then acc
+          else
+            match search lit s offset with
+            | -1 -> acc
+            | start ->
+                collect (start + length) (count + 1)
+                  ((start + length) :: start :: acc)
+        in
+        Ok (Array.of_list (List.rev (collect subject_offset 0 [])))
+
+  let find_iter ?(options : match_option list option)
+      ?(subject_offset : int = 0) (re : t) (s : string) :
+      (match_, match_error) Result.t Seq.t =
+    match re with
+    | Pcre re -> Jit.find_iter ?options ~subject_offset re s
+    | Literal _ when not (valid_offset s subject_offset) ->
+        Seq.return (Error BADOFFSET)
+    | Literal lit ->
+        let subject = Bindings.subject_of_string s in
+        let length = String.length lit.needle in
+        let rec next offset () =
+          match search lit s offset with
+          | -1 -> Seq.Nil
+          | start ->
+              Seq.Cons
+                (Ok (subject, start, start + length), next (start + length))
+        in
+        next subject_offset
+
+  (* Literals have no capture groups, so their captures are only the whole
+     match. *)
+  let no_names : (string, int) Hashtbl.t = Hashtbl.create 0
+
+  let captures_of_offsets (subject : subject) (ovector : int array) : captures
+      =
+    { subject; ovector; base = 0; pairs = 1; names = no_names }
+
+  let captures ?(options : match_option list option)
+      ?(subject_offset : int = 0) (re : t) (s : string) :
+      (captures option, match_error) Result.t =
+    match re with
+    | Pcre re -> Jit.captures ?options ~subject_offset re s
+    | Literal _ ->
+        find ?options ~subject_offset re s
+        |> Result.map
+             (Option.map (fun (subject, start, end_) ->
+                  captures_of_offsets subject [| start; end_ |]))
+
+  let captures_iter ?(options : match_option list option)
+      ?(subject_offset : int = 0) (re : t) (s : string) :
       (captures, match_error) Result.t Seq.t =
-    Seq.unfold
-      (fun offset ->
-        match captures ~options ~subject_offset:offset re subject with
-        | Ok (Some (c : captures)) -> Some (Ok c, (range_of_captures c).end_)
-        | Ok None -> None
-        | Error e -> Some (Error e, String.length subject))
-      subject_offset
-
-  let split ?(options : match_option list = []) ?(subject_offset : int = 0)
-      ?(limit : int option) (re : t) (subject : string) :
+    match re with
+    | Pcre re -> Jit.captures_iter ?options ~subject_offset re s
+    | Literal _ ->
+        find_iter ?options ~subject_offset re s
+        |> Seq.map
+             (Result.map (fun (subject, start, end_) ->
+                  captures_of_offsets subject [| start; end_ |]))
+
+  let captures_all ?(options : match_option list option)
+      ?(subject_offset : int = 0) ?(max_count : int option) (re : t)
+      (s : string) : (captures_batch, match_error) Result.t =
+    match re with
+    | Pcre re -> Jit.captures_all ?options ~subject_offset ?max_count re s
+    | Literal _ ->
+        find_all ?options ~subject_offset ?max_count re s
+        |> Result.map (fun ovector ->
+               {
+                 first =
+                   captures_of_offsets (Bindings.subject_of_string s) ovector;
+                 count = Array.length ovector / 2;
+               })
+
+  let split ?(options : match_option list option) ?(subject_offset : int = 0)
+      ?(limit : int option) (re : t) (s : string) :
       (string list, match_error) Result.t =
-    let delims = find_iter ~options ~subject_offset re subject in
-    let delims =
-      match limit with
-      | Some n when n > 0 -> Seq.take (n - 1) delims
-      | None -> delims
-      | _ -> invalid_arg "todo: decide how to handle 0 or negative limit"
+    match re with
+    | Pcre re -> Jit.split ?options ~subject_offset ?limit re s
+    | Literal _ ->
+        let delims = find_iter ?options ~subject_offset re s in
+        let delims =
+          match limit with
+          | Some n when n > 0 -> Seq.take (n - 1) delims
+          | None -> delims
+          | _ -> invalid_arg "todo: decide how to handle 0 or negative limit"
+        in
+        let* end_offset, substrings =
+          Seq.fold_left
+            (fun x m ->
+              match (x, m) with
+              | Ok (start, acc), Ok (_, delim_start, delim_end) ->
+                  let sub = String.sub s start (delim_start - start) in
+                  Ok (delim_end, sub :: acc)
+              | e, _ -> e)
+            (Ok (0, []))
+            delims
+        in
+        Ok
+          (String.sub s end_offset (String.length s - end_offset) :: substrings
+          |> List.rev)
+
+  let is_match ?(options : match_option list option)
+      ?(subject_offset : int = 0) (re : t) (s : string) :
+      (bool, match_error) Result.t =
+    match re with
+    | Pcre re -> Jit.is_match ?options ~subject_offset re s
+    | Literal _ when not (valid_offset s subject_offset) -> Error BADOFFSET
+    | Literal lit -> Ok (search lit s subject_offset >= 0)
+end
+
+module Parallel = struct
+  include Domain_pool
+
+  module Make (M : Intf.Matcher_handle) = struct
+    let handles ?(options : M.match_option list option) (res : M.t array) :
+        M.handle array =
+      Array.map (fun re -> M.handle ?options ~captures:false re) res
+
+    let is_match ?(options : M.match_option list option) (pool : pool)
+        (re : M.t) (subjects : string array) :
+        (bool, M.match_error) Result.t array =
+      init pool (Array.length subjects)
+        ~state:(fun () -> M.handle ?options ~captures:false re)
+        (fun h i -> M.is_match_with h subjects.(i))
+
+    let find_all ?(options : M.match_option list option)
+        ?(max_count : int option) (pool : pool) (re : M.t)
+        (subjects : string array) : (int array, M.match_error) Result.t array
+        =
+      init pool (Array.length subjects)
+        ~state:(fun () -> M.handle ?options ~captures:false re)
+        (fun h i -> M.find_all_with ?max_count h subjects.(i))
+
+    let is_match_many ?(options : M.match_option list option) (pool : pool)
+        (res : M.t array) (subjects : string array) :
+        (bool, M.match_error) Result.t array array =
+      init pool (Array.length subjects)
+        ~state:(fun () -> handles ?options res)
+        (fun hs i -> Array.map (fun h -> M.is_match_with h subjects.(i)) hs)
+
+    let find_all_many ?(options : M.match_option list option)
+        ?(max_count : int option) (pool : pool) (res : M.t array)
+        (subjects : string array) :
+        (int array, M.match_error) Result.t array array =
+      init pool (Array.length subjects)
+        ~state:(fun () -> handles ?options res)
+        (fun hs i ->
+          Array.map (fun h -> M.find_all_with ?max_count h subjects.(i)) hs)
+  end
+
+  module Interp = Make (Interp)
+  module Jit = Make (Jit)
+end
+
+(* The patterns of a set are combined into a single regex, each atomic, within a
+   branch reset group to keep its group numbers its own, and followed by a
+   callout naming it. The callout records the first, so leftmost, match of each
+   pattern and then fails, so that a single pass of PCRE2 over the subject tries
+   every pattern at every position. Patterns which cannot be combined like this
+   without changing their meaning are matched on their own. *)
+module Set = struct
+  include Match
+  include Error
+
+  type compile_option = Options.Interp.compile_option [@@deriving show, eq]
+
+  type t = {
+    length : int;
+    combined : Jit.t option;
+    (* The index of each pattern which is matched on its own. *)
+    separate : (int * Jit.t) list;
+  }
+
+  (* The first index of [sub] in [pattern] at or after [i]. *)
+  let rec occurs_at ?(i : int = 0) (sub : string) (pattern : string) :
+      int option =
+    if i + String.length sub > String.length pattern then None
+    else if String.sub pattern i (String.length sub) = sub then Some i
+    else occurs_at ~i:(i + 1) sub pattern
+
+  (* Whether [sub] occurs in [pattern]. *)
+  let occurs (sub : string) (pattern : string) : bool =
+    occurs_at sub pattern <> None
+
+  (* Whether [pattern] has the same meaning within the combined regex: it must
+     not recurse, into itself or a group by name or by absolute or relative
+     number (which, within the branch reset group, is the first group of that
+     number, of whichever pattern), use verbs, callouts, [\Q] or [\K], nor
+     possibly comment out what follows it. Nor may it name groups, since the
+     groups of other patterns with the same numbers may be named otherwise,
+     which PCRE2 refuses. Literal patterns are quoted, so are always
+     combinable. *)
+  let combinable (options : compile_option list) (pattern : string) : bool =
+    List.mem `LITERAL options
+    ||
+    let extended =
+      List.mem `EXTENDED options
+      || List.mem `EXTENDED_MORE options
+      || occurs "(?" pattern
     in
-    let* end_offset, substrings =
-      Seq.fold_left
-        (fun x m ->
-          match (x, m) with
-          | Ok (start, acc), Ok m ->
-              let { start = delim_start; end_ = delim_end } =
-                range_of_match m
-              in
-              let sub = String.sub subject start (delim_start - start) in
-              Ok (delim_end, sub :: acc)
-          | e, _ -> e)
-        (Ok (0, []))
-        delims
+    let forbidden =
+      [
+        "(*"; "(?C"; "(?R"; "(?(R"; "(?&"; "(?P>"; "\\g<"; "\\g'"; "\\Q"; "\\K";
+        "(?P<"; "(?'";
+      ]
+      @ List.concat_map
+          (fun prefix -> List.init 10 (Printf.sprintf "%s%d" prefix))
+          [ "(?"; "(?-"; "(?+" ]
+    in
+    (* A named group, as opposed to a lookbehind. *)
+    let rec named ?(i = 0) () =
+      match occurs_at ~i "(?<" pattern with
+      | None -> false
+      | Some j ->
+          (j + 3 < String.length pattern
+          && pattern.[j + 3] <> '='
+          && pattern.[j + 3] <> '!')
+          || named ~i:(j + 1) ()
+    in
+    (not (List.exists (fun sub -> occurs sub pattern) forbidden))
+    && (not (named ()))
+    && not (extended && String.contains pattern '#')
+
+  (* [pattern] quoted by [\Q...\E], which it may itself contain. *)
+  let quote (pattern : string) : string =
+    let b = Buffer.create (String.length pattern + 4) in
+    Buffer.add_string b "\\Q";
+    let n = String.length pattern in
+    let rec go i =
+      if i < n then
+        if pattern.[i] = '\\' && i + 1 < n && pattern.[i + 1] = 'E' then (
+          Buffer.add_string b "\\E\\\\E\\Q";
+          go (i + 2))
+        else (
+          Buffer.add_char b pattern.[i];
+          go (i + 1))
+    in
+    go 0;
+    Buffer.add_string b "\\E";
+    Buffer.contents b
+
+  (* The patterns as one regex, each followed by a callout of its index. *)
+  let combine (options : compile_option list) (patterns : (int * string) list)
+      : string =
+    let quote = if List.mem `LITERAL options then quote else Fun.id in
+    patterns
+    |> List.map (fun (i, p) -> Printf.sprintf "(?>%s)(?C\"%d\")" (quote p) i)
+    |> String.concat "|"
+    |> Printf.sprintf "(?|%s)"
+
+  let compile ?(options : compile_option list = []) (patterns : string array) :
+      (t, int * compile_error) Result.t =
+    let compile_each f =
+      let rec go i acc =
+        if i = Array.length patterns then Ok (List.rev acc)
+        else
+          match f i patterns.(i) with
+          | Ok x -> go (i + 1) (x :: acc)
+          | Error e -> Error (i, e)
+      in
+      go 0 []
+    in
+    let jit i p =
+      Jit.compile ~options:(options :> Jit.compile_option list) p
+      |> Result.map (fun re -> (i, re))
+    in
+    let* checked =
+      compile_each (fun i p ->
+          Interp.compile ~options p |> Result.map (fun _ -> (i, p)))
+    in
+    let together, apart =
+      List.partition (fun (_, p) -> combinable options p) checked
+    in
+    let combined =
+      match together with
+      | [] -> None
+      | _ -> (
+          let pattern = combine options together in
+          (* Literal patterns are quoted instead. *)
+          let options = List.filter (fun o -> o <> `LITERAL) options in
+          match
+            Jit.compile ~options:(options :> Jit.compile_option list) pattern
+          with
+          | Ok re -> Some re
+          | Error _ -> None)
+    in
+    let apart = if Option.is_none combined then checked else apart in
+    let* separate =
+      compile_each (fun i p ->
+          if List.mem_assoc i apart then jit i p |> Result.map Option.some
+          else Ok None)
     in
     Ok
-      ((* We still have one more substring to add: the one after the last
-          delimiter. *)
-       String.(sub subject end_offset (length subject - end_offset))
-       :: substrings
-      (* ... and we built this in reverse to be fast---but let's return it in
-         the right order. *)
-      |> List.rev)
+      {
+        length = Array.length patterns;
+        combined;
+        separate = List.filter_map Fun.id separate;
+      }
+
+  let length (set : t) : int = set.length
+
+  let separate (set : t) : int list =
+    List.sort compare (List.map fst set.separate)
+
+  let leftmost ?(subject_offset : int = 0) (set : t) (s : string) :
+      (match_ option array, match_error) Result.t =
+    let subject = Bindings.subject_of_string s in
+    let found = Array.make set.length None in
+    let* () =
+      match set.combined with
+      | None -> Ok ()
+      | Some re -> (
+          match
+            Bindings.set_match re.code subject subject_offset set.length
+          with
+          | _, status when status <> 0 -> Error (match_error_of_int status)
+          | offsets, _ ->
+              Array.iteri
+                (fun i _ ->
+                  if offsets.(2 * i) >= 0 then
+                    found.(i) <-
+                      Some (subject, offsets.(2 * i), offsets.((2 * i) + 1)))
+                found;
+              Ok ())
+    in
+    let rec separately = function
+      | [] -> Ok found
+      | (i, re) :: rest ->
+          let* m = Jit.find ~subject_offset re s in
+          found.(i) <- m;
+          separately rest
+    in
+    separately set.separate
 
-  (* TODO(cooper): dedup impl with a functor? *)
-  let is_match ?(options : match_option list = []) ?(subject_offset : int = 0)
-      (re : t) (subject : string) : (bool, match_error) Result.t =
-    find ~options ~subject_offset re subject |> Result.map Option.is_some
+  let matches ?(subject_offset : int = 0) (set : t) (s : string) :
+      (int list, match_error) Result.t =
+    let* found = leftmost ~subject_offset set s in
+    Ok
+      (List.filter
+         (fun i -> Option.is_some found.(i))
+         (List.init set.length Fun.id))
+end
+
+(* The required literal of each rule (or, failing that, a code unit PCRE2
+   reports every match contains) is searched for with a single automaton. Rules
+   with neither are always candidates. *)
+module Literal_prefilter = struct
+  type t = {
+    length : int;
+    automaton : Bindings.literal_set;
+    (* The rules without a literal, in increasing order. *)
+    unfiltered : int list;
+  }
+
+  let create (res : _ Bindings.regex compiled array) : t =
+    let literal_of i re =
+      let unit = Bindings.required_code_unit re.code in
+      match re.literal with
+      | Some literal -> Either.Left (i, literal)
+      | None when unit < 0 -> Either.Right i
+      | None ->
+          (* PCRE2 does not report whether the unit is matched caselessly. *)
+          let bytes = String.make 1 (Char.chr unit) in
+          Either.Left (i, { bytes; caseless = true })
+    in
+    let literals, unfiltered =
+      List.partition_map Fun.id (List.mapi literal_of (Array.to_list res))
+    in
+    let literals = Array.of_list literals in
+    let automaton =
+      Bindings.literal_set_create
+        (Array.map (fun (_, l) -> l.bytes) literals)
+        (Array.map (fun (_, l) -> l.caseless) literals)
+        (Array.map fst literals) (Array.length res)
+    in
+    { length = Array.length res; automaton; unfiltered }
+
+  let of_interp (res : Interp.t array) : t = create res
+  let of_jit (res : Jit.t array) : t = create res
+  let length (p : t) : int = p.length
+
+  let rec merge (xs : int list) (ys : int list) : int list =
+    match (xs, ys) with
+    | [], l | l, [] -> l
+    | x :: xs', y :: _ when x < y -> x :: merge xs' ys
+    | _, y :: ys' -> y :: merge xs ys'
+
+  let candidates_of_subject (p : t) (subject : Bindings.subject) : int list =
+    let found = Bindings.literal_set_scan p.automaton subject in
+    merge p.unfiltered (Array.to_list found)
+
+  let candidates (p : t) (s : string) : int list =
+    candidates_of_subject p (Bindings.subject_of_string s)
+
+  let candidates_bigstring ?(pos : int option) ?(len : int option) (p : t)
+      (b : bigstring) : int list =
+    candidates_of_subject p
+      (subject_of_window "candidates_bigstring" ?pos ?len b)
+end
+
+(* Runs [f] holding [mutex], which is released even should [f] raise. *)
+let with_mutex (mutex : Bindings.mutex) (f : unit -> 'a) : 'a =
+  Bindings.mutex_lock mutex;
+  Fun.protect ~finally:(fun () -> Bindings.mutex_unlock mutex) f
+
+(* The entries of a cache form a doubly linked list from the most to the least
+   recently used, alongside a table from keys to their entries. Patterns are
+   compiled without holding the lock, so that a slow compilation does not hold
+   up others; should two domains compile the same pattern at once, the first
+   to finish is kept. *)
+module Cache = struct
+  type stats = { hits : int; misses : int; evictions : int }
+  [@@deriving show, eq]
+
+  type key = {
+    pattern : string;
+    options : int32;
+    (* The JIT options and matching mode, or [None] for the interpreter. *)
+    jit : int32 option;
+  }
+
+  type compiled_regex = Interp_regex of Interp.t | Jit_regex of Jit.t
+
+  type entry = {
+    key : key;
+    regex : compiled_regex;
+    mutable newer : entry option;
+    mutable older : entry option;
+  }
+
+  type t = {
+    capacity : int;
+    table : (key, entry) Hashtbl.t;
+    mutable newest : entry option;
+    mutable oldest : entry option;
+    mutable hit_count : int;
+    mutable miss_count : int;
+    mutable eviction_count : int;
+    mutex : Bindings.mutex;
+  }
+
+  let create ~(capacity : int) : t =
+    if capacity <= 0 then invalid_arg "Cache.create: capacity must be positive";
+    {
+      capacity;
+      table = Hashtbl.create (min capacity 1024);
+      newest = None;
+      oldest = None;
+      hit_count = 0;
+      miss_count = 0;
+      eviction_count = 0;
+      mutex = Bindings.mutex_create ();
+    }
+
+  let locked (cache : t) (f : unit -> 'a) : 'a = with_mutex cache.mutex f
+
+  let unlink (cache : t) (e : entry) : unit =
+    (match e.newer with
+    | Some newer -> newer.older <- e.older
+    | None -> cache.newest <- e.older);
+    (match e.older with
+    | Some older -> older.newer <- e.newer
+    | None -> cache.oldest <- e.newer);
+    e.newer <- None;
+    e.older <- None
+
+  let push (cache : t) (e : entry) : unit =
+    e.older <- cache.newest;
+    (match cache.newest with
+    | Some newest -> newest.newer <- Some e
+    | None -> cache.oldest <- Some e);
+    cache.newest <- Some e
+
+  let find (cache : t) (key : key) : compiled_regex option =
+    locked cache (fun () ->
+        match Hashtbl.find_opt cache.table key with
+        | Some e ->
+            cache.hit_count <- cache.hit_count + 1;
+            unlink cache e;
+            push cache e;
+            Some e.regex
+        | None ->
+            cache.miss_count <- cache.miss_count + 1;
+            None)
+
+  (* Adds [regex] under [key], unless another domain has added it meanwhile,
+     and returns the regex which is cached. *)
+  let add (cache : t) (key : key) (regex : compiled_regex) : compiled_regex =
+    locked cache (fun () ->
+        match Hashtbl.find_opt cache.table key with
+        | Some e -> e.regex
+        | None ->
+            if Hashtbl.length cache.table >= cache.capacity then
+              Option.iter
+                (fun oldest ->
+                  unlink cache oldest;
+                  Hashtbl.remove cache.table oldest.key;
+                  cache.eviction_count <- cache.eviction_count + 1)
+                cache.oldest;
+            let e = { key; regex; newer = None; older = None } in
+            Hashtbl.replace cache.table key e;
+            push cache e;
+            regex)
+
+  let find_or_compile (cache : t) (key : key)
+      (compile : unit -> (compiled_regex, compile_error) Result.t) :
+      (compiled_regex, compile_error) Result.t =
+    match find cache key with
+    | Some regex -> Ok regex
+    | None -> compile () |> Result.map (add cache key)
+
+  let interp ?(options : Options.Interp.compile_option list = []) (cache : t)
+      (pattern : string) : (Interp.t, compile_error) Result.t =
+    let key =
+      {
+        pattern;
+        options = Options.Interp.bitvector_of_compile_options options;
+        jit = None;
+      }
+    in
+    find_or_compile cache key (fun () ->
+        Interp.compile ~options pattern
+        |> Result.map (fun re -> Interp_regex re))
+    |> Result.map (function Interp_regex re -> re | Jit_regex _ -> assert false)
+
+  let jit ?(options : Jit.compile_option list = [])
+      ?(mode : Options.Jit.matching_mode = Options.Jit.JIT_COMPLETE) (cache : t)
+      (pattern : string) : (Jit.t, compile_error) Result.t =
+    let interp_options, jit_options = Jit.split_options options in
+    let key =
+      {
+        pattern;
+        options = Options.Interp.bitvector_of_compile_options interp_options;
+        jit =
+          Some
+            (Int32.logor
+               (Options.Jit.int32_of_matching_mode mode)
+               (Options.Jit.bitvector_of_compile_options jit_options));
+      }
+    in
+    find_or_compile cache key (fun () ->
+        let* interp = Interp.compile ~options:interp_options pattern in
+        Jit.of_interp ~options:jit_options ~mode interp
+        |> Result.map (fun re -> Jit_regex re))
+    |> Result.map (function Jit_regex re -> re | Interp_regex _ -> assert false)
+
+  let capacity (cache : t) : int = cache.capacity
+
+  let length (cache : t) : int =
+    locked cache (fun () -> Hashtbl.length cache.table)
+
+  let stats (cache : t) : stats =
+    locked cache (fun () ->
+        {
+          hits = cache.hit_count;
+          misses = cache.miss_count;
+          evictions = cache.eviction_count;
+        })
+
+  let clear (cache : t) : unit =
+    locked cache (fun () ->
+        Hashtbl.reset cache.table;
+        cache.newest <- None;
+        cache.oldest <- None)
+end
+
+(* Regexes are kept by a digest of the version of PCRE2, their options and
+   their pattern. Those in the file are all decoded when it is loaded, but are
+   only JIT compiled once asked for, and then on a copy of their code, so that
+   the regexes returned by [interp] remain interpreted. *)
+module Disk_cache = struct
+  type entry = {
+    interp : Interp.t;
+    (* The JIT compiled copies, by their JIT options. *)
+    mutable jits : (int32 * Jit.t) list;
+  }
+
+  type t = {
+    path : string;
+    table : (Digest.t, entry) Hashtbl.t;
+    loaded : int;
+    mutable modified : bool;
+    mutex : Bindings.mutex;
+  }
+
+  let key (options : int32) (pattern : string) : Digest.t =
+    let major, minor = version in
+    Digest.string (Printf.sprintf "%d.%d:%ld:%s" major minor options pattern)
+
+  let load (path : string) : t =
+    let entries =
+      Option.value (Bindings.serialized_load path) ~default:[||]
+    in
+    let table = Hashtbl.create (max 16 (Array.length entries)) in
+    Array.iter
+      (fun (pattern, options, code) ->
+        let interp =
+          {
+            (compiled_of_code code) with
+            literal = required_literal options pattern;
+          }
+        in
+        Hashtbl.replace table (key options pattern) { interp; jits = [] })
+      entries;
+    {
+      path;
+      table;
+      loaded = Array.length entries;
+      modified = false;
+      mutex = Bindings.mutex_create ();
+    }
+
+  let locked (cache : t) (f : unit -> 'a) : 'a = with_mutex cache.mutex f
+
+  let find_or_compile (cache : t) (options : Options.Interp.compile_option list)
+      (pattern : string) : (entry, compile_error) Result.t =
+    let key =
+      key (Options.Interp.bitvector_of_compile_options options) pattern
+    in
+    match locked cache (fun () -> Hashtbl.find_opt cache.table key) with
+    | Some e -> Ok e
+    | None ->
+        let* interp = Interp.compile ~options pattern in
+        Ok
+          (locked cache (fun () ->
+               match Hashtbl.find_opt cache.table key with
+               | Some e -> e
+               | None ->
+                   let e = { interp; jits = [] } in
+                   Hashtbl.replace cache.table key e;
+                   cache.modified <- true;
+                   e))
+
+  let interp ?(options : Options.Interp.compile_option list = []) (cache : t)
+      (pattern : string) : (Interp.t, compile_error) Result.t =
+    find_or_compile cache options pattern |> Result.map (fun e -> e.interp)
+
+  let jit ?(options : Jit.compile_option list = []) (cache : t)
+      (pattern : string) : (Jit.t, compile_error) Result.t =
+    let interp_options, jit_options = Jit.split_options options in
+    let bitvector = Options.Jit.bitvector_of_compile_options jit_options in
+    let* e = find_or_compile cache interp_options pattern in
+    match locked cache (fun () -> List.assoc_opt bitvector e.jits) with
+    | Some re -> Ok re
+    | None ->
+        let copy = { e.interp with code = Bindings.code_copy e.interp.code } in
+        let* re = Jit.of_interp ~options:jit_options copy in
+        Ok
+          (locked cache (fun () ->
+               match List.assoc_opt bitvector e.jits with
+               | Some re -> re
+               | None ->
+                   e.jits <- (bitvector, re) :: e.jits;
+                   re))
+
+  let loaded (cache : t) : int = cache.loaded
+
+  let length (cache : t) : int =
+    locked cache (fun () -> Hashtbl.length cache.table)
+
+  let save (cache : t) : unit =
+    locked cache (fun () ->
+        if cache.modified then (
+          let codes =
+            Hashtbl.fold (fun _ e acc -> e.interp.code :: acc) cache.table []
+          in
+          match Bindings.serialized_save cache.path (Array.of_list codes) with
+          | 0 -> cache.modified <- false
+          | error ->
+              failwith
+                (Printf.sprintf "Disk_cache.save: could not serialize (%d)"
+                   error)))
+end
+
+module Embedded = struct
+  let interp (compiled : string) : Interp.t = Marshal.from_string compiled 0
+
+  let jit (compiled : string) : Jit.t =
+    match Jit.of_interp (interp compiled) with
+    | Ok re -> re
+    | Error e ->
+        failwith
+          (Printf.sprintf "Embedded.jit: could not JIT compile (%s)"
+             (show_compile_error e))
+end
+
+(* A regex starts out interpreted, and counts the matches made with it and the
+   bytes of their subjects. Once either reaches its threshold, the first match
+   to see so JIT compiles a copy of the code, rather than the code itself, so
+   that the interpreted matches of other domains meanwhile are undisturbed.
+   Once the JIT compiled regex is published, every match uses it.
+
+   Releasing the JIT compiled regex returns it to the interpreter, and its
+   executable memory is freed once the GC finds the copy unreachable. Should
+   the JIT compiled code of every regex exceed the budget, those least recently
+   used are released. *)
+module Tiered = struct
+  include Match
+  include Error
+
+  type compile_option = Jit.compile_option [@@deriving show, eq]
+  type match_option = Options.Jit.match_option [@@deriving show, eq]
+
+  type tier =
+    | Interpreted
+    (* JIT compiling, while matches continue to be interpreted. *)
+    | Compiling
+    | Compiled of Jit.t
+    (* JIT compilation failed, so it is not tried again. *)
+    | Uncompilable
+
+  type t = {
+    id : int;
+    interp : Interp.t;
+    jit_options : Options.Jit.jit_only_compile_option list;
+    max_uses : int;
+    max_bytes : int;
+    uses : int Atomic.t;
+    bytes : int Atomic.t;
+    tier : tier Atomic.t;
+    (* The [clock] when last matched with the JIT. *)
+    last_use : int Atomic.t;
+  }
+
+  let next_id : int Atomic.t = Atomic.make 0
+
+  (* Advanced whenever a regex is JIT compiled, so that those matched with the
+     JIT least recently have the smallest [last_use], without every match
+     writing to a counter shared by every domain. *)
+  let clock : int Atomic.t = Atomic.make 0
+
+  (* The regexes which are JIT compiled, held weakly so that they may still be
+     collected. *)
+  module Compiled_set = Weak.Make (struct
+    type nonrec t = t
+
+    let equal (a : t) (b : t) : bool = a.id = b.id
+    let hash (re : t) : int = Hashtbl.hash re.id
+  end)
+
+  let compiled_set : Compiled_set.t = Compiled_set.create 64
+  let compiled_mutex : Bindings.mutex = Bindings.mutex_create ()
+  let budget : int option Atomic.t = Atomic.make None
+
+  let set_jit_budget (bytes : int option) : unit =
+    match bytes with
+    | Some n when n < 0 ->
+        invalid_arg "Tiered.set_jit_budget: budget must not be negative"
+    | _ -> Atomic.set budget bytes
+
+  let jit_budget () : int option = Atomic.get budget
+
+  let jit_size (re : t) : int =
+    match Atomic.get re.tier with
+    | Compiled jit -> Bindings.regex_jit_size jit.code
+    | _ -> 0
+
+  let release_jit (re : t) : unit =
+    match Atomic.get re.tier with
+    | Compiled _ as tier ->
+        Atomic.set re.uses 0;
+        Atomic.set re.bytes 0;
+        if Atomic.compare_and_set re.tier tier Interpreted then
+          with_mutex compiled_mutex (fun () ->
+              Compiled_set.remove compiled_set re)
+    | _ -> ()
+
+  (* Releases the least recently used regexes, other than [keep], until the
+     JIT compiled code of those left is within the budget. *)
+  let enforce_budget (keep : t) : unit =
+    match Atomic.get budget with
+    | None -> ()
+    | Some budget ->
+        let cold =
+          with_mutex compiled_mutex (fun () ->
+              let sized =
+                Compiled_set.fold
+                  (fun re acc -> (re, jit_size re) :: acc)
+                  compiled_set []
+              in
+              let total =
+                List.fold_left (fun n (_, size) -> n + size) 0 sized
+              in
+              let by_last_use =
+                List.sort
+                  (fun (a, _) (b, _) ->
+                    compare (Atomic.get a.last_use) (Atomic.get b.last_use))
+                  sized
+              in
+              let rec take total acc = function
+                | (re, size) :: rest when total > budget ->
+                    if re == keep then take total acc rest
+                    else take (total - size) (re :: acc) rest
+                | _ -> acc
+              in
+              take total [] by_last_use)
+        in
+        List.iter release_jit cold
+
+  let default_thresholds : (int * int) Atomic.t = Atomic.make (16, 1 lsl 20)
+
+  let set_thresholds ~(uses : int) ~(bytes : int) : unit =
+    if uses < 0 || bytes < 0 then
+      invalid_arg "Tiered.set_thresholds: thresholds must not be negative";
+    Atomic.set default_thresholds (uses, bytes)
+
+  let thresholds () : int * int = Atomic.get default_thresholds
+
+  let compile ?(options : compile_option list = []) (pattern : string) :
+      (t, compile_error) Result.t =
+    let interp_options, jit_options = Jit.split_options options in
+    let* interp = Interp.compile ~options:interp_options pattern in
+    let max_uses, max_bytes = thresholds () in
+    Ok
+      {
+        id = Atomic.fetch_and_add next_id 1;
+        interp;
+        jit_options;
+        max_uses;
+        max_bytes;
+        uses = Atomic.make 0;
+        bytes = Atomic.make 0;
+        tier = Atomic.make Interpreted;
+        last_use = Atomic.make 0;
+      }
+
+  let jit_compile (re : t) : Jit.t option =
+    let copy = { re.interp with code = Bindings.code_copy re.interp.code } in
+    match Jit.of_interp ~options:re.jit_options copy with
+    | Ok jit ->
+        Atomic.set re.last_use (Atomic.fetch_and_add clock 1 + 1);
+        Atomic.set re.tier (Compiled jit);
+        with_mutex compiled_mutex (fun () -> Compiled_set.add compiled_set re);
+        enforce_budget re;
+        Some jit
+    | Error _ ->
+        Atomic.set re.tier Uncompilable;
+        None
+
+  (* The JIT compiled regex to match [s] from [offset] with, if [re] has been,
+     or now is, JIT compiled. *)
+  let tier (re : t) (s : string) (offset : int) : Jit.t option =
+    match Atomic.get re.tier with
+    | Compiled jit ->
+        let now = Atomic.get clock in
+        if Atomic.get re.last_use <> now then Atomic.set re.last_use now;
+        Some jit
+    | Compiling | Uncompilable -> None
+    | Interpreted ->
+        let length = max 0 (String.length s - offset) in
+        let uses = Atomic.fetch_and_add re.uses 1 + 1 in
+        let bytes = Atomic.fetch_and_add re.bytes length + length in
+        if
+          (uses >= re.max_uses || bytes >= re.max_bytes)
+          && Atomic.compare_and_set re.tier Interpreted Compiling
+        then jit_compile re
+        else None
+
+  let is_jit (re : t) : bool =
+    match Atomic.get re.tier with Compiled _ -> true | _ -> false
+
+  let interp_options (options : match_option list option) :
+      Interp.match_option list option =
+    (options :> Interp.match_option list option)
+
+  let capture_groups (re : t) : (string * int) list =
+    Interp.capture_groups re.interp
+
+  let group_index (re : t) (name : string) : int option =
+    Interp.group_index re.interp name
+
+  let find ?(options : match_option list option) ?(subject_offset : int = 0)
+      (re : t) (s : string) : (match_ option, match_error) Result.t =
+    match tier re s subject_offset with
+    | Some jit -> Jit.find ?options ~subject_offset jit s
+    | None ->
+        Interp.find ?options:(interp_options options) ~subject_offset re.interp
+          s
+
+  let find_iter ?(options : match_option list option)
+      ?(subject_offset : int = 0) (re : t) (s : string) :
+      (match_, match_error) Result.t Seq.t =
+    match tier re s subject_offset with
+    | Some jit -> Jit.find_iter ?options ~subject_offset jit s
+    | None ->
+        Interp.find_iter ?options:(interp_options options) ~subject_offset
+          re.interp s
+
+  let find_all ?(options : match_option list option)
+      ?(subject_offset : int = 0) ?(max_count : int option) (re : t)
+      (s : string) : (int array, match_error) Result.t =
+    match tier re s subject_offset with
+    | Some jit -> Jit.find_all ?options ~subject_offset ?max_count jit s
+    | None ->
+        Interp.find_all ?options:(interp_options options) ~subject_offset
+          ?max_count re.interp s
+
+  let captures ?(options : match_option list option)
+      ?(subject_offset : int = 0) (re : t) (s : string) :
+      (captures option, match_error) Result.t =
+    match tier re s subject_offset with
+    | Some jit -> Jit.captures ?options ~subject_offset jit s
+    | None ->
+        Interp.captures ?options:(interp_options options) ~subject_offset
+          re.interp s
+
+  let captures_iter ?(options : match_option list option)
+      ?(subject_offset : int = 0) (re : t) (s : string) :
+      (captures, match_error) Result.t Seq.t =
+    match tier re s subject_offset with
+    | Some jit -> Jit.captures_iter ?options ~subject_offset jit s
+    | None ->
+        Interp.captures_iter ?options:(interp_options options) ~subject_offset
+          re.interp s
+
+  let captures_all ?(options : match_option list option)
+      ?(subject_offset : int = 0) ?(max_count : int option) (re : t)
+      (s : string) : (captures_batch, match_error) Result.t =
+    match tier re s subject_offset with
+    | Some jit -> Jit.captures_all ?options ~subject_offset ?max_count jit s
+    | None ->
+        Interp.captures_all ?options:(interp_options options) ~subject_offset
+          ?max_count re.interp s
+
+  let split ?(options : match_option list option) ?(subject_offset : int = 0)
+      ?(limit : int option) (re : t) (s : string) :
+      (string list, match_error) Result.t =
+    match tier re s subject_offset with
+    | Some jit -> Jit.split ?options ~subject_offset ?limit jit s
+    | None ->
+        Interp.split ?options:(interp_options options) ~subject_offset ?limit
+          re.interp s
+
+  let is_match ?(options : match_option list option)
+      ?(subject_offset : int = 0) (re : t) (s : string) :
+      (bool, match_error) Result.t =
+    match tier re s subject_offset with
+    | Some jit -> Jit.is_match ?options ~subject_offset jit s
+    | None ->
+        Interp.is_match ?options:(interp_options options) ~subject_offset
+          re.interp s
 end
@@ -4,6 +4,127 @@ type match_ [@@deriving show, eq]
 type captures [@@deriving show, eq]
 (** A set comprising an entire match alongside any matches for capture groups *)
 
+type captures_batch [@@deriving show]
+(** The captures of successive matches, sharing a single buffer of offsets *)
+
+(** A flag which cancels matching, set from any thread or domain. *)
+module Cancel : sig
+  type t
+
+  val create : unit -> t
+  (** [create ()] is a new flag, which is not set. *)
+
+  val cancel : t -> unit
+  (** [cancel c] sets [c], so that every match guarded by it (see [limits])
+      fails with [CANCELLED], including any in progress. *)
+
+  val is_cancelled : t -> bool
+  (** [is_cancelled c] is whether [cancel c] has been called. *)
+end
+
+type limits = {
+  match_limit : int option;
+      (** The maximum number of times PCRE2's internal matching function may be
+          called, which bounds the backtracking done by a single match. It
+          applies to both interpreted and JIT matching. If reached, matching
+          fails with [MATCHLIMIT]. *)
+  depth_limit : int option;
+      (** The maximum depth of nested backtracking. It applies only to
+          interpreted matching. If reached, matching fails with [DEPTHLIMIT]. *)
+  heap_limit : int option;
+      (** The maximum heap memory, in KiB, used to hold backtracking
+          information. It applies only to interpreted matching. If reached,
+          matching fails with [HEAPLIMIT]. *)
+  timeout : float option;
+      (** The time, in seconds, each call may spend matching, after which it
+          fails with [TIMEOUT]. The clock starts afresh for each call to a
+          matching function; [find_iter] and [captures_iter] match lazily in
+          batches, so for them it bounds each batch. *)
+  cancel : Cancel.t option;
+      (** A flag which, once set, causes matching to fail with [CANCELLED]. *)
+}
+(** Bounds on the work a single match may do, so that a pattern which
+    backtracks catastrophically fails quickly rather than running for minutes.
+    Each limit is PCRE2's default when [None]. Limits are attached to a
+    compiled pattern with [with_limits] (e.g., [Interp.with_limits]), or to a
+    handle with [handle ~limits]; the match context which enforces them is
+    created once then, rather than on every match.
+
+    The [timeout] and [cancel] flag are enforced natively, without calling
+    into OCaml, by checking them between the calls to PCRE2 which a guarded
+    match is split into: its start positions are searched a chunk at a time,
+    each chunk twice as long as the one before, and each chunk first with a
+    small [match_limit] which, each time it is reached, is doubled before
+    retrying. Each call does at most about as much work as those before it
+    together, so this about doubles the work of the match at most, and a
+    match fails with [TIMEOUT] within about twice its [timeout]. Patterns using
+    [\G], [FIRSTLINE], anchoring or verbs such as [(*COMMIT)] (other than
+    those setting options at the start), and partial or DFA matching, are not
+    split into chunks, since that could change what they match, so only bound
+    the backtracking from each start position. The
+    guard is also checked by any callouts in the pattern (e.g., with
+    [AUTO_CALLOUT]), and before each match of a batch, such as in [find_all].
+
+    A pattern with limits cannot be marshalled, since its match context
+    belongs to this process; attach them again once it is unmarshalled.
+
+    @raise Invalid_argument when used, if any limit is negative. *)
+
+val no_limits : limits
+(** [no_limits] leaves every limit at PCRE2's default. It is the limits of a
+    newly compiled pattern. *)
+
+type bigstring =
+  (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
+(** A subject outside of the OCaml heap, which may be matched without copying
+    it *)
+
+val set_release_lock_threshold : int option -> unit
+(** [set_release_lock_threshold (Some n)] causes matching on a window of at
+    least [n] bytes of a [bigstring] to release the OCaml runtime lock, so that
+    other threads may run while it is matched. [set_release_lock_threshold
+    None] prevents the lock from ever being released. The default is
+    [Some 65536].
+
+    Subjects which are strings are always matched with the lock held, since
+    they may be moved by the GC. So are those given to functions which do not
+    allocate, such as [is_match_with].
+
+    @raise Invalid_argument if [n] is negative. *)
+
+val release_lock_threshold : unit -> int option
+(** [release_lock_threshold ()] is the current threshold set by
+    [set_release_lock_threshold]. *)
+
+(** Each compiled pattern carries what PCRE2 reports of the subjects it can
+    match: the minimum length of a match, the code unit (or set of code units)
+    a match must start with, and the last literal code unit a match must
+    contain. [find], [captures], [is_match] and the like check a subject
+    against these first, with a length check and [memchr], and reject it
+    without calling PCRE2 if it lacks any of them. [find_all] and its kin
+    check once, before the first match. Partial matching is never
+    prefiltered, nor are patterns compiled with [`NO_START_OPTIMIZE] or
+    [`AUTO_CALLOUT]. *)
+module Prefilter : sig
+  type stats = {
+    too_short : int;  (** Subjects shorter than the minimum length. *)
+    no_first_code_unit : int;
+        (** Subjects lacking a code unit a match could start with. *)
+    no_last_code_unit : int;
+        (** Subjects lacking the last literal code unit of a match. *)
+  }
+  [@@deriving show, eq]
+  (** The number of subjects rejected for each reason, and so of calls to
+      PCRE2 saved, across all patterns and domains. *)
+
+  val stats : unit -> stats
+  (** [stats ()] is the number of subjects rejected since the program started
+      or [reset_stats] was last called. *)
+
+  val reset_stats : unit -> unit
+  (** [reset_stats ()] sets every count of [stats] to 0. *)
+end
+
 (** Errors which may occur during compilation of the pattern *)
 type compile_error =
   | END_BACKSLASH  (** A pattern string ends in a backslash *)
@@ -385,6 +506,12 @@ type match_error =
           that was compiled with PCRE2_MATCH_INVALID_UTF. This is not supported
           for DFA matching. *)
   | INVALIDOFFSET  (** internal error, should not occur *)
+  | TIMEOUT
+      (** Matching took longer than the [timeout] of its [limits], so was
+          abandoned. *)
+  | CANCELLED
+      (** The [cancel] flag of the [limits] of the match was set, so it was
+          abandoned. *)
 [@@deriving show, eq]
 
 (* Fastpath to JIT match for perf *)
@@ -461,7 +588,6 @@ module Options : sig
         (* not for pcre2_dfa_match() *)
         (* not for pcre2_dfa_match() or pcre2_jit_match() *) ]
     (* TODO: split to enforce restrictions (maybe except `NO_JIT) *)
-    (* TODO: add match_context options (depth, heap, match) limits here or separately? *)
 
     type subst_options =
       (* shared *)
@@ -490,6 +616,15 @@ module Options : sig
   end
 end
 
+(** Compiled patterns may be marshalled (e.g., with [Marshal] or
+    [output_value]), so that a process, such as a forked worker, may be sent
+    them without compiling them again. They are marshalled as PCRE2's
+    serialized code alongside the pattern and options. A process linked with
+    another version of PCRE2, or on a host of another word size or endianness,
+    cannot decode the code, so compiles the pattern again instead; should that
+    fail, unmarshalling raises [Failure]. A pattern which has been JIT
+    compiled (such as a [Jit.t]) is JIT compiled again when unmarshalled; to
+    leave that to the worker, send an [Interp.t] and use [Jit.of_interp]. *)
 module Interp : sig
   include module type of Options.Interp
 
@@ -497,10 +632,44 @@ module Interp : sig
     Intf.Matcher
       with type match_ = match_
        and type captures = captures
+       and type captures_batch = captures_batch
        and type compile_option = Options.Interp.compile_option
        and type compile_error = compile_error
        and type match_option = Options.Interp.match_option
        and type match_error = match_error
+
+  include
+    Intf.Matcher_handle
+      with type t := t
+       and type match_ := match_
+       and type captures := captures
+       and type match_option := match_option
+       and type match_error := match_error
+       and type limits := limits
+
+  include
+    Intf.Matcher_bigstring
+      with type t := t
+       and type match_ := match_
+       and type captures := captures
+       and type captures_batch := captures_batch
+       and type match_option := match_option
+       and type match_error := match_error
+       and type bigstring := bigstring
+
+  include
+    Intf.Matcher_file
+      with type t := t
+       and type range := range
+       and type match_option := match_option
+       and type match_error := match_error
+
+  include
+    Intf.Matcher_stream
+      with type t := t
+       and type range := range
+       and type match_option := match_option
+       and type match_error := match_error
 end
 
 module Jit : sig
@@ -510,12 +679,46 @@ module Jit : sig
     Intf.Matcher
       with type match_ = match_
        and type captures = captures
+       and type captures_batch = captures_batch
        and type compile_option =
         [ Options.Jit.jit_only_compile_option | Options.Interp.compile_option ]
        and type compile_error = compile_error
        and type match_option = Options.Jit.match_option
        and type match_error = match_error
 
+  include
+    Intf.Matcher_handle
+      with type t := t
+       and type match_ := match_
+       and type captures := captures
+       and type match_option := match_option
+       and type match_error := match_error
+       and type limits := limits
+
+  include
+    Intf.Matcher_bigstring
+      with type t := t
+       and type match_ := match_
+       and type captures := captures
+       and type captures_batch := captures_batch
+       and type match_option := match_option
+       and type match_error := match_error
+       and type bigstring := bigstring
+
+  include
+    Intf.Matcher_file
+      with type t := t
+       and type range := range
+       and type match_option := match_option
+       and type match_error := match_error
+
+  include
+    Intf.Matcher_stream
+      with type t := t
+       and type range := range
+       and type match_option := match_option
+       and type match_error := match_error
+
   val of_interp :
     ?options:jit_only_compile_option list ->
     ?mode:matching_mode ->
@@ -523,7 +726,83 @@ module Jit : sig
     (t, compile_error) Result.t
   (** [of_interp options mode re] is either [Ok jit_re], the JIT-enabled
       version of the provided pattern, or [Error c], where [c] is the relevant
-      compilation error. *)
+      compilation error.
+
+      NOTE: Streams match partially, so use the JIT only if [re] has been JIT
+      compiled with [mode = JIT_PARTIAL_HARD]; otherwise, they fall back on the
+      interpreter. *)
+
+  val compile_many :
+    ?options:compile_option list ->
+    ?threads:int ->
+    string array ->
+    (t, compile_error) Result.t array * float array
+  (** [compile_many patterns] is the result of [compile] for each of
+      [patterns], and the seconds each took to compile, both in the order of
+      [patterns]. They are compiled in parallel on [threads] threads (by
+      default, one per online processor), which do not hold the runtime lock,
+      so other threads and domains may run meanwhile.
+
+      @raise Invalid_argument if [threads] is negative. *)
+
+  val set_stack_sizes : start:int -> max:int -> unit
+  (** [set_stack_sizes ~start ~max] bounds the size in bytes of the JIT stack
+      of each thread. Matching begins on a small stack provided by PCRE2; if
+      that is exhausted, the thread is given a JIT stack of [start] bytes,
+      which is doubled each time it is exhausted in turn, up to [max] bytes.
+      Only once a stack of [max] bytes is exhausted does matching fail with
+      [JIT_STACKLIMIT]. Each thread, and so each domain, has its own stack,
+      kept for the lifetime of the thread. The defaults are [start = 131072]
+      and [max = 8388608]. Stacks which already exist are unaffected.
+
+      @raise Invalid_argument unless [0 < start <= max]. *)
+
+  val stack_sizes : unit -> int * int
+  (** [stack_sizes ()] is [(start, max)], as set by [set_stack_sizes]. *)
+
+  val free_unused_memory : unit -> unit
+  (** [free_unused_memory ()] returns to the system the executable memory
+      which PCRE2 keeps for JIT compiled code, all of which has since been
+      freed. PCRE2 allocates the JIT compiled code of every regex from the same
+      pool of executable memory, which it does not otherwise shrink. See
+      [pcre2_jit_free_unused_memory(3)]. *)
+end
+
+(** Matching many subjects at once, in parallel. *)
+module Parallel : sig
+  type pool
+  (** A pool of domains which share the work of matching.
+
+      NOTE: Before OCaml 5 there are no domains, so a pool comprises only the
+      domain using it and all matching is sequential. *)
+
+  val create : ?domains:int -> unit -> pool
+  (** [create ()] is a new pool of [domains] domains, counting the one which
+      uses it (by default, [Domain.recommended_domain_count ()]). The others
+      are spawned now and wait for work until [shutdown] is called.
+
+      @raise Invalid_argument if [domains] is not positive. *)
+
+  val domains : pool -> int
+  (** [domains pool] is the number of domains in [pool]. *)
+
+  val shutdown : pool -> unit
+  (** [shutdown pool] stops the domains of [pool], waiting for them to exit.
+      Using [pool] afterwards raises [Invalid_argument]. *)
+
+  module Interp :
+    Intf.Parallel_matcher
+      with type pool := pool
+       and type t := Interp.t
+       and type match_option := Interp.match_option
+       and type match_error := match_error
+
+  module Jit :
+    Intf.Parallel_matcher
+      with type pool := pool
+       and type t := Jit.t
+       and type match_option := Jit.match_option
+       and type match_error := match_error
 end
 
 (** Version information *)
@@ -533,6 +812,19 @@ val version : int * int
 val config_unicode : bool
 (** Indicates whether unicode support is enabled *)
 
+type memory_usage = {
+  regexes : int;  (** The number of compiled patterns alive. *)
+  code_bytes : int;  (** The total size of their compiled code. *)
+  jit_bytes : int;  (** The total size of their JIT compiled code. *)
+}
+[@@deriving show, eq]
+
+val memory_usage : unit -> memory_usage
+(** [memory_usage ()] is the memory used by the compiled patterns alive in
+    every domain, which have not yet been collected. The size of compiled and
+    JIT compiled code is also reported to the GC, so that it collects patterns
+    sooner the more memory they hold. *)
+
 val config_match_limit : int
 (** Default limit for calls to internal matching function *)
 
@@ -551,3 +843,337 @@ type dfa_match_option =
   | (* exclusive *)
     `DFA_RESTART
   | `DFA_SHORTEST ]
+
+(** Matching with PCRE2's alternative, DFA-based algorithm, which considers
+    every alternative at once instead of backtracking. It finds the longest
+    match at the leftmost position, never backtracks exponentially and may
+    restart a partial match without its earlier text.
+
+    The DFA does not capture groups. Instead, the [captures] of a match are
+    the alternative matches at its position, longest first: group [0] is the
+    longest match, group [1] the next longest and so on, at most 64 in all.
+    [is_match] stops at the first match found, per [`DFA_SHORTEST].
+
+    The DFA needs a workspace besides the match data. A handle keeps its own,
+    reused from match to match; otherwise, a workspace private to the calling
+    thread is used. Either is grown when a match exhausts it. *)
+module Dfa : sig
+  include
+    Intf.Matcher
+      with type match_ = match_
+       and type captures = captures
+       and type captures_batch = captures_batch
+       and type compile_option = Options.Interp.compile_option
+       and type compile_error = compile_error
+       and type match_option = dfa_match_option
+       and type match_error = match_error
+
+  include
+    Intf.Matcher_handle
+      with type t := t
+       and type match_ := match_
+       and type captures := captures
+       and type match_option := match_option
+       and type match_error := match_error
+       and type limits := limits
+
+  include
+    Intf.Matcher_bigstring
+      with type t := t
+       and type match_ := match_
+       and type captures := captures
+       and type captures_batch := captures_batch
+       and type match_option := match_option
+       and type match_error := match_error
+       and type bigstring := bigstring
+
+  include
+    Intf.Matcher_file
+      with type t := t
+       and type range := range
+       and type match_option := match_option
+       and type match_error := match_error
+
+  include
+    Intf.Matcher_stream
+      with type t := t
+       and type range := range
+       and type match_option := match_option
+       and type match_error := match_error
+
+  val of_interp : Interp.t -> t
+  (** [of_interp re] is [re], matched with the DFA. As the DFA does not
+      capture groups, [capture_groups] of the result is empty. *)
+end
+
+(** Matching which skips PCRE2 for patterns that are plain literals, i.e.,
+    which are not empty, contain none of [\ ^ $ . | ? * + ( ) [ ] { }], and
+    are compiled with no option but [`CASELESS] (which, as in PCRE2 without
+    [`UTF], ignores the case of ASCII letters only). These are neither
+    compiled nor matched by PCRE2, but searched for with [memmem] (or
+    [memchr], if caseless). Every other pattern is compiled as by [Jit] and
+    matched with it. Either way, the results are those of [Jit]. *)
+module Literal : sig
+  include
+    Intf.Matcher
+      with type match_ = match_
+       and type captures = captures
+       and type captures_batch = captures_batch
+       and type compile_option = Jit.compile_option
+       and type compile_error = compile_error
+       and type match_option = Options.Jit.match_option
+       and type match_error = match_error
+
+  val is_literal : t -> bool
+  (** [is_literal re] is whether [re] is matched without PCRE2. *)
+end
+
+(** A set of patterns, all of which are matched against a subject at once.
+
+    The patterns are combined into a single regex, so that one pass over the
+    subject finds the leftmost match of each, rather than a pass per pattern.
+    A pattern whose meaning could change in the combined regex, such as one
+    using verbs, callouts or recursion, or which names groups, is matched on
+    its own instead, as are all of them if the combined regex cannot be
+    compiled. The results are the same either way.
+
+    Sets are JIT compiled where possible and matched with the default limits.
+    The leftmost match of a pattern is the one [Jit.find] would give. *)
+module Set : sig
+  type t
+  type compile_option = Options.Interp.compile_option
+
+  val compile :
+    ?options:compile_option list ->
+    string array ->
+    (t, int * compile_error) Result.t
+  (** [compile ~options patterns] is the set of [patterns], each compiled with
+      [options], or the index of the first which fails to compile and why. *)
+
+  val length : t -> int
+  (** [length set] is the number of patterns in [set]. *)
+
+  val separate : t -> int list
+  (** [separate set] is the indices, in increasing order, of the patterns of
+      [set] which are matched on their own, each in a pass over the subject of
+      its own, rather than in the combined regex. *)
+
+  val matches :
+    ?subject_offset:int -> t -> string -> (int list, match_error) Result.t
+  (** [matches set s] is the indices, in increasing order, of the patterns
+      which match [s]. *)
+
+  val leftmost :
+    ?subject_offset:int ->
+    t ->
+    string ->
+    (match_ option array, match_error) Result.t
+  (** [leftmost set s] is the leftmost match in [s] of each pattern, by index,
+      or [None] for those which do not match. *)
+end
+
+(** A prefilter for large sets of rules, which finds the rules that may match
+    a subject in one pass over it, so that only those need be matched.
+
+    Each rule contributes the longest literal that every match of its pattern
+    contains, as far as can be told from the pattern without looking into
+    groups or classes, or failing that a code unit which PCRE2 reports every
+    match contains. These are searched for together with an Aho-Corasick
+    automaton. A rule with neither is always a candidate, as is one whose
+    literal occurs anywhere in the subject, even before where matching would
+    begin. *)
+module Literal_prefilter : sig
+  type t
+
+  val of_interp : Interp.t array -> t
+  val of_jit : Jit.t array -> t
+
+  val length : t -> int
+  (** [length p] is the number of rules in [p]. *)
+
+  val candidates : t -> string -> int list
+  (** [candidates p s] is the indices, in increasing order, of the rules which
+      may match [s]. The others certainly do not. *)
+
+  val candidates_bigstring : ?pos:int -> ?len:int -> t -> bigstring -> int list
+  (** Like [candidates], for a window of a bigstring, which is searched without
+      the runtime lock if it is large. *)
+end
+
+(** A bounded cache of compiled patterns, keyed by the pattern, its compile
+    options and (for the JIT) its JIT options and matching mode. Once full,
+    the least recently used pattern is evicted to make room for another.
+
+    A cache may be shared by threads and domains. Patterns are compiled
+    outside of its lock, so a pattern compiled by two at once is compiled
+    twice, but only cached once. Errors are not cached.
+
+    Regexes are equal, and hash alike, when compiled from the same pattern with
+    the same compile options, so they may also be kept in a [Hashtbl]. *)
+module Cache : sig
+  type t
+
+  type stats = {
+    hits : int;  (** Lookups which found the pattern compiled. *)
+    misses : int;  (** Lookups which compiled it. *)
+    evictions : int;  (** Patterns evicted to make room for another. *)
+  }
+  [@@deriving show, eq]
+
+  val create : capacity:int -> t
+  (** [create ~capacity] is an empty cache of at most [capacity] patterns.
+      Raises [Invalid_argument] unless [capacity] is positive. *)
+
+  val interp :
+    ?options:Options.Interp.compile_option list ->
+    t ->
+    string ->
+    (Interp.t, compile_error) Result.t
+  (** [interp cache pattern] is [Interp.compile pattern], compiled only if it
+      is not already in [cache]. *)
+
+  val jit :
+    ?options:Jit.compile_option list ->
+    ?mode:Options.Jit.matching_mode ->
+    t ->
+    string ->
+    (Jit.t, compile_error) Result.t
+  (** [jit cache pattern] is [Jit.compile pattern] (or, given [mode],
+      [Jit.of_interp ~mode]), compiled only if it is not already in [cache]. *)
+
+  val capacity : t -> int
+  val length : t -> int
+
+  val stats : t -> stats
+  (** [stats cache] is the number of hits, misses and evictions since [cache]
+      was created. *)
+
+  val clear : t -> unit
+  (** [clear cache] evicts every pattern, without counting them as evictions.
+  *)
+end
+
+(** A cache of compiled patterns kept in a file, so that later runs of a program
+    need not compile them again. Loading the file decodes every pattern in it;
+    they are JIT compiled only once first asked for with [jit]. A file written
+    by another version of PCRE2 is ignored. Safe to share between threads and
+    domains. *)
+module Disk_cache : sig
+  type t
+
+  val load : string -> t
+  (** [load path] is the cache kept in [path], empty if it does not exist or is
+      not a valid cache for this version of PCRE2. *)
+
+  val interp :
+    ?options:Options.Interp.compile_option list ->
+    t ->
+    string ->
+    (Interp.t, compile_error) Result.t
+  (** [interp cache pattern] is [Interp.compile pattern], compiled only if it
+      is not already in [cache]. *)
+
+  val jit :
+    ?options:Jit.compile_option list ->
+    t ->
+    string ->
+    (Jit.t, compile_error) Result.t
+  (** [jit cache pattern] is [Jit.compile pattern], JIT compiling a copy of the
+      pattern in [cache] (compiled first if need be) once per set of JIT
+      options. *)
+
+  val loaded : t -> int
+  (** [loaded cache] is the number of patterns which were loaded from the file.
+  *)
+
+  val length : t -> int
+
+  val save : t -> unit
+  (** [save cache] writes every pattern in [cache] to its file, replacing it
+      atomically, unless none has been compiled since it was loaded. Raises
+      [Sys_error] if the file cannot be written and [Failure] if PCRE2 cannot
+      serialize the patterns. *)
+end
+
+(** Patterns compiled when a program is built, by the [pcre2.ppx] rewriter:
+    [[%pcre2 "pattern"]] is a [Jit.t] and [[%pcre2.interp "pattern"]] an
+    [Interp.t]. The pattern must be a string literal, and may set options
+    inline (e.g., [(?i)]). An invalid pattern is reported when the program is
+    built. The compiled pattern is embedded in the program, marshalled, and
+    decoded once, when the module using it is initialized, so that every
+    evaluation of the expression is the same pattern. As with marshalling,
+    should the program be run with another version of PCRE2 than it was built
+    with (such as after an upgrade of a shared libpcre2), or on another kind of
+    host, the pattern is compiled again from the embedded pattern instead. *)
+module Embedded : sig
+  val interp : string -> Interp.t
+  (** [interp compiled] decodes a pattern embedded by [[%pcre2.interp]],
+      compiling it again if the code was compiled by another version of PCRE2.
+
+      @raise Failure if it cannot be decoded or compiled. *)
+
+  val jit : string -> Jit.t
+  (** [jit compiled] decodes a pattern embedded by [[%pcre2]] and JIT compiles
+      it.
+
+      @raise Failure if it cannot be JIT compiled. *)
+end
+
+(** Patterns which are interpreted until they have been used enough to be worth
+    JIT compiling, so that patterns used only a few times do not pay for JIT
+    compilation and its executable memory. Once a pattern has been used for
+    [uses] matches, or to match [bytes] bytes of subjects (see
+    [set_thresholds]), it is JIT compiled, once, by the first match to cross
+    the threshold; the matches of other threads and domains meanwhile continue
+    to be interpreted, and later matches use the JIT. Should JIT compilation
+    fail, the pattern remains interpreted. The JIT compiles a copy of the
+    pattern, so interpreted matches under way are unaffected.
+
+    The JIT compiled code of a pattern may be released, returning it to the
+    interpreter until it crosses the thresholds again; its executable memory is
+    freed once the GC has collected the JIT compiled copy (see
+    [Jit.free_unused_memory]). Given a budget, the patterns least recently
+    matched with the JIT are released whenever the JIT compiled code of every
+    pattern exceeds it. *)
+module Tiered : sig
+  include
+    Intf.Matcher
+      with type match_ = match_
+       and type captures = captures
+       and type captures_batch = captures_batch
+       and type compile_option = Jit.compile_option
+       and type compile_error = compile_error
+       and type match_option = Options.Jit.match_option
+       and type match_error = match_error
+
+  val is_jit : t -> bool
+  (** [is_jit re] is whether [re] has been JIT compiled. *)
+
+  val set_thresholds : uses:int -> bytes:int -> unit
+  (** [set_thresholds ~uses ~bytes] sets the thresholds of patterns compiled
+      hereafter. The defaults are [uses = 16] and [bytes = 1048576].
+
+      @raise Invalid_argument if either is negative. *)
+
+  val thresholds : unit -> int * int
+  (** [thresholds ()] is [(uses, bytes)], as set by [set_thresholds]. *)
+
+  val jit_size : t -> int
+  (** [jit_size re] is the size in bytes of the JIT compiled code of [re], or
+      0 if it is interpreted. *)
+
+  val release_jit : t -> unit
+  (** [release_jit re] returns [re] to the interpreter, if it is JIT compiled.
+  *)
+
+  val set_jit_budget : int option -> unit
+  (** [set_jit_budget (Some bytes)] bounds the total size of the JIT compiled
+      code of every pattern, releasing those least recently matched with the
+      JIT to stay within [bytes] whenever another is JIT compiled. [None], the
+      default, sets no bound.
+
+      @raise Invalid_argument if [bytes] is negative. *)
+
+  val jit_budget : unit -> int option
+  (** [jit_budget ()] is the budget, as set by [set_jit_budget]. *)
+end
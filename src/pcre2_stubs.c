@@ -1,14 +1,31 @@
+// For memmem.
+#define _GNU_SOURCE
+
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "caml/alloc.h"
+#include "caml/bigarray.h"
 #include "caml/config.h"
 #include "caml/custom.h"
+#include "caml/fail.h"
 #include "caml/memory.h"
 #include "caml/misc.h"
 #include "caml/mlvalues.h"
+#include "caml/signals.h"
+#include "caml/sys.h"
 
 // NOTE: Currently these bindings support only 8-bit code units. Below we use
 // the generically named functions. Future versions could include support for
@@ -28,10 +45,70 @@ const int RESULT_ERROR_TAG = 1;
 const int TUPLE_TAG = 0;
 const int ARRAY_TAG = 0;
 
+/// What is known of the subjects a regex can match, from which most subjects
+/// it cannot match are rejected without calling PCRE2 (see
+/// [prefilter_rejects]).
+struct prefilter {
+        /// The minimum length of a match (PCRE2_INFO_MINLENGTH), which is in
+        /// characters, and so never more than the length in bytes.
+        uint32_t min_length;
+        /// The code unit every match starts with (PCRE2_INFO_FIRSTCODEUNIT),
+        /// or -1 if there is none or it is not ASCII.
+        int first_code_unit;
+        /// The last literal code unit every match contains
+        /// (PCRE2_INFO_LASTCODEUNIT), or -1 if there is none or it is not
+        /// ASCII.
+        int last_code_unit;
+        /// Whether [first_bitmap] holds the code units a match may start with
+        /// (PCRE2_INFO_FIRSTBITMAP).
+        bool has_first_bitmap;
+        uint8_t first_bitmap[32];
+};
+
 struct ocaml_regex {
         pcre2_code *regex;
+        /// The prefilter of the regex, or NULL if it has none.
+        struct prefilter *prefilter;
+        /// The pattern and options the regex was compiled from, by which
+        /// regexes are compared and hashed (see [regex_ops]).
+        char *pattern;
+        size_t pattern_length;
+        uint32_t options;
+        /// The options the regex has been JIT compiled with, or 0 if it has
+        /// not been, so that it is JIT compiled again when unmarshalled (see
+        /// [ocaml_regex_deserialize]).
+        uint32_t jit_options;
+        /// The size of the code (PCRE2_INFO_SIZE) and of its JIT compiled code
+        /// (PCRE2_INFO_JITSIZE), as counted in [live_code_bytes] and
+        /// [live_jit_bytes].
+        size_t code_size;
+        size_t jit_size;
 };
 
+/// The number of regexes alive, and the total size of their code and JIT
+/// compiled code (see [memory_usage]).
+static atomic_size_t live_regex_count = 0;
+static atomic_size_t live_code_bytes = 0;
+static atomic_size_t live_jit_bytes = 0;
+
+/// The memory against which that of JIT compiled code is weighed when asking
+/// the GC to speed up, as for bigarrays: JIT compiling this much code makes
+/// the GC do a full major cycle.
+#define JIT_GC_MAX_MEMORY (256 * 1024 * 1024)
+
+static size_t jit_size_of(const pcre2_code *regex) {
+        size_t size = 0;
+        return pcre2_pattern_info(regex, PCRE2_INFO_JITSIZE, &size) == 0 ? size : 0;
+}
+
+/// Counts a new regex, whose [code_size] and [jit_size] have been set, among
+/// those alive.
+static void count_live_regex(const struct ocaml_regex *re) {
+        atomic_fetch_add(&live_regex_count, 1);
+        atomic_fetch_add(&live_code_bytes, re->code_size);
+        atomic_fetch_add(&live_jit_bytes, re->jit_size);
+}
+
 static inline struct ocaml_regex *regex_of_value(value v) {
         CAMLparam1(v);
         CAMLreturnT(struct ocaml_regex *, Data_custom_val(v));
@@ -39,239 +116,2003 @@ static inline struct ocaml_regex *regex_of_value(value v) {
 
 static void ocaml_regex_free(value ocaml_regex) {
         struct ocaml_regex *re = Data_custom_val(ocaml_regex);
+        atomic_fetch_sub(&live_regex_count, 1);
+        atomic_fetch_sub(&live_code_bytes, re->code_size);
+        atomic_fetch_sub(&live_jit_bytes, re->jit_size);
         pcre2_code_free(re->regex);
+        free(re->prefilter);
+        free(re->pattern);
+}
+
+/// Orders regexes by the options and then the pattern they were compiled
+/// from, so that regexes compiled alike are equal.
+///
+/// NOTE: Whether a regex has been JIT compiled is not considered, since that
+/// is done in place (see [jit_compile_unboxed]) and would otherwise change
+/// the hash of a regex already in a table. It does not change what matches.
+static int ocaml_regex_compare(value v1, value v2) {
+        const struct ocaml_regex *re1 = Data_custom_val(v1);
+        const struct ocaml_regex *re2 = Data_custom_val(v2);
+        if (re1->options != re2->options) {
+                return re1->options < re2->options ? -1 : 1;
+        }
+        size_t length = re1->pattern_length < re2->pattern_length ? re1->pattern_length
+                                                                  : re2->pattern_length;
+        int order = length ? memcmp(re1->pattern, re2->pattern, length) : 0;
+        if (order != 0) {
+                return order < 0 ? -1 : 1;
+        }
+        if (re1->pattern_length != re2->pattern_length) {
+                return re1->pattern_length < re2->pattern_length ? -1 : 1;
+        }
+        return 0;
+}
+
+/// Hashes a regex by the same pattern and options it is compared by, with
+/// FNV-1a.
+static intnat ocaml_regex_hash(value v) {
+        const struct ocaml_regex *re = Data_custom_val(v);
+        uint32_t hash = 2166136261u ^ re->options;
+        for (size_t i = 0; i < re->pattern_length; ++i) {
+                hash = (hash ^ (uint8_t)re->pattern[i]) * 16777619u;
+        }
+        return hash;
+}
+
+static struct prefilter *prefilter_create(const pcre2_code *re);
+static uint32_t pcre2_compile_options(uint32_t options, const char *pattern, size_t length);
+
+/// Marshals a regex as the options and pattern it was compiled from, the
+/// options it was JIT compiled with, and its code in the format of
+/// `pcre2_serialize_encode(3)`, so that it need not be compiled again.
+///
+/// NOTE: PCRE2 only decodes codes serialized by the same version of PCRE2 on
+/// a host of the same word size and endianness. Elsewhere, the regex is
+/// compiled again from its pattern (see [ocaml_regex_deserialize]).
+static void ocaml_regex_serialize(value v, uintnat *bsize_32, uintnat *bsize_64) {
+        const struct ocaml_regex *re = Data_custom_val(v);
+        uint8_t *bytes;
+        PCRE2_SIZE size;
+        const pcre2_code *codes[] = {re->regex};
+        int32_t ret = pcre2_serialize_encode(codes, 1, &bytes, &size, NULL);
+        if (ret < 0) {
+                caml_failwith("output_value: could not serialize a PCRE2 regex");
+        }
+        caml_serialize_int_4(re->options);
+        caml_serialize_int_4(re->jit_options);
+        caml_serialize_int_8(re->pattern_length);
+        caml_serialize_block_1(re->pattern, re->pattern_length);
+        caml_serialize_int_8(size);
+        caml_serialize_block_1(bytes, size);
+        pcre2_serialize_free(bytes);
+        *bsize_32 = sizeof(struct ocaml_regex);
+        *bsize_64 = sizeof(struct ocaml_regex);
+}
+
+/// Unmarshals a regex marshalled by [ocaml_regex_serialize], decoding its
+/// code and, if it had been JIT compiled, JIT compiling it with the same
+/// options, since a [jit regex] is only ever matched with the JIT. Should the
+/// code not decode, having been serialized by another version of PCRE2 or on
+/// another kind of host, the pattern is compiled again with its options.
+static uintnat ocaml_regex_deserialize(void *dst) {
+        struct ocaml_regex *re = dst;
+        re->options = caml_deserialize_uint_4();
+        re->jit_options = caml_deserialize_uint_4();
+        re->pattern_length = caml_deserialize_uint_8();
+        re->pattern = malloc(re->pattern_length + 1);
+        if (!re->pattern) {
+                caml_deserialize_error("out of memory for a PCRE2 regex");
+        }
+        caml_deserialize_block_1(re->pattern, re->pattern_length);
+        uint64_t size = caml_deserialize_uint_8();
+        uint8_t *bytes = malloc(size);
+        if (!bytes) {
+                free(re->pattern);
+                caml_deserialize_error("out of memory for a PCRE2 regex");
+        }
+        caml_deserialize_block_1(bytes, size);
+        int32_t ret = pcre2_serialize_decode(&re->regex, 1, bytes, NULL);
+        free(bytes);
+        if (ret < 0) {
+                int error_code;
+                PCRE2_SIZE error_offset;
+                re->regex = pcre2_compile(
+                    (PCRE2_SPTR)re->pattern, re->pattern_length,
+                    pcre2_compile_options(re->options, re->pattern, re->pattern_length),
+                    &error_code, &error_offset, NULL);
+                ret = re->regex ? 0 : -1;
+        }
+        if (ret >= 0 && re->jit_options && pcre2_jit_compile(re->regex, re->jit_options) < 0) {
+                pcre2_code_free(re->regex);
+                ret = -1;
+        }
+        if (ret < 0) {
+                free(re->pattern);
+                caml_deserialize_error("could not decode, compile or JIT compile a PCRE2 regex");
+        }
+        re->prefilter = prefilter_create(re->regex);
+        pcre2_pattern_info(re->regex, PCRE2_INFO_SIZE, &re->code_size);
+        re->jit_size = jit_size_of(re->regex);
+        count_live_regex(re);
+        caml_adjust_gc_speed(re->code_size + re->jit_size, JIT_GC_MAX_MEMORY);
+        return sizeof(struct ocaml_regex);
 }
 
 static struct custom_operations regex_ops = {.identifier = "pcre2_ocaml_regexp",
                                              .finalize = ocaml_regex_free,
-                                             .compare = NULL,
-                                             .hash = NULL,
-                                             .serialize = NULL,
-                                             .deserialize = NULL,
+                                             .compare = ocaml_regex_compare,
+                                             .hash = ocaml_regex_hash,
+                                             .serialize = ocaml_regex_serialize,
+                                             .deserialize = ocaml_regex_deserialize,
                                              .compare_ext = NULL,
                                              .fixed_length = NULL};
 
-CAMLprim void pcre2_ocaml_init(void) {
-        CAMLparam0();
-        CAMLreturn0;
-}
+/// The matching functions of PCRE2 which may be used with a compiled regex.
+enum engine {
+        /// `pcre2_match`, which also uses the JIT if the regex has been JIT
+        /// compiled.
+        ENGINE_INTERP,
+        /// `pcre2_jit_match`.
+        ENGINE_JIT,
+        /// `pcre2_dfa_match`.
+        ENGINE_DFA,
+};
 
-/// Returns the PCRE2 version the library was compiled with.
-CAMLprim value get_version(void) /* -> int * int */ {
-        CAMLparam0();
-        CAMLlocal1(version);
-        // SAFETY: This allocation is immediately filled with well-formed
-        // values prior to returning.
-        version = caml_alloc_small(2, TUPLE_TAG);
-        Field(version, 0) = Val_int(PCRE2_MAJOR);
-        Field(version, 1) = Val_int(PCRE2_MINOR);
-        CAMLreturn(version);
-}
+/// The workspace used by `pcre2_dfa_match`, which is grown as needed.
+struct dfa_workspace {
+        int *data;
+        size_t size;
+};
 
-/// Compiles the provided pattern.
+/// The initial and maximum sizes, in ints, of a DFA workspace. PCRE2 requires
+/// at least 20; each state the DFA tracks takes 2 or 3.
+static const size_t dfa_workspace_start_size = 1024;
+static const size_t dfa_workspace_max_size = 16 * 1024 * 1024;
+
+/// The number of pairs in the offset vector of match data used to report every
+/// match the DFA finds at a position (longest first). Any beyond this are not
+/// reported.
+static const uint32_t dfa_alternatives = 64;
+
+/// Replaces a DFA workspace with a larger one, or allocates it if it has yet
+/// to be.
 ///
-/// Note that the options from OCaml are not split between those which can
-/// directly be provided and those which are specified in the extra word passed
-/// via the compile context.
+/// @return false if the workspace is already as large as is permitted, or a
+/// larger one could not be allocated.
+static bool grow_dfa_workspace(struct dfa_workspace *workspace) {
+        if (!workspace || workspace->size >= dfa_workspace_max_size) {
+                return false;
+        }
+        size_t size = workspace->size ? 2 * workspace->size : dfa_workspace_start_size;
+        int *data = realloc(workspace->data, size * sizeof(int));
+        if (!data) {
+                return false;
+        }
+        workspace->data = data;
+        workspace->size = size;
+        return true;
+}
+
+/// Long-lived match data, reused across calls to avoid allocating (and
+/// freeing) the offset vector and backtracking frames for each match.
 ///
-/// @param[in] pattern The pattern to compile. See `pcre2pattern(3)` for
-/// details.
-/// @param[in] options The options, specified via a bitvector. See
-/// `pcre2_compile(3)`.
-/// @return A result comprising the compiled pattern or a structured error.
-CAMLprim value compile_unboxed(value pattern /* : string */,
-                               uint32_t options /* : int32 [@unboxed] */
-                               /* another arg for compile context options? */
-                               ) /* : -> (regex, int) Result.t */ {
-        CAMLparam1(pattern);
-        CAMLlocal2(result, regex_value);
+/// NOTE: PCRE2 (since 10.41) retains the heap frame vector used by the
+/// interpreter in the match data, so reusing it also keeps those frames warm.
+struct ocaml_match_data {
+        pcre2_match_data *match_data;
+        /// The workspace for DFA matching, which is only allocated once it is
+        /// used. It is held by pointer since it may be grown while the runtime
+        /// lock is released, when the custom block may be moved.
+        struct dfa_workspace *workspace;
+};
 
-        size_t ocaml_regexp_size = sizeof(struct ocaml_regex);
-        int error_code;
-        size_t error_offset;
-        size_t pattern_len = caml_string_length(pattern);
+static inline struct ocaml_match_data *match_data_of_value(value v) {
+        CAMLparam1(v);
+        CAMLreturnT(struct ocaml_match_data *, Data_custom_val(v));
+}
 
-        pcre2_compile_context *ccontext = NULL;
-        // TODO(cooper): allocated compile_context for the "extra" options if need be.
-        // SAFETY: Passing in the value of String_val(subject) here is fine
-        // since a GC cannot occur (and the resulting value, which is held across GC, does not refer
-        // to the string).
-        pcre2_code *regex = pcre2_compile((PCRE2_SPTR)String_val(pattern), pattern_len, options,
-                                          &error_code, &error_offset, ccontext);
-        pcre2_compile_context_free(ccontext);
+static void ocaml_match_data_free(value ocaml_match_data) {
+        struct ocaml_match_data *md = Data_custom_val(ocaml_match_data);
+        pcre2_match_data_free(md->match_data);
+        free(md->workspace->data);
+        free(md->workspace);
+}
 
-        if (!regex) {
-                // Returns [Error e] since the pattern could not be compiled.
-                result = caml_alloc_small(1, RESULT_ERROR_TAG);
-                // TODO(cooper): mapping between error codes here and datatype
-                // above.
-                Field(result, 0) = Val_int(error_code);
-                CAMLreturn(result);
+static struct custom_operations match_data_ops = {.identifier = "pcre2_ocaml_match_data",
+                                                  .finalize = ocaml_match_data_free,
+                                                  .compare = NULL,
+                                                  .hash = NULL,
+                                                  .serialize = NULL,
+                                                  .deserialize = NULL,
+                                                  .compare_ext = NULL,
+                                                  .fixed_length = NULL};
+
+/// Returns the match data held by an OCaml [match_data option], or NULL if it
+/// is [None].
+static inline pcre2_match_data *match_data_of_option(value v /* : match_data option */) {
+        return Is_block(v) ? match_data_of_value(Field(v, 0))->match_data : NULL;
+}
+
+/// Returns match data private to the calling thread which has room for a
+/// single pair in its offset vector. This suffices for any matching which only
+/// reports the range of the whole match, and is used when the caller has not
+/// provided match data of its own.
+///
+/// NOTE: The match data is never freed; it lives as long as the thread.
+static pcre2_match_data *scratch_match_data(void) {
+        static _Thread_local pcre2_match_data *scratch = NULL;
+        if (!scratch) {
+                // On failure this remains NULL, for which matching reports
+                // PCRE2_ERROR_NULL.
+                scratch = pcre2_match_data_create(1, NULL);
         }
+        return scratch;
+}
 
-        // caml_alloc_custom_mem wants a size estimate of the allocated
-        size_t pcre2_allocated_mem;
-        pcre2_pattern_info(regex, PCRE2_INFO_SIZE, &pcre2_allocated_mem);
-        // TODO(cooper): used mem amount needs increased later if we jit?
-        regex_value = caml_alloc_custom_mem(&regex_ops, ocaml_regexp_size, pcre2_allocated_mem);
-        regex_of_value(regex_value)->regex = regex;
+/// Returns the DFA workspace held by an OCaml [match_data option] or, if it is
+/// [None], one private to the calling thread.
+///
+/// NOTE: The scratch workspace is never freed; it lives as long as the thread.
+static struct dfa_workspace *workspace_of_option(value v /* : match_data option */) {
+        static _Thread_local struct dfa_workspace scratch = {NULL, 0};
+        return Is_block(v) ? match_data_of_value(Field(v, 0))->workspace : &scratch;
+}
 
-        // Return [Ok regex]
+/// Creates match data with room for every capture group of a regex or, for
+/// the DFA, for every alternative match it reports.
+static pcre2_match_data *match_data_for_captures(const pcre2_code *re, enum engine engine) {
+        return engine == ENGINE_DFA ? pcre2_match_data_create(dfa_alternatives, NULL)
+                                    : pcre2_match_data_create_from_pattern(re, NULL);
+}
+
+/// Allocates an [Error error_code] value.
+static value alloc_error(int error_code) /* : -> (_, int) Result.t */ {
+        CAMLparam0();
+        CAMLlocal1(result);
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        result = caml_alloc_small(1, RESULT_ERROR_TAG);
+        Field(result, 0) = Val_int(error_code);
+        CAMLreturn(result);
+}
+
+/// Allocates an [Ok v] value.
+static value alloc_ok(value v) /* : -> (_, _) Result.t */ {
+        CAMLparam1(v);
+        CAMLlocal1(result);
         // SAFETY: This allocation is immediately filled with well-formed
         // values prior to returning.
         result = caml_alloc_small(1, RESULT_OK_TAG);
-        Field(result, 0) = regex_value;
+        Field(result, 0) = v;
+        CAMLreturn(result);
+}
+
+/// Allocates an [Some v] value.
+static value alloc_some(value v) /* : -> _ option */ {
+        CAMLparam1(v);
+        CAMLlocal1(option);
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        option = caml_alloc_small(1, OPTION_SOME_TAG);
+        Field(option, 0) = v;
+        CAMLreturn(option);
+}
+
+/// Returns a pointer to the contents of a subject, which is either an OCaml
+/// string or a one-dimensional Bigarray of chars (see [Bindings.subject]).
+///
+/// NOTE: The contents of a string may be moved by the GC, so the pointer must
+/// not be used after anything which may allocate on the OCaml heap. Those of a
+/// Bigarray are outside of the heap, and so are not.
+static inline PCRE2_SPTR subject_pointer(value subject /* : subject */) {
+        return Tag_val(subject) == String_tag ? (PCRE2_SPTR)String_val(subject)
+                                              : (PCRE2_SPTR)Caml_ba_data_val(subject);
+}
+
+/// Returns the length in bytes of a subject. See [subject_pointer].
+static inline size_t subject_size(value subject /* : subject */) {
+        return Tag_val(subject) == String_tag ? caml_string_length(subject)
+                                              : (size_t)Caml_ba_array_val(subject)->dim[0];
+}
+
+/// Returns the length in bytes of a subject.
+CAMLprim intnat subject_length_unboxed(value subject /* : subject */
+                                       ) /* : -> int [@untagged] [@@noalloc] */ {
+        return subject_size(subject);
+}
+
+/// Boxed argument version of [subject_length_unboxed] (for bytecode).
+CAMLprim value subject_length(value subject) {
+        return Val_long(subject_length_unboxed(subject));
+}
 
+/// Copies part of a subject into a fresh OCaml string.
+///
+/// @param[in] subject The subject to copy from.
+/// @param[in] start The byte index in the subject at which to begin.
+/// @param[in] length The number of bytes to copy, which (like [start]) must
+/// be within the bounds of the subject.
+CAMLprim value subject_sub(value subject /* : subject */, value start /* : int */,
+                           value length /* : int */) /* : -> string */ {
+        CAMLparam1(subject);
+        CAMLlocal1(result);
+        result = caml_alloc_string(Long_val(length));
+        // SAFETY: The subject pointer is retrieved after the allocation, so is
+        // valid even if it caused a string subject to be moved.
+        memcpy(Bytes_val(result), subject_pointer(subject) + Long_val(start), Long_val(length));
         CAMLreturn(result);
 }
 
-/// Boxed argument version of [compile_unboxed] (for bytecode).
-CAMLprim value compile(value *argv, int argc UNUSED) {
-        return compile_unboxed(argv[0], Int32_val(argv[1]));
+/// The size in bytes from which subjects outside of the OCaml heap are matched
+/// without holding the runtime lock, so that other threads may run meanwhile.
+/// Smaller subjects are matched quickly enough that releasing and reacquiring
+/// the lock would cost more than it saves.
+static atomic_size_t release_lock_threshold = 64 * 1024;
+
+/// Sets [release_lock_threshold]; a negative value means the lock is never
+/// released.
+CAMLprim value set_release_lock_threshold(value threshold /* : int */) /* : -> unit */ {
+        intnat n = Long_val(threshold);
+        atomic_store_explicit(&release_lock_threshold, n < 0 ? SIZE_MAX : (size_t)n,
+                              memory_order_relaxed);
+        return Val_unit;
 }
 
-/// Match with the provided pattern.
+/// Returns [release_lock_threshold], or -1 if the lock is never released.
+CAMLprim value get_release_lock_threshold(value unit UNUSED) /* : -> int */ {
+        size_t n = atomic_load_explicit(&release_lock_threshold, memory_order_relaxed);
+        return Val_long(n == SIZE_MAX ? -1 : (intnat)n);
+}
+
+/// Releases the runtime lock, if matching on [subject] may be done without
+/// it (see [release_lock_threshold]).
 ///
-/// @param[in] ocaml_re The compiled regex to use for matching.
-/// @param[in] subject The string to be searched.
-/// @param[in] subject_offset The byte index in the subject at which to begin.
-/// @param[in] options Matching options, specified via a bitvector . See `pcre2_match(3)`.
-// TODO: allow reusing the pcre2_match_data struct so that exec_all / find_iter
-// / captures_iter can avoid a bunch of allocations.
-// Ideally this function doesn't allocate except for some `caml_alloc_small`s.
-CAMLprim value match_unboxed(value ocaml_re /* : _ regex */, value subject /* : string */,
-                             intnat subject_offset /* : int [@untagged] */,
-                             uint32_t options /* : int32 */
-                             ) /* : -> ((int * int) option, int) Result.t */ {
-        CAMLparam2(ocaml_re, subject);
-        CAMLlocal3(result, range, match);
+/// NOTE: While the lock is released, no OCaml values may be accessed. The
+/// contents of an off-heap subject, and the compiled regex and match data
+/// (which are allocated by PCRE2) remain valid, as long as the values holding
+/// them are registered as roots by the caller.
+///
+/// @return Whether the lock was released, to be passed to [end_matching].
+static bool begin_matching(value subject /* : subject */) {
+        if (Tag_val(subject) == String_tag
+            || subject_size(subject)
+                   < atomic_load_explicit(&release_lock_threshold, memory_order_relaxed)) {
+                return false;
+        }
+        caml_enter_blocking_section();
+        return true;
+}
 
-        // Need to handle this case manually since PCRE2 takes an unsigned value.
-        if (subject_offset < 0) {
-                // SAFETY: This allocation is immediately filled with
-                // well-formed values prior to returning.
-                result = caml_alloc_small(1, RESULT_ERROR_TAG);
-                Field(result, 0) = Val_int(PCRE2_ERROR_BADOFFSET);
-                CAMLreturn(result);
+/// Reacquires the runtime lock, if [begin_matching] released it.
+static void end_matching(bool released) {
+        if (released) {
+                caml_leave_blocking_section();
         }
-        size_t offset = subject_offset;
-        size_t subject_length = caml_string_length(subject);
+}
 
-        const pcre2_code *re = regex_of_value(ocaml_re)->regex;
-        // TODO: support match/depth limits. Or callouts. May need to be
-        // bundled with the compiled regex.
-        pcre2_match_context *mcontext = NULL;
-        pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(re, NULL);
+/// The bounds on the size of the JIT stack of each thread. See
+/// [thread_jit_stack].
+static atomic_size_t jit_stack_start_size = 128 * 1024;
+static atomic_size_t jit_stack_max_size = 8 * 1024 * 1024;
 
-        int ret = pcre2_match(re, (PCRE2_SPTR)String_val(subject), subject_length, offset, options,
-                              match_data, mcontext);
-        PCRE2_SIZE *ovec = pcre2_get_ovector_pointer(match_data);
+/// The JIT stack of the calling thread, and its maximum size.
+///
+/// Matching first uses the 32 KiB stack PCRE2 provides on the machine stack
+/// (as is done when no JIT stack is assigned), which suffices for most
+/// patterns. Should that be exhausted, the thread is given a JIT stack of
+/// [jit_stack_start_size] bytes, then one twice the size each time that is in
+/// turn exhausted, up to [jit_stack_max_size] bytes. Each thread (and so each
+/// domain) has its own, since a JIT stack may only be used by one thread at a
+/// time.
+///
+/// NOTE: The stack is never freed; it lives as long as the thread.
+static _Thread_local pcre2_jit_stack *thread_jit_stack = NULL;
+static _Thread_local size_t thread_jit_stack_size = 0;
+
+/// Returns the JIT stack of the calling thread, if it has one, for PCRE2 to
+/// use (otherwise it uses its default stack).
+static pcre2_jit_stack *thread_jit_stack_callback(void *data UNUSED) {
+        return thread_jit_stack;
+}
 
-        if (ret == PCRE2_ERROR_NOMATCH || ret == PCRE2_ERROR_PARTIAL) {
-                pcre2_match_data_free(match_data);
-                // SAFETY: This allocation is immediately filled with
-                // well-formed values prior to returning.
-                result = caml_alloc_small(1, RESULT_OK_TAG);
-                Field(result, 0) = Val_none;
-                CAMLreturn(result);
-        } else if (ret <= 0) {
-                pcre2_match_data_free(match_data);
-                // SAFETY: This allocation is immediately filled with
-                // well-formed values prior to returning.
-                result = caml_alloc_small(1, RESULT_ERROR_TAG);
-                Field(result, 0) = Val_int(ret);
-                CAMLreturn(result);
+/// Replaces the JIT stack of the calling thread with a larger one.
+///
+/// @return false if the stack is already as large as is permitted, or a larger
+/// one could not be allocated.
+static bool grow_thread_jit_stack(void) {
+        size_t start = atomic_load_explicit(&jit_stack_start_size, memory_order_relaxed);
+        size_t max = atomic_load_explicit(&jit_stack_max_size, memory_order_relaxed);
+        if (thread_jit_stack_size >= max) {
+                return false;
+        }
+        size_t size = thread_jit_stack_size ? 2 * thread_jit_stack_size : start;
+        if (size > max) {
+                size = max;
         }
+        // NOTE: The memory for the stack is reserved up front, but only
+        // committed as it is used.
+        pcre2_jit_stack *stack = pcre2_jit_stack_create(size, size, NULL);
+        if (!stack) {
+                return false;
+        }
+        pcre2_jit_stack_free(thread_jit_stack);
+        thread_jit_stack = stack;
+        thread_jit_stack_size = size;
+        return true;
+}
 
-        // SAFETY: This allocation is immediately filled with well-formed values.
-        range = caml_alloc_small(2, TUPLE_TAG);
-        Field(range, 0) = Val_int(ovec[0]);
-        Field(range, 1) = Val_int(ovec[1]);
+/// Sets the bounds on the size of JIT stacks created hereafter.
+CAMLprim value set_jit_stack_sizes(value start /* : int */, value max /* : int */) /* : -> unit */ {
+        atomic_store_explicit(&jit_stack_start_size, Long_val(start), memory_order_relaxed);
+        atomic_store_explicit(&jit_stack_max_size, Long_val(max), memory_order_relaxed);
+        return Val_unit;
+}
 
-        pcre2_match_data_free(match_data);
+/// Returns the bounds on the size of JIT stacks.
+CAMLprim value get_jit_stack_sizes(value unit UNUSED) /* : -> int * int */ {
+        CAMLparam0();
+        CAMLlocal1(sizes);
+        size_t start = atomic_load_explicit(&jit_stack_start_size, memory_order_relaxed);
+        size_t max = atomic_load_explicit(&jit_stack_max_size, memory_order_relaxed);
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        sizes = caml_alloc_small(2, TUPLE_TAG);
+        Field(sizes, 0) = Val_long(start);
+        Field(sizes, 1) = Val_long(max);
+        CAMLreturn(sizes);
+}
 
-        // SAFETY: This allocation is immediately filled with well-formed values.
-        match = caml_alloc_small(1, OPTION_SOME_TAG);
-        Field(match, 0) = range;
+/// The error codes returned, in place of PCRE2's own, when a guarded match is
+/// abandoned (see [struct ocaml_match_context]).
+#define PCRE2_OCAML_ERROR_TIMEOUT (-1000)
+#define PCRE2_OCAML_ERROR_CANCELLED (-1001)
+
+/// A flag which cancels the matches guarded by it once set, which may be done
+/// from any thread. It is shared by the OCaml value and every match context
+/// referring to it, and freed once the last of them is.
+struct cancel_flag {
+        atomic_bool cancelled;
+        atomic_uint references;
+};
 
-        // SAFETY: This allocation is immediately filled with
-        // well-formed values prior to returning.
-        result = caml_alloc_small(1, RESULT_OK_TAG);
-        Field(result, 0) = match;
+static void cancel_flag_release(struct cancel_flag *flag) {
+        if (flag && atomic_fetch_sub(&flag->references, 1) == 1) {
+                free(flag);
+        }
+}
 
-        CAMLreturn(result);
+static inline struct cancel_flag **cancel_flag_of_value(value v) {
+        CAMLparam1(v);
+        CAMLreturnT(struct cancel_flag **, Data_custom_val(v));
 }
 
-/// Boxed argument version of [jit_match_unboxed] (for bytecode).
-CAMLprim value match(value *argv, int argc UNUSED) {
-        return match_unboxed(argv[0], argv[1], Nativeint_val(argv[2]), Int32_val(argv[3]));
+static void ocaml_cancel_flag_free(value ocaml_cancel_flag) {
+        cancel_flag_release(*(struct cancel_flag **)Data_custom_val(ocaml_cancel_flag));
 }
 
-/// Requests JIT compilation for a processed regex.
-///
-/// @param[in] regex The already processed regex.
-/// @param[in] options JIT compilation options, specified via a bitvector . See
-/// `pcre2_jit_compile(3)`.
-CAMLprim value jit_compile_unboxed(
-    value ocaml_re /* : interp regex */,
-    uint32_t options /* : int32 [@unboxed] */) /* : -> (jit regex, int) Result.t */ {
-        // NOTE: The return value of the function is 0 for success, or a
-        // negative error code otherwise. In particular,
-        // PCRE2_ERROR_JIT_BADOPTION is returned if JIT is not supported or if
-        // an unknown bit is set in options. The function can also return
-        // PCRE2_ERROR_NOMEMORY if JIT is unable to allocate executable memory
-        // for the compiler, even if it was because of a system security
-        // restriction.
+static struct custom_operations cancel_flag_ops = {.identifier = "pcre2_ocaml_cancel_flag",
+                                                   .finalize = ocaml_cancel_flag_free,
+                                                   .compare = NULL,
+                                                   .hash = NULL,
+                                                   .serialize = NULL,
+                                                   .deserialize = NULL,
+                                                   .compare_ext = NULL,
+                                                   .fixed_length = NULL};
+
+/// Creates a cancellation flag, which is initially unset.
+CAMLprim value cancel_flag_create(value unit UNUSED) /* : -> cancel_flag */ {
+        CAMLparam0();
+        CAMLlocal1(flag_value);
+        struct cancel_flag *flag = malloc(sizeof(struct cancel_flag));
+        if (!flag) {
+                caml_raise_out_of_memory();
+        }
+        atomic_init(&flag->cancelled, false);
+        atomic_init(&flag->references, 1);
+        flag_value = caml_alloc_custom(&cancel_flag_ops, sizeof(struct cancel_flag *), 0, 1);
+        *cancel_flag_of_value(flag_value) = flag;
+        CAMLreturn(flag_value);
+}
 
-        // How to handle allocation failure (can be due to security policy) or
-        // lack of jit support? Result seems fine but a bit annoying maybe
-        CAMLparam1(ocaml_re);
-        CAMLlocal1(result);
+/// Sets a cancellation flag. Matches guarded by it stop at their next check.
+CAMLprim value cancel_flag_set(value flag /* : cancel_flag */) /* : -> unit */ {
+        atomic_store(&(*cancel_flag_of_value(flag))->cancelled, true);
+        return Val_unit;
+}
 
-        int res = pcre2_jit_compile(regex_of_value(ocaml_re)->regex, options);
-        if (res < 0) {
-                // SAFETY: This allocation is immediately filled with
-                // well-formed values prior to returning.
-                result = caml_alloc_small(1, RESULT_ERROR_TAG);
-                Field(0, result) = Val_int(res);
-                CAMLreturn(result);
+/// Returns whether a cancellation flag has been set.
+CAMLprim value cancel_flag_is_set(value flag /* : cancel_flag */) /* : -> bool */ {
+        return Val_bool(atomic_load(&(*cancel_flag_of_value(flag))->cancelled));
+}
+
+/// A mutex which may be shared by threads and domains alike, for state kept on
+/// the OCaml side (such as [Cache] in pcre2.ml). The custom block holds a
+/// pointer to it, since a locked mutex must not be moved by the GC.
+static void ocaml_mutex_free(value ocaml_mutex) {
+        pthread_mutex_t *mutex = *(pthread_mutex_t **)Data_custom_val(ocaml_mutex);
+        pthread_mutex_destroy(mutex);
+        free(mutex);
+}
+
+static struct custom_operations mutex_ops = {.identifier = "pcre2_ocaml_mutex",
+                                             .finalize = ocaml_mutex_free,
+                                             .compare = NULL,
+                                             .hash = NULL,
+                                             .serialize = NULL,
+                                             .deserialize = NULL,
+                                             .compare_ext = NULL,
+                                             .fixed_length = NULL};
+
+/// Creates a mutex, which is initially unlocked.
+CAMLprim value mutex_create(value unit UNUSED) /* : -> mutex */ {
+        CAMLparam0();
+        CAMLlocal1(mutex_value);
+        pthread_mutex_t *mutex = malloc(sizeof(pthread_mutex_t));
+        if (!mutex) {
+                caml_raise_out_of_memory();
         }
+        pthread_mutex_init(mutex, NULL);
+        mutex_value = caml_alloc_custom(&mutex_ops, sizeof(pthread_mutex_t *), 0, 1);
+        *(pthread_mutex_t **)Data_custom_val(mutex_value) = mutex;
+        CAMLreturn(mutex_value);
+}
 
-        // SAFETY: This allocation is immediately filled with well-formed
-        // values prior to returning.
-        result = caml_alloc_small(1, RESULT_OK_TAG);
-        // TODO: this seems bad, since in OCaml we could then have
-        // {x : interp regex} and {y : jit regex}, pointers to the same regex.
-        //
-        // This is maybe actually fine here, and mostly depends on if you can
-        // call pcre2_jit_compile multiple times on the same pcer2_code*
-        // safely. Since pcre2_match permits jit, and while {interp regex} is
-        // "really" interpreted OR JIT, {jit regex} is definitely JIT.
-        Field(0, result) = ocaml_re;
-        CAMLreturn(result);
+/// Locks a mutex, blocking until it is free.
+///
+/// NOTE: The holder of the mutex may be waiting for the runtime lock, so it is
+/// released while this blocks, as by the Mutex module of OCaml.
+CAMLprim value mutex_lock(value ocaml_mutex /* : mutex */) /* : -> unit */ {
+        CAMLparam1(ocaml_mutex);
+        pthread_mutex_t *mutex = *(pthread_mutex_t **)Data_custom_val(ocaml_mutex);
+        if (pthread_mutex_trylock(mutex) != 0) {
+                caml_enter_blocking_section();
+                pthread_mutex_lock(mutex);
+                caml_leave_blocking_section();
+        }
+        CAMLreturn(Val_unit);
 }
 
-/// Boxed argument version of [jit_compile_unboxed] (for bytecode).
-CAMLprim value jit_compile(value *argv, int argc UNUSED) {
-        return jit_compile_unboxed(argv[0], Int32_val(argv[1]));
+/// Unlocks a mutex held by the calling thread.
+CAMLprim value mutex_unlock(value ocaml_mutex /* : mutex */) /* : -> unit */ {
+        pthread_mutex_unlock(*(pthread_mutex_t **)Data_custom_val(ocaml_mutex));
+        return Val_unit;
 }
 
-/// Match with the provided JIT compiled regex.
+/// A match context, which bounds the resources a match may consume. It is
+/// never modified once created, so may be shared between threads.
 ///
-/// @param[in] ocaml_re The JIT regex to use for matching.
-/// @param[in] subject The string to be searched.
-/// @param[in] subject_offset The byte index in the subject at which to begin.
-/// @param[in] options Matching options, specified via a bitvector. See
-/// `pcre2_match(3)`. NOTE: PCRE2_ZERO_TERMINATED is not supported, but this
-/// isn't much of an issue since we are dealing with OCaml strings.
-CAMLprim value jit_match_unboxed(value ocaml_re /* : jit regex */, value subject /* : string */,
-                                 int subject_offset /* : int [@untagged] */,
-                                 uint32_t options /* : int32 */
-                                 ) /* : -> ((int * int) option, int) Result.t */ {
-        // TODO: Mostly copied from match_stub impl
-        //
-        //
-        // NOTE: In UTF mode, the subject string is not checked for UTF
+/// A context may also guard matching with a timeout or a cancellation flag.
+/// Matching cannot be interrupted other than by a callout, which only occurs
+/// for patterns containing them (or compiled with AUTO_CALLOUT), so the guard
+/// is instead checked between calls to PCRE2, of which a guarded match is
+/// split into many (see [run_match]):
+///
+/// - The start positions of a match are tried a chunk at a time, by way of
+///   PCRE2's offset limit, each chunk twice as long as the one before.
+/// - Each chunk is first tried with a small match limit, which bounds the
+///   backtracking done from any one start position. Should that be reached,
+///   the chunk is tried again from scratch with twice the limit, and so on up
+///   to the requested limit.
+///
+/// Since each call to PCRE2 does about as much work as every call before it
+/// put together, at most, this at most doubles or so the work done by a match
+/// which runs to completion. By the same token, a match may run past its
+/// deadline by about as long again as it has already run: a timeout of [t]
+/// fails a match within about [2t]. The guard is also checked by callouts,
+/// every so many, and before each match in a batch.
+struct ocaml_match_context {
+        /// The contexts to try a match with in turn, of increasing match
+        /// limits. There is only one unless the context is guarded.
+        pcre2_match_context **attempts;
+        size_t attempt_count;
+        /// The limits of the last attempt, which a guarded match splits into
+        /// chunks also uses (see [thread_chunk_context]).
+        uint32_t match_limit;
+        uint32_t depth_limit;
+        uint32_t heap_limit;
+        /// The time allowed for each call to match, or a negative number for
+        /// no limit.
+        int64_t timeout_ns;
+        /// The cancellation flag, if any.
+        struct cancel_flag *cancel;
+};
+
+/// The match limit of the first attempt at a guarded match.
+static const uint32_t first_guarded_match_limit = 16 * 1024;
+
+/// The number of start positions in the first chunk of a guarded match.
+static const size_t first_guarded_chunk_length = 256;
+
+/// The time by which a guarded match on the calling thread must finish. See
+/// [arm_guard].
+static _Thread_local uint64_t thread_deadline_ns = UINT64_MAX;
+
+/// Callouts seen on the calling thread since the guard was last checked.
+static _Thread_local uint32_t thread_callouts = 0;
+
+static uint64_t monotonic_ns(void) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static inline bool is_guarded(const struct ocaml_match_context *mc) {
+        return mc->timeout_ns >= 0 || mc->cancel;
+}
+
+/// Starts the clock for a call which matches with the provided context. Each
+/// call into the bindings has a timeout of its own.
+static void arm_guard(const struct ocaml_match_context *mc) {
+        if (mc->timeout_ns >= 0) {
+                thread_deadline_ns = monotonic_ns() + mc->timeout_ns;
+        }
+}
+
+/// @return 0 if a guarded match may continue, or otherwise the error code to
+/// abandon it with.
+static int check_guard(const struct ocaml_match_context *mc) {
+        if (mc->cancel && atomic_load_explicit(&mc->cancel->cancelled, memory_order_relaxed)) {
+                return PCRE2_OCAML_ERROR_CANCELLED;
+        }
+        if (mc->timeout_ns >= 0 && monotonic_ns() >= thread_deadline_ns) {
+                return PCRE2_OCAML_ERROR_TIMEOUT;
+        }
+        return 0;
+}
+
+/// Checks the guard of a match every so many callouts, abandoning the match
+/// (by returning a negative value) if need be.
+static int guard_callout(pcre2_callout_block *block UNUSED, void *data) {
+        if (++thread_callouts < 64) {
+                return 0;
+        }
+        thread_callouts = 0;
+        return check_guard(data);
+}
+
+static void match_context_free(struct ocaml_match_context *mc) {
+        for (size_t i = 0; i < mc->attempt_count; ++i) {
+                pcre2_match_context_free(mc->attempts[i]);
+        }
+        free(mc->attempts);
+        cancel_flag_release(mc->cancel);
+        free(mc);
+}
+
+static void ocaml_match_context_free(value ocaml_match_context) {
+        match_context_free(*(struct ocaml_match_context **)Data_custom_val(ocaml_match_context));
+}
+
+static struct custom_operations match_context_ops = {.identifier = "pcre2_ocaml_match_context",
+                                                     .finalize = ocaml_match_context_free,
+                                                     .compare = NULL,
+                                                     .hash = NULL,
+                                                     .serialize = NULL,
+                                                     .deserialize = NULL,
+                                                     .compare_ext = NULL,
+                                                     .fixed_length = NULL};
+
+/// The match context used when no other is specified, which only assigns the
+/// JIT stack of the calling thread. It is created once, and never modified, so
+/// may be shared by every thread.
+static pcre2_match_context *default_pcre2_match_context = NULL;
+static struct ocaml_match_context default_match_context = {
+    .attempts = &default_pcre2_match_context,
+    .attempt_count = 1,
+    .match_limit = 0,
+    .depth_limit = 0,
+    .heap_limit = 0,
+    .timeout_ns = -1,
+    .cancel = NULL,
+};
+
+CAMLprim void pcre2_ocaml_init(void) {
+        CAMLparam0();
+        // On failure this remains NULL, for which PCRE2 uses its defaults
+        // (without the thread's JIT stack).
+        caml_register_custom_operations(&regex_ops);
+        default_pcre2_match_context = pcre2_match_context_create(NULL);
+        if (default_pcre2_match_context) {
+                pcre2_jit_stack_assign(default_pcre2_match_context, thread_jit_stack_callback,
+                                       NULL);
+        }
+        CAMLreturn0;
+}
+
+// NOTE: The custom block holds a pointer to the context, rather than the
+// context itself, since the context is passed to callouts and so must not be
+// moved by the GC.
+static inline struct ocaml_match_context **match_context_of_value(value v) {
+        CAMLparam1(v);
+        CAMLreturnT(struct ocaml_match_context **, Data_custom_val(v));
+}
+
+/// Returns the match context held by an OCaml [match_context option], or the
+/// default match context if it is [None].
+static inline const struct ocaml_match_context *match_context_of_option(
+    value v /* : match_context option */) {
+        return Is_block(v) ? *match_context_of_value(Field(v, 0)) : &default_match_context;
+}
+
+/// Creates a match context with the provided limits. Each limit is one of
+/// PCRE2's own defaults if it is negative.
+///
+/// @param[in] match_limit The limit on the number of times the internal
+/// matching function may be called (see `pcre2_set_match_limit(3)`). This also
+/// applies to JIT matching.
+/// @param[in] depth_limit The limit on the depth of nested backtracking (see
+/// `pcre2_set_depth_limit(3)`). This is ignored by JIT matching.
+/// @param[in] heap_limit The limit, in kibibytes, on the heap memory used to
+/// hold backtracking information (see `pcre2_set_heap_limit(3)`). This is
+/// ignored by JIT matching.
+/// @param[in] timeout_ns The time, in nanoseconds, each call to match may
+/// take, or a negative number for no limit.
+/// @param[in] cancel A cancellation flag to guard matching with, if any.
+/// @return The match context, which also assigns the JIT stack of the calling
+/// thread (see [thread_jit_stack]).
+CAMLprim value match_context_create(value match_limit /* : int */, value depth_limit /* : int */,
+                                    value heap_limit /* : int */, value timeout_ns /* : int */,
+                                    value cancel /* : cancel_flag option */
+                                    ) /* : -> match_context */ {
+        CAMLparam5(match_limit, depth_limit, heap_limit, timeout_ns, cancel);
+        CAMLlocal1(match_context_value);
+
+        pcre2_match_context *base = pcre2_match_context_create(NULL);
+        if (!base) {
+                caml_raise_out_of_memory();
+        }
+        pcre2_jit_stack_assign(base, thread_jit_stack_callback, NULL);
+        uint32_t depth;
+        if (Long_val(depth_limit) >= 0) {
+                depth = Long_val(depth_limit) < UINT32_MAX ? Long_val(depth_limit) : UINT32_MAX;
+        } else {
+                pcre2_config(PCRE2_CONFIG_DEPTHLIMIT, &depth);
+        }
+        pcre2_set_depth_limit(base, depth);
+        uint32_t heap;
+        if (Long_val(heap_limit) >= 0) {
+                heap = Long_val(heap_limit) < UINT32_MAX ? Long_val(heap_limit) : UINT32_MAX;
+        } else {
+                pcre2_config(PCRE2_CONFIG_HEAPLIMIT, &heap);
+        }
+        pcre2_set_heap_limit(base, heap);
+        uint32_t limit;
+        if (Long_val(match_limit) >= 0) {
+                limit = Long_val(match_limit) < UINT32_MAX ? Long_val(match_limit) : UINT32_MAX;
+        } else {
+                pcre2_config(PCRE2_CONFIG_MATCHLIMIT, &limit);
+        }
+        pcre2_set_match_limit(base, limit);
+
+        struct ocaml_match_context *mc = malloc(sizeof(struct ocaml_match_context));
+        if (!mc) {
+                pcre2_match_context_free(base);
+                caml_raise_out_of_memory();
+        }
+        mc->match_limit = limit;
+        mc->depth_limit = depth;
+        mc->heap_limit = heap;
+        mc->timeout_ns = Long_val(timeout_ns);
+        mc->cancel = Is_block(cancel) ? *cancel_flag_of_value(Field(cancel, 0)) : NULL;
+        if (mc->cancel) {
+                atomic_fetch_add(&mc->cancel->references, 1);
+        }
+        // The match limits of each attempt: doubling from the first, if
+        // guarded, then the limit itself.
+        mc->attempt_count = 1;
+        if (is_guarded(mc)) {
+                pcre2_set_callout(base, guard_callout, mc);
+                for (uint64_t l = first_guarded_match_limit; l < limit; l *= 2) {
+                        ++mc->attempt_count;
+                }
+        }
+        mc->attempts = calloc(mc->attempt_count, sizeof(pcre2_match_context *));
+        if (!mc->attempts) {
+                mc->attempt_count = 0;
+                pcre2_match_context_free(base);
+                match_context_free(mc);
+                caml_raise_out_of_memory();
+        }
+        mc->attempts[mc->attempt_count - 1] = base;
+        bool failed = false;
+        for (size_t i = 0; i + 1 < mc->attempt_count; ++i) {
+                // NOTE: Copies share the callout (and its data) of the base.
+                mc->attempts[i] = pcre2_match_context_copy(base);
+                if (!mc->attempts[i]) {
+                        failed = true;
+                        continue;
+                }
+                pcre2_set_match_limit(mc->attempts[i], first_guarded_match_limit << i);
+        }
+        if (failed) {
+                match_context_free(mc);
+                caml_raise_out_of_memory();
+        }
+
+        match_context_value = caml_alloc_custom(&match_context_ops,
+                                                sizeof(struct ocaml_match_context *), 0, 1);
+        *match_context_of_value(match_context_value) = mc;
+
+        CAMLreturn(match_context_value);
+}
+
+/// The reasons for which [prefilter_rejects] rejects subjects.
+enum prefilter_rejection {
+        PREFILTER_TOO_SHORT,
+        PREFILTER_NO_FIRST_CODE_UNIT,
+        PREFILTER_NO_LAST_CODE_UNIT,
+        PREFILTER_REJECTIONS,
+};
+
+/// The number of subjects rejected for each reason, and so of calls to PCRE2
+/// saved.
+static atomic_uint_fast64_t prefilter_rejections[PREFILTER_REJECTIONS];
+
+/// Creates the prefilter of a compiled regex.
+///
+/// @return The prefilter, or NULL if nothing is known which could reject a
+/// subject, or if rejecting subjects before PCRE2 would be observable (as it
+/// would with PCRE2_NO_START_OPTIMIZE or PCRE2_AUTO_CALLOUT, which ask that
+/// every start position be tried).
+static struct prefilter *prefilter_create(const pcre2_code *re) {
+        uint32_t all_options = 0;
+        pcre2_pattern_info(re, PCRE2_INFO_ALLOPTIONS, &all_options);
+        if (all_options & (PCRE2_NO_START_OPTIMIZE | PCRE2_AUTO_CALLOUT)) {
+                return NULL;
+        }
+        struct prefilter prefilter = {0, -1, -1, false, {0}};
+        pcre2_pattern_info(re, PCRE2_INFO_MINLENGTH, &prefilter.min_length);
+
+        // NOTE: A code unit may have been matched caselessly, which PCRE2 does
+        // not report, so its other case is accepted as well (as PCRE2 does
+        // itself). That is only simple for ASCII, so other units are ignored.
+        uint32_t type = 0;
+        uint32_t unit = 0;
+        pcre2_pattern_info(re, PCRE2_INFO_FIRSTCODETYPE, &type);
+        pcre2_pattern_info(re, PCRE2_INFO_FIRSTCODEUNIT, &unit);
+        if (type == 1 && unit < 128) {
+                prefilter.first_code_unit = unit;
+        }
+        pcre2_pattern_info(re, PCRE2_INFO_LASTCODETYPE, &type);
+        pcre2_pattern_info(re, PCRE2_INFO_LASTCODEUNIT, &unit);
+        if (type == 1 && unit < 128) {
+                prefilter.last_code_unit = unit;
+        }
+        const uint8_t *bitmap = NULL;
+        if (pcre2_pattern_info(re, PCRE2_INFO_FIRSTBITMAP, &bitmap) == 0 && bitmap) {
+                prefilter.has_first_bitmap = true;
+                memcpy(prefilter.first_bitmap, bitmap, sizeof(prefilter.first_bitmap));
+        }
+
+        if (prefilter.min_length == 0 && prefilter.first_code_unit < 0
+            && prefilter.last_code_unit < 0 && !prefilter.has_first_bitmap) {
+                return NULL;
+        }
+        // NOTE: Should this fail, the regex simply goes unfiltered.
+        struct prefilter *result = malloc(sizeof(struct prefilter));
+        if (result) {
+                *result = prefilter;
+        }
+        return result;
+}
+
+/// Returns whether the bytes hold an ASCII code unit, in either case.
+static bool contains_code_unit(PCRE2_SPTR bytes, size_t length, int unit) {
+        if (memchr(bytes, unit, length)) {
+                return true;
+        }
+        int other = unit >= 'a' && unit <= 'z'   ? unit - 'a' + 'A'
+                    : unit >= 'A' && unit <= 'Z' ? unit - 'A' + 'a'
+                                                 : unit;
+        return other != unit && memchr(bytes, other, length);
+}
+
+/// Returns whether the bytes hold a code unit of the bitmap.
+static bool contains_bitmap_unit(PCRE2_SPTR bytes, size_t length, const uint8_t *bitmap) {
+        for (size_t i = 0; i < length; ++i) {
+                if (bitmap[bytes[i] / 8] & (1u << (bytes[i] % 8))) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+/// Returns whether a regex certainly cannot match a subject from an offset,
+/// judging by its prefilter, so that PCRE2 need not be called.
+///
+/// NOTE: Partial matches and restarted DFA matches may lack what a complete
+/// match needs, so these are never rejected. Nor is an offset outside of the
+/// subject, so that PCRE2 may report it.
+///
+/// @param[in] prefilter The prefilter of the regex, or NULL.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_length The length of the subject in bytes.
+/// @param[in] offset The byte index in the subject at which matching begins.
+/// @param[in] options The matching options.
+static bool prefilter_rejects(const struct prefilter *prefilter, PCRE2_SPTR subject,
+                              size_t subject_length, size_t offset, uint32_t options) {
+        if (!prefilter || offset > subject_length
+            || (options & (PCRE2_PARTIAL_SOFT | PCRE2_PARTIAL_HARD | PCRE2_DFA_RESTART))) {
+                return false;
+        }
+        PCRE2_SPTR rest = subject + offset;
+        size_t length = subject_length - offset;
+        enum prefilter_rejection reason;
+        if (length < prefilter->min_length) {
+                reason = PREFILTER_TOO_SHORT;
+        } else if (prefilter->first_code_unit >= 0
+                       ? !contains_code_unit(rest, length, prefilter->first_code_unit)
+                       : prefilter->has_first_bitmap
+                             && !contains_bitmap_unit(rest, length, prefilter->first_bitmap)) {
+                reason = PREFILTER_NO_FIRST_CODE_UNIT;
+        } else if (prefilter->last_code_unit >= 0
+                   && !contains_code_unit(rest, length, prefilter->last_code_unit)) {
+                reason = PREFILTER_NO_LAST_CODE_UNIT;
+        } else {
+                return false;
+        }
+        atomic_fetch_add_explicit(&prefilter_rejections[reason], 1, memory_order_relaxed);
+        return true;
+}
+
+/// Returns the number of subjects rejected by prefilters for each reason, as
+/// [too_short, no_first_code_unit, no_last_code_unit].
+CAMLprim value get_prefilter_rejections(value unit UNUSED) /* : -> int array */ {
+        CAMLparam0();
+        CAMLlocal1(counts);
+        counts = caml_alloc(PREFILTER_REJECTIONS, ARRAY_TAG);
+        for (int i = 0; i < PREFILTER_REJECTIONS; ++i) {
+                uint_fast64_t n = atomic_load_explicit(&prefilter_rejections[i],
+                                                       memory_order_relaxed);
+                // SAFETY: Immediate values may be stored without caml_modify.
+                Field(counts, i) = Val_long(n);
+        }
+        CAMLreturn(counts);
+}
+
+/// Resets the counts of [get_prefilter_rejections] to 0.
+CAMLprim value reset_prefilter_rejections(value unit UNUSED) /* : -> unit */ {
+        for (int i = 0; i < PREFILTER_REJECTIONS; ++i) {
+                atomic_store_explicit(&prefilter_rejections[i], 0, memory_order_relaxed);
+        }
+        return Val_unit;
+}
+
+/// Returns the PCRE2 version the library was compiled with.
+CAMLprim value get_version(void) /* -> int * int */ {
+        CAMLparam0();
+        CAMLlocal1(version);
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        version = caml_alloc_small(2, TUPLE_TAG);
+        Field(version, 0) = Val_int(PCRE2_MAJOR);
+        Field(version, 1) = Val_int(PCRE2_MINOR);
+        CAMLreturn(version);
+}
+
+/// Returns the length of the verbs which set options, such as (*UTF) or
+/// (*LIMIT_MATCH=10), at the start of a pattern. (*NOTEMPTY_ATSTART) is not
+/// counted, since it depends on where matching starts.
+static size_t leading_option_verbs_length(const char *pattern, size_t length) {
+        static const char *const verbs[] = {
+            "(*UTF)", "(*UCP)", "(*NOTEMPTY)", "(*NO_AUTO_POSSESS)", "(*NO_DOTSTAR_ANCHOR)",
+            "(*NO_JIT)", "(*NO_START_OPT)", "(*CR)", "(*LF)", "(*CRLF)", "(*ANYCRLF)", "(*ANY)",
+            "(*NUL)", "(*BSR_ANYCRLF)", "(*BSR_UNICODE)",
+        };
+        size_t i = 0;
+        for (;;) {
+                size_t verb_length = 0;
+                for (size_t v = 0; v < sizeof(verbs) / sizeof(*verbs); ++v) {
+                        size_t n = strlen(verbs[v]);
+                        if (length - i >= n && memcmp(pattern + i, verbs[v], n) == 0) {
+                                verb_length = n;
+                                break;
+                        }
+                }
+                if (!verb_length && length - i > 8 && memcmp(pattern + i, "(*LIMIT_", 8) == 0) {
+                        const char *end = memchr(pattern + i, ')', length - i);
+                        verb_length = end ? (size_t)(end - (pattern + i)) + 1 : 0;
+                }
+                if (!verb_length) {
+                        return i;
+                }
+                i += verb_length;
+        }
+}
+
+/// Returns the options to pass to pcre2_compile for a pattern compiled with the
+/// provided options. PCRE2_USE_OFFSET_LIMIT is added, so that guarded matches
+/// may be split into chunks of start positions (see [run_match]), only if that
+/// cannot change what matches: not if the pattern may use \G, whose meaning
+/// depends on where matching starts, nor any verb other than those setting
+/// options at its start. Backtracking verbs such as (*COMMIT) or (*SKIP) may
+/// end or skip ahead in a search, which a chunk knows nothing of. Being
+/// textual, this errs towards not splitting, such as for an escaped [\(*].
+/// The bindings never set an offset limit otherwise.
+static uint32_t pcre2_compile_options(uint32_t options, const char *pattern, size_t length) {
+        size_t verbs = leading_option_verbs_length(pattern, length);
+        if (memmem(pattern, length, "\\G", 2)
+            || memmem(pattern + verbs, length - verbs, "(*", 2)) {
+                return options & ~PCRE2_USE_OFFSET_LIMIT;
+        }
+        return options | PCRE2_USE_OFFSET_LIMIT;
+}
+
+/// Wraps a compiled regex in a custom block, which takes ownership of it, its
+/// prefilter and the copy of the pattern it was compiled from.
+static value alloc_regex(pcre2_code *regex, struct prefilter *prefilter, char *pattern,
+                         size_t pattern_length, uint32_t options) /* : -> regex */ {
+        CAMLparam0();
+        CAMLlocal1(regex_value);
+        // caml_alloc_custom_mem wants a size estimate of the allocated
+        // memory, which includes any JIT compiled code. Code JIT compiled
+        // later is accounted for by [jit_compile_unboxed].
+        size_t code_size = 0;
+        pcre2_pattern_info(regex, PCRE2_INFO_SIZE, &code_size);
+        size_t jit_size = jit_size_of(regex);
+        regex_value = caml_alloc_custom_mem(&regex_ops, sizeof(struct ocaml_regex),
+                                            code_size + jit_size);
+        struct ocaml_regex *re = regex_of_value(regex_value);
+        re->regex = regex;
+        re->prefilter = prefilter;
+        re->pattern = pattern;
+        re->pattern_length = pattern_length;
+        re->options = options;
+        re->jit_options = 0;
+        re->code_size = code_size;
+        re->jit_size = jit_size;
+        count_live_regex(re);
+        CAMLreturn(regex_value);
+}
+
+/// Compiles the provided pattern.
+///
+/// Note that the options from OCaml are not split between those which can
+/// directly be provided and those which are specified in the extra word passed
+/// via the compile context.
+///
+/// @param[in] pattern The pattern to compile. See `pcre2pattern(3)` for
+/// details.
+/// @param[in] options The options, specified via a bitvector. See
+/// `pcre2_compile(3)`.
+/// @return A result comprising the compiled pattern or a structured error.
+CAMLprim value compile_unboxed(value pattern /* : string */,
+                               uint32_t options /* : int32 [@unboxed] */
+                               /* another arg for compile context options? */
+                               ) /* : -> (regex, int) Result.t */ {
+        CAMLparam1(pattern);
+        CAMLlocal2(result, regex_value);
+
+        int error_code;
+        size_t error_offset;
+        size_t pattern_len = caml_string_length(pattern);
+
+        pcre2_compile_context *ccontext = NULL;
+        // TODO(cooper): allocated compile_context for the "extra" options if need be.
+        // SAFETY: Passing in the value of String_val(subject) here is fine
+        // since a GC cannot occur (and the resulting value, which is held across GC, does not refer
+        // to the string).
+        pcre2_code *regex = pcre2_compile(
+            (PCRE2_SPTR)String_val(pattern), pattern_len,
+            pcre2_compile_options(options, String_val(pattern), pattern_len), &error_code,
+            &error_offset, ccontext);
+        pcre2_compile_context_free(ccontext);
+        // NOTE: One extra byte, so that an empty pattern is not malloc(0).
+        char *pattern_copy = regex ? malloc(pattern_len + 1) : NULL;
+        if (regex && !pattern_copy) {
+                pcre2_code_free(regex);
+                caml_raise_out_of_memory();
+        }
+
+        if (!regex) {
+                // Returns [Error e] since the pattern could not be compiled.
+                result = caml_alloc_small(1, RESULT_ERROR_TAG);
+                // TODO(cooper): mapping between error codes here and datatype
+                // above.
+                Field(result, 0) = Val_int(error_code);
+                CAMLreturn(result);
+        }
+
+        memcpy(pattern_copy, String_val(pattern), pattern_len);
+        regex_value =
+            alloc_regex(regex, prefilter_create(regex), pattern_copy, pattern_len, options);
+
+        // Return [Ok regex]
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        result = caml_alloc_small(1, RESULT_OK_TAG);
+        Field(result, 0) = regex_value;
+
+        CAMLreturn(result);
+}
+
+/// Boxed argument version of [compile_unboxed] (for bytecode).
+CAMLprim value compile(value *argv, int argc UNUSED) {
+        return compile_unboxed(argv[0], Int32_val(argv[1]));
+}
+
+/// Wraps match data in a custom block, freeing it if that fails.
+static value alloc_match_data(pcre2_match_data *match_data) /* : -> match_data */ {
+        CAMLparam0();
+        CAMLlocal1(match_data_value);
+
+        struct dfa_workspace *workspace = match_data ? calloc(1, sizeof(struct dfa_workspace))
+                                                     : NULL;
+        if (!workspace) {
+                pcre2_match_data_free(match_data);
+                caml_raise_out_of_memory();
+        }
+
+        size_t ovector_size = 2 * sizeof(PCRE2_SIZE) * pcre2_get_ovector_count(match_data);
+        match_data_value = caml_alloc_custom_mem(&match_data_ops, sizeof(struct ocaml_match_data),
+                                                 ovector_size);
+        match_data_of_value(match_data_value)->match_data = match_data;
+        match_data_of_value(match_data_value)->workspace = workspace;
+
+        CAMLreturn(match_data_value);
+}
+
+/// Creates match data for use with the provided regex.
+///
+/// @param[in] ocaml_re The compiled regex the match data will be used with.
+/// @param[in] ocaml_pairs The number of (start, end) pairs the offset vector
+/// should hold. If this is not positive, the offset vector is sized to hold
+/// every capture group of [ocaml_re]. A single pair suffices when only the
+/// range of the whole match is needed.
+/// @return The match data, which may be reused for any number of matches.
+CAMLprim value match_data_create(value ocaml_re /* : _ regex */,
+                                 value ocaml_pairs /* : int */) /* : -> match_data */ {
+        CAMLparam2(ocaml_re, ocaml_pairs);
+        const pcre2_code *re = regex_of_value(ocaml_re)->regex;
+        intnat pairs = Long_val(ocaml_pairs);
+        CAMLreturn(alloc_match_data(pairs > 0 ? pcre2_match_data_create(pairs, NULL)
+                                              : match_data_for_captures(re, ENGINE_INTERP)));
+}
+
+/// Creates match data for DFA matching with the provided regex. See
+/// [match_data_create]; if [ocaml_pairs] is not positive, the offset vector is
+/// instead sized to hold as many alternative matches as are reported.
+CAMLprim value dfa_match_data_create(value ocaml_re /* : _ regex */,
+                                     value ocaml_pairs /* : int */) /* : -> match_data */ {
+        CAMLparam2(ocaml_re, ocaml_pairs);
+        const pcre2_code *re = regex_of_value(ocaml_re)->regex;
+        intnat pairs = Long_val(ocaml_pairs);
+        CAMLreturn(alloc_match_data(pairs > 0 ? pcre2_match_data_create(pairs, NULL)
+                                              : match_data_for_captures(re, ENGINE_DFA)));
+}
+
+/// Calls the matching function once, with the provided match context, growing
+/// the JIT stack of the thread or the DFA workspace as need be.
+static int match_once(const pcre2_code *re, enum engine engine, PCRE2_SPTR subject,
+                      size_t subject_length, size_t offset, uint32_t options,
+                      pcre2_match_data *match_data, struct dfa_workspace *workspace,
+                      pcre2_match_context *context) {
+        if (engine == ENGINE_DFA && !workspace->data && !grow_dfa_workspace(workspace)) {
+                return PCRE2_ERROR_NOMEMORY;
+        }
+        int ret = PCRE2_ERROR_NOMATCH;
+        do {
+                switch (engine) {
+                case ENGINE_INTERP:
+                        ret = pcre2_match(re, subject, subject_length, offset, options, match_data,
+                                          context);
+                        break;
+                case ENGINE_JIT:
+                        ret = pcre2_jit_match(re, subject, subject_length, offset, options,
+                                              match_data, context);
+                        break;
+                case ENGINE_DFA:
+                        ret = pcre2_dfa_match(re, subject, subject_length, offset, options,
+                                              match_data, context, workspace->data,
+                                              workspace->size);
+                        break;
+                }
+                // NOTE: pcre2_match also uses the JIT if the regex has been JIT
+                // compiled, so may equally exhaust the JIT stack.
+        } while ((ret == PCRE2_ERROR_JIT_STACKLIMIT && grow_thread_jit_stack())
+                 || (ret == PCRE2_ERROR_DFA_WSSIZE && grow_dfa_workspace(workspace)));
+        return ret;
+}
+
+/// The match limit of the attempt at a guarded match of the given index.
+static uint32_t attempt_match_limit(const struct ocaml_match_context *mc, size_t attempt) {
+        return attempt + 1 < mc->attempt_count ? first_guarded_match_limit << attempt
+                                               : mc->match_limit;
+}
+
+/// Returns the match context of the calling thread with which a guarded match
+/// is split into chunks, set up with the limits and guard of the provided
+/// context, or NULL if it cannot be created. Its offset limit and match limit
+/// are set for each call.
+///
+/// NOTE: The context is never freed; it lives as long as the thread.
+static pcre2_match_context *thread_chunk_context(const struct ocaml_match_context *mc) {
+        static _Thread_local pcre2_match_context *context = NULL;
+        if (!context) {
+                context = pcre2_match_context_create(NULL);
+                if (!context) {
+                        return NULL;
+                }
+                pcre2_jit_stack_assign(context, thread_jit_stack_callback, NULL);
+        }
+        pcre2_set_depth_limit(context, mc->depth_limit);
+        pcre2_set_heap_limit(context, mc->heap_limit);
+        // SAFETY: The callout only reads the context, which outlives the match.
+        pcre2_set_callout(context, guard_callout, (void *)mc);
+        return context;
+}
+
+/// Returns whether a guarded match may be split into chunks of start
+/// positions, which requires that the regex was compiled with
+/// PCRE2_USE_OFFSET_LIMIT (see [pcre2_compile_options], which leaves it out for
+/// patterns using \G or backtracking verbs), and that neither the regex nor
+/// the options make the match depend on where it starts searching.
+static bool is_chunkable(const pcre2_code *re, enum engine engine, uint32_t options) {
+        if (engine == ENGINE_DFA
+            || options & (PCRE2_ANCHORED | PCRE2_NOTEMPTY_ATSTART | PCRE2_PARTIAL_SOFT
+                          | PCRE2_PARTIAL_HARD)) {
+                return false;
+        }
+        uint32_t all_options = 0;
+        pcre2_pattern_info(re, PCRE2_INFO_ALLOPTIONS, &all_options);
+        return (all_options & PCRE2_USE_OFFSET_LIMIT)
+               && !(all_options & (PCRE2_ANCHORED | PCRE2_FIRSTLINE));
+}
+
+/// Runs a match with each attempt of a context in turn, until one does not
+/// reach its match limit, checking the guard (if any) before each.
+static int run_attempts(const pcre2_code *re, enum engine engine, PCRE2_SPTR subject,
+                        size_t subject_length, size_t offset, uint32_t options,
+                        pcre2_match_data *match_data, struct dfa_workspace *workspace,
+                        const struct ocaml_match_context *mcontext,
+                        pcre2_match_context *chunk_context) {
+        bool guarded = is_guarded(mcontext);
+        int ret = PCRE2_ERROR_MATCHLIMIT;
+        for (size_t i = 0; i < mcontext->attempt_count && ret == PCRE2_ERROR_MATCHLIMIT; ++i) {
+                int stop = guarded ? check_guard(mcontext) : 0;
+                if (stop) {
+                        return stop;
+                }
+                pcre2_match_context *attempt = mcontext->attempts[i];
+                if (chunk_context) {
+                        pcre2_set_match_limit(chunk_context, attempt_match_limit(mcontext, i));
+                        attempt = chunk_context;
+                }
+                ret = match_once(re, engine, subject, subject_length, offset, options, match_data,
+                                 workspace, attempt);
+        }
+        return ret;
+}
+
+/// Runs a single match of a regex against a subject, storing the offsets of
+/// the match in the provided match data.
+///
+/// A guarded match is split into chunks of start positions where possible
+/// (see [ocaml_match_context]), so that the guard is checked however little
+/// each start position backtracks.
+///
+/// @param[in] re The compiled regex to use for matching.
+/// @param[in] engine The matching function to use.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_length The length of the subject in bytes.
+/// @param[in] offset The byte index in the subject at which to begin.
+/// @param[in] options Matching options, specified via a bitvector.
+/// @param[in,out] match_data The match data to store the results in.
+/// @param[in,out] workspace The workspace to use for DFA matching, which is
+/// grown if it is too small.
+/// @param[in] mcontext The match context to use, which sets the limits (and
+/// JIT stack) of the match. If it is guarded, [arm_guard] must have been
+/// called with it.
+/// @return The return code of the matching function, except that 0 (meaning
+/// the offset vector was too small to hold all captures) is replaced with the
+/// number of pairs in the offset vector, all of which have been set.
+/// PCRE2_ERROR_JIT_STACKLIMIT is only returned once the JIT stack of the
+/// thread can grow no further (see [thread_jit_stack]), and likewise
+/// PCRE2_ERROR_DFA_WSSIZE once the workspace can grow no further. A guarded
+/// match may also return PCRE2_OCAML_ERROR_TIMEOUT or
+/// PCRE2_OCAML_ERROR_CANCELLED.
+static int run_match(const pcre2_code *re, enum engine engine, PCRE2_SPTR subject,
+                     size_t subject_length, size_t offset, uint32_t options,
+                     pcre2_match_data *match_data, struct dfa_workspace *workspace,
+                     const struct ocaml_match_context *mcontext) {
+        pcre2_match_context *chunk_context = NULL;
+        if (is_guarded(mcontext) && offset < subject_length
+            && subject_length - offset > first_guarded_chunk_length
+            && is_chunkable(re, engine, options)) {
+                chunk_context = thread_chunk_context(mcontext);
+        }
+        int ret;
+        if (!chunk_context) {
+                ret = run_attempts(re, engine, subject, subject_length, offset, options,
+                                   match_data, workspace, mcontext, NULL);
+        } else {
+                uint32_t all_options = 0;
+                pcre2_pattern_info(re, PCRE2_INFO_ALLOPTIONS, &all_options);
+                bool utf = all_options & PCRE2_UTF;
+                size_t start = offset;
+                size_t chunk_length = first_guarded_chunk_length;
+                for (;;) {
+                        // The last start position of the chunk, or none.
+                        bool last = subject_length - start <= chunk_length;
+                        size_t limit = last ? PCRE2_UNSET : start + chunk_length - 1;
+                        pcre2_set_offset_limit(chunk_context, limit);
+                        ret = run_attempts(re, engine, subject, subject_length, start, options,
+                                           match_data, workspace, mcontext, chunk_context);
+                        if (ret != PCRE2_ERROR_NOMATCH || last) {
+                                break;
+                        }
+                        start = limit + 1;
+                        // A UTF-8 subject may only be searched from the start
+                        // of a character, and none starts within one. It has
+                        // already been checked by the first call.
+                        while (utf && start < subject_length && (subject[start] & 0xC0) == 0x80) {
+                                ++start;
+                        }
+                        options |= PCRE2_NO_UTF_CHECK;
+                        chunk_length *= 2;
+                }
+                pcre2_set_offset_limit(chunk_context, PCRE2_UNSET);
+        }
+        if (ret == 0) {
+                ret = pcre2_get_ovector_count(match_data);
+        }
+        return ret;
+}
+
+/// Shared implementation of [match_unboxed], [jit_match_unboxed] and
+/// [dfa_match_unboxed].
+static value match_range(value ocaml_re, value ocaml_match_data, value ocaml_match_context,
+                         value subject, intnat subject_offset, uint32_t options,
+                         enum engine engine) /* : -> ((int * int) option, int) Result.t */ {
+        CAMLparam4(ocaml_re, ocaml_match_data, ocaml_match_context, subject);
+        CAMLlocal1(range);
+
+        // Need to handle this case manually since PCRE2 takes an unsigned value.
+        if (subject_offset < 0) {
+                CAMLreturn(alloc_error(PCRE2_ERROR_BADOFFSET));
+        }
+
+        const pcre2_code *re = regex_of_value(ocaml_re)->regex;
+        pcre2_match_data *match_data = match_data_of_option(ocaml_match_data);
+        if (!match_data) {
+                match_data = scratch_match_data();
+        }
+
+        // SAFETY: Passing in the value of subject_pointer(subject) here is fine
+        // since a GC cannot occur (and it is not on the OCaml heap if the lock
+        // is released).
+        PCRE2_SPTR subject_data = subject_pointer(subject);
+        size_t length = subject_size(subject);
+        const struct ocaml_match_context *mcontext =
+            match_context_of_option(ocaml_match_context);
+        arm_guard(mcontext);
+        struct dfa_workspace *workspace = workspace_of_option(ocaml_match_data);
+        const struct prefilter *prefilter = regex_of_value(ocaml_re)->prefilter;
+        bool released = begin_matching(subject);
+        int ret = prefilter_rejects(prefilter, subject_data, length, subject_offset, options)
+                      ? PCRE2_ERROR_NOMATCH
+                      : run_match(re, engine, subject_data, length, subject_offset, options,
+                                  match_data, workspace, mcontext);
+        end_matching(released);
+
+        if (ret == PCRE2_ERROR_NOMATCH || ret == PCRE2_ERROR_PARTIAL) {
+                CAMLreturn(alloc_ok(Val_none));
+        } else if (ret < 0) {
+                CAMLreturn(alloc_error(ret));
+        }
+
+        // NOTE: Read prior to allocating, since the match data may be shared.
+        PCRE2_SIZE *ovec = pcre2_get_ovector_pointer(match_data);
+        PCRE2_SIZE start = ovec[0];
+        PCRE2_SIZE end = ovec[1];
+        // SAFETY: This allocation is immediately filled with well-formed values.
+        range = caml_alloc_small(2, TUPLE_TAG);
+        Field(range, 0) = Val_int(start);
+        Field(range, 1) = Val_int(end);
+
+        CAMLreturn(alloc_ok(alloc_some(range)));
+}
+
+/// Match with the provided pattern.
+///
+/// @param[in] ocaml_re The compiled regex to use for matching.
+/// @param[in] ocaml_match_data The match data to use, if any; it needs only a
+/// single pair in its offset vector.
+/// @param[in] ocaml_match_context The match context to use, if any, which sets
+/// the limits of matching.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_offset The byte index in the subject at which to begin.
+/// @param[in] options Matching options, specified via a bitvector . See `pcre2_match(3)`.
+CAMLprim value match_unboxed(value ocaml_re /* : _ regex */,
+                             value ocaml_match_data /* : match_data option */,
+                             value ocaml_match_context /* : match_context option */,
+                             value subject /* : subject */,
+                             intnat subject_offset /* : int [@untagged] */,
+                             uint32_t options /* : int32 */
+                             ) /* : -> ((int * int) option, int) Result.t */ {
+        return match_range(ocaml_re, ocaml_match_data, ocaml_match_context, subject, subject_offset,
+                           options, ENGINE_INTERP);
+}
+
+/// Boxed argument version of [match_unboxed] (for bytecode).
+CAMLprim value match(value *argv, int argc UNUSED) {
+        return match_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                             Int32_val(argv[5]));
+}
+
+/// Requests JIT compilation for a processed regex.
+///
+/// @param[in] regex The already processed regex.
+/// @param[in] options JIT compilation options, specified via a bitvector . See
+/// `pcre2_jit_compile(3)`.
+CAMLprim value jit_compile_unboxed(
+    value ocaml_re /* : interp regex */,
+    uint32_t options /* : int32 [@unboxed] */) /* : -> (jit regex, int) Result.t */ {
+        // NOTE: The return value of the function is 0 for success, or a
+        // negative error code otherwise. In particular,
+        // PCRE2_ERROR_JIT_BADOPTION is returned if JIT is not supported or if
+        // an unknown bit is set in options. The function can also return
+        // PCRE2_ERROR_NOMEMORY if JIT is unable to allocate executable memory
+        // for the compiler, even if it was because of a system security
+        // restriction.
+
+        // How to handle allocation failure (can be due to security policy) or
+        // lack of jit support? Result seems fine but a bit annoying maybe
+        CAMLparam1(ocaml_re);
+        CAMLlocal1(result);
+
+        struct ocaml_regex *re = regex_of_value(ocaml_re);
+        int res = pcre2_jit_compile(re->regex, options);
+        if (res < 0) {
+                // SAFETY: This allocation is immediately filled with
+                // well-formed values prior to returning.
+                result = caml_alloc_small(1, RESULT_ERROR_TAG);
+                Field(result, 0) = Val_int(res);
+                CAMLreturn(result);
+        }
+        re->jit_options |= options;
+        // The JIT compiled code is unknown to the GC, which would otherwise
+        // let thousands of JIT compiled regexes accumulate.
+        size_t jit_size = jit_size_of(re->regex);
+        if (jit_size > re->jit_size) {
+                atomic_fetch_add(&live_jit_bytes, jit_size - re->jit_size);
+                caml_adjust_gc_speed(jit_size - re->jit_size, JIT_GC_MAX_MEMORY);
+                re->jit_size = jit_size;
+        }
+
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        result = caml_alloc_small(1, RESULT_OK_TAG);
+        // TODO: this seems bad, since in OCaml we could then have
+        // {x : interp regex} and {y : jit regex}, pointers to the same regex.
+        //
+        // This is maybe actually fine here, and mostly depends on if you can
+        // call pcre2_jit_compile multiple times on the same pcer2_code*
+        // safely. Since pcre2_match permits jit, and while {interp regex} is
+        // "really" interpreted OR JIT, {jit regex} is definitely JIT.
+        //
+        // NOTE: JIT compiling a regex while another domain matches with it is
+        // a race, so [Tiered] and [Disk_cache] JIT compile a copy of the regex
+        // (see [code_copy]) instead.
+        Field(result, 0) = ocaml_re;
+        CAMLreturn(result);
+}
+
+/// Boxed argument version of [jit_compile_unboxed] (for bytecode).
+CAMLprim value jit_compile(value *argv, int argc UNUSED) {
+        return jit_compile_unboxed(argv[0], Int32_val(argv[1]));
+}
+
+/// Returns the size of the JIT compiled code of a regex, or 0 if it has not
+/// been JIT compiled.
+CAMLprim value regex_jit_size(value ocaml_re /* : _ regex */) /* : -> int */ {
+        return Val_long(regex_of_value(ocaml_re)->jit_size);
+}
+
+/// Returns the number of regexes alive, and the total size of their code and
+/// of their JIT compiled code.
+CAMLprim value memory_usage(value unit UNUSED) /* : -> int * int * int */ {
+        CAMLparam0();
+        CAMLlocal1(usage);
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        usage = caml_alloc_small(3, TUPLE_TAG);
+        Field(usage, 0) = Val_long(atomic_load(&live_regex_count));
+        Field(usage, 1) = Val_long(atomic_load(&live_code_bytes));
+        Field(usage, 2) = Val_long(atomic_load(&live_jit_bytes));
+        CAMLreturn(usage);
+}
+
+/// Returns the executable memory which PCRE2 holds for JIT compiled code, but
+/// which no longer holds any, to the system. See
+/// `pcre2_jit_free_unused_memory(3)`.
+CAMLprim value jit_free_unused_memory(value unit UNUSED) /* : -> unit */ {
+        pcre2_jit_free_unused_memory(NULL);
+        return Val_unit;
+}
+
+/// A pattern to be compiled by [compile_many_unboxed], and its outcome.
+struct compile_job {
+        /// A copy of the pattern, since the OCaml string may be moved while the
+        /// runtime lock is released.
+        char *pattern;
+        size_t pattern_length;
+        pcre2_code *regex;
+        struct prefilter *prefilter;
+        /// The error code of compilation or JIT compilation, if [regex] is
+        /// NULL.
+        int error_code;
+        double seconds;
+};
+
+/// The patterns compiled by [compile_many_unboxed], which its threads take
+/// one at a time.
+struct compile_batch {
+        struct compile_job *jobs;
+        size_t count;
+        atomic_size_t next;
+        uint32_t options;
+        /// The options for pcre2_jit_compile, or 0 for none.
+        uint32_t jit_options;
+};
+
+static double monotonic_seconds(void) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/// Compiles the patterns of a batch until none are left.
+static void *compile_worker(void *data) {
+        struct compile_batch *batch = data;
+        for (;;) {
+                size_t i = atomic_fetch_add(&batch->next, 1);
+                if (i >= batch->count) {
+                        return NULL;
+                }
+                struct compile_job *job = &batch->jobs[i];
+                double start = monotonic_seconds();
+                size_t error_offset;
+                job->regex = pcre2_compile(
+                    (PCRE2_SPTR)job->pattern, job->pattern_length,
+                    pcre2_compile_options(batch->options, job->pattern, job->pattern_length),
+                    &job->error_code, &error_offset, NULL);
+                if (job->regex && batch->jit_options) {
+                        int res = pcre2_jit_compile(job->regex, batch->jit_options);
+                        if (res < 0) {
+                                pcre2_code_free(job->regex);
+                                job->regex = NULL;
+                                job->error_code = res;
+                        }
+                }
+                if (job->regex) {
+                        job->prefilter = prefilter_create(job->regex);
+                }
+                job->seconds = monotonic_seconds() - start;
+        }
+}
+
+/// Compiles, and optionally JIT compiles, many patterns in parallel, on
+/// threads of its own, without holding the runtime lock.
+///
+/// @param[in] patterns The patterns to compile.
+/// @param[in] options The options to compile each with, as for
+/// [compile_unboxed].
+/// @param[in] jit_options The options to JIT compile each with, as for
+/// [jit_compile_unboxed], or 0 not to.
+/// @param[in] thread_count The number of threads to compile on, including
+/// the calling thread, or 0 for one per online processor.
+/// @return A pair of the result of compiling each pattern, as for
+/// [compile_unboxed], and the seconds each took, in the order of [patterns].
+CAMLprim value compile_many_unboxed(value patterns /* : string array */,
+                                    uint32_t options /* : int32 [@unboxed] */,
+                                    uint32_t jit_options /* : int32 [@unboxed] */,
+                                    intnat thread_count /* : int [@untagged] */
+                                    ) /* : -> (regex, int) Result.t array * float array */ {
+        CAMLparam1(patterns);
+        CAMLlocal4(results, timings, result, regex_value);
+
+        size_t count = Wosize_val(patterns);
+        struct compile_job *jobs = calloc(count + 1, sizeof(struct compile_job));
+        if (!jobs) {
+                caml_raise_out_of_memory();
+        }
+        for (size_t i = 0; i < count; ++i) {
+                size_t length = caml_string_length(Field(patterns, i));
+                jobs[i].pattern = malloc(length + 1);
+                if (!jobs[i].pattern) {
+                        for (size_t j = 0; j < i; ++j) {
+                                free(jobs[j].pattern);
+                        }
+                        free(jobs);
+                        caml_raise_out_of_memory();
+                }
+                memcpy(jobs[i].pattern, String_val(Field(patterns, i)), length);
+                jobs[i].pattern_length = length;
+        }
+
+        if (thread_count <= 0) {
+                long online = sysconf(_SC_NPROCESSORS_ONLN);
+                thread_count = online > 0 ? online : 1;
+        }
+        if ((size_t)thread_count > count) {
+                thread_count = count > 0 ? (intnat)count : 1;
+        }
+        struct compile_batch batch = {jobs, count, 0, options, jit_options};
+        pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+        caml_enter_blocking_section();
+        // NOTE: Should a thread fail to start, those which did (and the
+        // calling thread) compile its share.
+        intnat started = 0;
+        while (threads && started < thread_count - 1
+               && pthread_create(&threads[started], NULL, compile_worker, &batch) == 0) {
+                ++started;
+        }
+        compile_worker(&batch);
+        for (intnat i = 0; i < started; ++i) {
+                pthread_join(threads[i], NULL);
+        }
+        caml_leave_blocking_section();
+        free(threads);
+
+        // NOTE: caml_alloc initializes the fields, so immediates may then be
+        // stored directly, and the results with caml_modify.
+        results = count ? caml_alloc(count, ARRAY_TAG) : caml_alloc_tuple(0);
+        timings = count ? caml_alloc(count * Double_wosize, Double_array_tag)
+                        : caml_alloc_tuple(0);
+        for (size_t i = 0; i < count; ++i) {
+                struct compile_job *job = &jobs[i];
+                Store_double_field(timings, i, job->seconds);
+                if (job->regex) {
+                        regex_value = alloc_regex(job->regex, job->prefilter, job->pattern,
+                                                  job->pattern_length, options);
+                        regex_of_value(regex_value)->jit_options = batch.jit_options;
+                        result = caml_alloc_small(1, RESULT_OK_TAG);
+                        Field(result, 0) = regex_value;
+                } else {
+                        free(job->pattern);
+                        result = caml_alloc_small(1, RESULT_ERROR_TAG);
+                        Field(result, 0) = Val_int(job->error_code);
+                }
+                Store_field(results, i, result);
+        }
+        free(jobs);
+
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        result = caml_alloc_small(2, TUPLE_TAG);
+        Field(result, 0) = results;
+        Field(result, 1) = timings;
+        CAMLreturn(result);
+}
+
+/// Boxed argument version of [compile_many_unboxed] (for bytecode).
+CAMLprim value compile_many(value patterns, value options, value jit_options,
+                            value thread_count) {
+        return compile_many_unboxed(patterns, Int32_val(options), Int32_val(jit_options),
+                                    Long_val(thread_count));
+}
+
+/// Copies a regex, without its JIT compiled code (if any), so that the copy
+/// may be JIT compiled, or not, independently of the original.
+///
+/// @param[in] ocaml_re The regex to copy.
+/// @return The copy.
+CAMLprim value code_copy(value ocaml_re /* : _ regex */) /* : -> interp regex */ {
+        CAMLparam1(ocaml_re);
+        const struct ocaml_regex *re = regex_of_value(ocaml_re);
+        pcre2_code *regex = pcre2_code_copy(re->regex);
+        char *pattern = malloc(re->pattern_length + 1);
+        struct prefilter *prefilter = re->prefilter ? malloc(sizeof(struct prefilter)) : NULL;
+        if (!regex || !pattern || (re->prefilter && !prefilter)) {
+                pcre2_code_free(regex);
+                free(pattern);
+                free(prefilter);
+                caml_raise_out_of_memory();
+        }
+        memcpy(pattern, re->pattern, re->pattern_length);
+        if (prefilter) {
+                *prefilter = *re->prefilter;
+        }
+        CAMLreturn(alloc_regex(regex, prefilter, pattern, re->pattern_length, re->options));
+}
+
+/// The header of a file of serialized regexes (see [serialized_save]). It is
+/// followed by the options, pattern length and pattern of each regex, and then
+/// by the regexes as serialized by PCRE2, which only the same version of PCRE2
+/// on the same architecture can decode.
+///
+/// NOTE: PCRE2 trusts serialized regexes to be well-formed, so the checksum
+/// guards against decoding a file which was truncated or corrupted.
+struct serialized_header {
+        char magic[8];
+        uint32_t pcre2_major;
+        uint32_t pcre2_minor;
+        uint32_t count;
+        uint32_t padding;
+        uint64_t sources_size;
+        uint64_t codes_size;
+        /// The FNV-1a hash of everything after the header.
+        uint64_t checksum;
+};
+
+static uint64_t fnv1a_64(uint64_t hash, const void *buffer, size_t length) {
+        const uint8_t *bytes = buffer;
+        for (size_t i = 0; i < length; ++i) {
+                hash = (hash ^ bytes[i]) * 1099511628211u;
+        }
+        return hash;
+}
+
+#define FNV1A_64_BASIS 14695981039346656037u
+
+/// The magic number of a file of serialized regexes, ending in the version of
+/// its format.
+static const char SERIALIZED_MAGIC[8] = {'P', 'C', 'R', 'E', '2', 'O', 'C', 1};
+
+/// Writes the whole buffer to a file.
+///
+/// @return Whether it was written, setting errno if not.
+static bool write_all(int fd, const void *buffer, size_t length) {
+        const char *bytes = buffer;
+        while (length > 0) {
+                ssize_t written = write(fd, bytes, length);
+                if (written < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (written <= 0) {
+                        return false;
+                }
+                bytes += written;
+                length -= written;
+        }
+        return true;
+}
+
+/// Saves regexes to a file, serialized by PCRE2 alongside the patterns and
+/// options they were compiled from. The file is written beside the path and
+/// then renamed to it, so that it is replaced at once.
+///
+/// @param[in] path The path of the file.
+/// @param[in] regexes The regexes to save.
+/// @return 0, or the error code of `pcre2_serialize_encode(3)`.
+/// @raise Sys_error if the file cannot be written.
+CAMLprim value serialized_save(value path /* : string */,
+                               value regexes /* : _ regex array */) /* : -> int */ {
+        CAMLparam2(path, regexes);
+        CAMLlocal1(temporary_path);
+
+        if (!caml_string_is_c_safe(path)) {
+                errno = ENOENT;
+                caml_sys_error(path);
+        }
+        uint32_t count = Wosize_val(regexes);
+        const pcre2_code **codes = malloc((count + 1) * sizeof(pcre2_code *));
+        if (!codes) {
+                caml_raise_out_of_memory();
+        }
+        uint64_t sources_size = 0;
+        uint64_t checksum = FNV1A_64_BASIS;
+        for (uint32_t i = 0; i < count; ++i) {
+                const struct ocaml_regex *re = regex_of_value(Field(regexes, i));
+                codes[i] = re->regex;
+                uint32_t source[2] = {re->options, (uint32_t)re->pattern_length};
+                checksum = fnv1a_64(checksum, source, sizeof(source));
+                checksum = fnv1a_64(checksum, re->pattern, re->pattern_length);
+                sources_size += sizeof(source) + re->pattern_length;
+        }
+        uint8_t *serialized = NULL;
+        PCRE2_SIZE serialized_size = 0;
+        if (count > 0) {
+                int32_t ret = pcre2_serialize_encode(codes, count, &serialized, &serialized_size,
+                                                     NULL);
+                if (ret < 0) {
+                        free(codes);
+                        CAMLreturn(Val_int(ret));
+                }
+        }
+        free(codes);
+        checksum = fnv1a_64(checksum, serialized, serialized_size);
+
+        temporary_path = caml_alloc_sprintf("%s.%ld.tmp", String_val(path), (long)getpid());
+        int fd = open(String_val(temporary_path), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        struct serialized_header header = {.pcre2_major = PCRE2_MAJOR,
+                                           .pcre2_minor = PCRE2_MINOR,
+                                           .count = count,
+                                           .sources_size = sources_size,
+                                           .codes_size = serialized_size,
+                                           .checksum = checksum};
+        memcpy(header.magic, SERIALIZED_MAGIC, sizeof(header.magic));
+        bool ok = fd >= 0 && write_all(fd, &header, sizeof(header));
+        for (uint32_t i = 0; ok && i < count; ++i) {
+                const struct ocaml_regex *re = regex_of_value(Field(regexes, i));
+                uint32_t source[2] = {re->options, (uint32_t)re->pattern_length};
+                ok = write_all(fd, source, sizeof(source))
+                     && write_all(fd, re->pattern, re->pattern_length);
+        }
+        ok = ok && write_all(fd, serialized, serialized_size);
+        int error = ok ? 0 : errno;
+        if (fd >= 0 && close(fd) < 0 && ok) {
+                ok = false;
+                error = errno;
+        }
+        if (ok && rename(String_val(temporary_path), String_val(path)) < 0) {
+                ok = false;
+                error = errno;
+        }
+        if (serialized) {
+                pcre2_serialize_free(serialized);
+        }
+        if (!ok) {
+                if (fd >= 0) {
+                        unlink(String_val(temporary_path));
+                }
+                errno = error;
+                caml_sys_error(path);
+        }
+        CAMLreturn(Val_int(0));
+}
+
+/// The regexes of a file of serialized regexes, decoded, and the offsets of
+/// their sources in the file.
+struct serialized_contents {
+        uint32_t count;
+        pcre2_code **codes;
+        size_t *sources;
+};
+
+/// Validates a mapped file of serialized regexes and decodes them.
+///
+/// @return Whether the file is valid, for this version of PCRE2.
+static bool serialized_decode(const uint8_t *bytes, size_t length,
+                              struct serialized_contents *contents) {
+        struct serialized_header header;
+        if (length < sizeof(header)) {
+                return false;
+        }
+        memcpy(&header, bytes, sizeof(header));
+        if (memcmp(header.magic, SERIALIZED_MAGIC, sizeof(header.magic)) != 0
+            || header.pcre2_major != PCRE2_MAJOR || header.pcre2_minor != PCRE2_MINOR
+            || header.sources_size > length - sizeof(header)
+            || header.codes_size != length - sizeof(header) - header.sources_size
+            || (header.count > 0) != (header.codes_size > 0)
+            || fnv1a_64(FNV1A_64_BASIS, bytes + sizeof(header), length - sizeof(header))
+                   != header.checksum) {
+                return false;
+        }
+        contents->count = header.count;
+        contents->sources = malloc((header.count + 1) * sizeof(size_t));
+        contents->codes = malloc((header.count + 1) * sizeof(pcre2_code *));
+        if (!contents->sources || !contents->codes) {
+                return false;
+        }
+        size_t offset = sizeof(header);
+        size_t end = sizeof(header) + header.sources_size;
+        for (uint32_t i = 0; i < header.count; ++i) {
+                uint32_t source[2];
+                if (end - offset < sizeof(source)) {
+                        return false;
+                }
+                memcpy(source, bytes + offset, sizeof(source));
+                if (end - offset - sizeof(source) < source[1]) {
+                        return false;
+                }
+                contents->sources[i] = offset;
+                offset += sizeof(source) + source[1];
+        }
+        if (offset != end || header.count == 0) {
+                return offset == end;
+        }
+        const uint8_t *serialized = bytes + end;
+        return pcre2_serialize_get_number_of_codes(serialized) == (int32_t)header.count
+               && pcre2_serialize_decode(contents->codes, header.count, serialized, NULL)
+                      == (int32_t)header.count;
+}
+
+/// Loads the regexes saved by [serialized_save], mapping the file and decoding
+/// them all at once.
+///
+/// @param[in] path The path of the file.
+/// @return The pattern, options and regex of each, or [None] if the file does
+/// not exist, is not a file of serialized regexes or is for another version of
+/// PCRE2 (or architecture).
+CAMLprim value serialized_load(value path /* : string */
+                               ) /* : -> (string * int32 * interp regex) array option */ {
+        CAMLparam1(path);
+        CAMLlocal5(entries, entry, pattern, regex_value, result);
+
+        if (!caml_string_is_c_safe(path)) {
+                CAMLreturn(Val_none);
+        }
+        char *file = caml_stat_strdup(String_val(path));
+        struct serialized_contents contents = {0, NULL, NULL};
+        bool valid = false;
+        // NOTE: Nothing below refers to the OCaml heap until the lock is
+        // reacquired.
+        caml_enter_blocking_section();
+        int fd = open(file, O_RDONLY);
+        struct stat info;
+        void *mapped = MAP_FAILED;
+        if (fd >= 0 && fstat(fd, &info) == 0 && info.st_size > 0) {
+                mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        if (fd >= 0) {
+                close(fd);
+        }
+        if (mapped != MAP_FAILED) {
+                valid = serialized_decode(mapped, info.st_size, &contents);
+        }
+        caml_leave_blocking_section();
+        caml_stat_free(file);
+
+        // NOTE: Each regex is wrapped, with its pattern copied out of the
+        // mapping, which is unmapped once all are.
+        uint32_t decoded = valid ? contents.count : 0;
+        if (valid) {
+                entries = decoded ? caml_alloc(decoded, ARRAY_TAG) : caml_alloc_tuple(0);
+        }
+        for (uint32_t i = 0; i < decoded; ++i) {
+                const uint8_t *bytes = (const uint8_t *)mapped + contents.sources[i];
+                uint32_t source[2];
+                memcpy(source, bytes, sizeof(source));
+                uint32_t options = source[0];
+                uint32_t pattern_length = source[1];
+                const char *pattern_bytes = (const char *)bytes + sizeof(source);
+                char *pattern_copy = malloc(pattern_length + 1);
+                if (!pattern_copy) {
+                        for (uint32_t j = i; j < decoded; ++j) {
+                                pcre2_code_free(contents.codes[j]);
+                        }
+                        munmap(mapped, info.st_size);
+                        free(contents.codes);
+                        free(contents.sources);
+                        caml_raise_out_of_memory();
+                }
+                memcpy(pattern_copy, pattern_bytes, pattern_length);
+                pattern = caml_alloc_initialized_string(pattern_length, pattern_bytes);
+                regex_value = alloc_regex(contents.codes[i], prefilter_create(contents.codes[i]),
+                                          pattern_copy, pattern_length, options);
+                entry = caml_alloc_tuple(3);
+                Store_field(entry, 0, pattern);
+                Store_field(entry, 1, caml_copy_int32(options));
+                Store_field(entry, 2, regex_value);
+                Store_field(entries, i, entry);
+        }
+        if (mapped != MAP_FAILED) {
+                munmap(mapped, info.st_size);
+        }
+        free(contents.codes);
+        free(contents.sources);
+        if (!valid) {
+                CAMLreturn(Val_none);
+        }
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        result = caml_alloc_small(1, OPTION_SOME_TAG);
+        Field(result, 0) = entries;
+        CAMLreturn(result);
+}
+
+/// Match with the provided JIT compiled regex.
+///
+/// @param[in] ocaml_re The JIT regex to use for matching.
+/// @param[in] ocaml_match_data The match data to use, if any; it needs only a
+/// single pair in its offset vector.
+/// @param[in] ocaml_match_context The match context to use, if any, which sets
+/// the limits of matching.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_offset The byte index in the subject at which to begin.
+/// @param[in] options Matching options, specified via a bitvector. See
+/// `pcre2_match(3)`. NOTE: PCRE2_ZERO_TERMINATED is not supported, but this
+/// isn't much of an issue since we are dealing with OCaml strings.
+CAMLprim value jit_match_unboxed(value ocaml_re /* : jit regex */,
+                                 value ocaml_match_data /* : match_data option */,
+                                 value ocaml_match_context /* : match_context option */,
+                                 value subject /* : subject */,
+                                 intnat subject_offset /* : int [@untagged] */,
+                                 uint32_t options /* : int32 */
+                                 ) /* : -> ((int * int) option, int) Result.t */ {
+        // NOTE: In UTF mode, the subject string is not checked for UTF
         // validity. Unless PCRE2_MATCH_INVALID_UTF was set when the pattern
         // was compiled, passing an invalid UTF string results in undefined
         // behaviour.Your program may crash or loop or give wrong results .In
@@ -285,70 +2126,797 @@ CAMLprim value jit_match_unboxed(value ocaml_re /* : jit regex */, value subject
         // The supported options are PCRE2_NOTBOL, PCRE2_NOTEOL,
         // PCRE2_NOTEMPTY, PCRE2_NOTEMPTY_ATSTART, PCRE2_PARTIAL_HARD, and
         // PCRE2_PARTIAL_SOFT. Unsupported options are ignored.
-        CAMLparam2(ocaml_re, subject);
-        CAMLlocal3(result, range, match);
+        return match_range(ocaml_re, ocaml_match_data, ocaml_match_context, subject, subject_offset,
+                           options, ENGINE_JIT);
+}
+
+/// Boxed argument version of [jit_match_unboxed] (for bytecode).
+CAMLprim value jit_match(value *argv, int argc UNUSED) {
+        return jit_match_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                 Int32_val(argv[5]));
+}
+
+/// Match with the provided regex using the DFA, which finds the longest match
+/// at the first position at which there is one. See [match_unboxed].
+CAMLprim value dfa_match_unboxed(value ocaml_re /* : _ regex */,
+                                 value ocaml_match_data /* : match_data option */,
+                                 value ocaml_match_context /* : match_context option */,
+                                 value subject /* : subject */,
+                                 intnat subject_offset /* : int [@untagged] */,
+                                 uint32_t options /* : int32 */
+                                 ) /* : -> ((int * int) option, int) Result.t */ {
+        return match_range(ocaml_re, ocaml_match_data, ocaml_match_context, subject, subject_offset,
+                           options, ENGINE_DFA);
+}
+
+/// Boxed argument version of [dfa_match_unboxed] (for bytecode).
+CAMLprim value dfa_match(value *argv, int argc UNUSED) {
+        return dfa_match_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                 Int32_val(argv[5]));
+}
+
+/// Shared implementation of the allocation-free matching functions.
+///
+/// @return The number of pairs set in the offset vector of the match data used
+/// (which is positive) if there is a match, 0 if there is none,
+/// PCRE2_ERROR_PARTIAL if there is only a partial match (in which case the
+/// first pair of the offset vector is its range), or otherwise a negative error
+/// code.
+static intnat match_noalloc_partial(value ocaml_re, value ocaml_match_data,
+                                    value ocaml_match_context, value subject,
+                                    intnat subject_offset, uint32_t options, enum engine engine,
+                                    pcre2_match_data **match_data_used) {
+        // NOTE: Nothing here (or in callers) can trigger a GC, so the values
+        // need not be registered as roots. For the same reason, the runtime
+        // lock is never released here (see [begin_matching]).
+        if (subject_offset < 0) {
+                return PCRE2_ERROR_BADOFFSET;
+        }
+
+        const pcre2_code *re = regex_of_value(ocaml_re)->regex;
+        pcre2_match_data *match_data = match_data_of_option(ocaml_match_data);
+        if (!match_data) {
+                match_data = scratch_match_data();
+        }
+        *match_data_used = match_data;
+
+        const struct ocaml_match_context *mcontext = match_context_of_option(ocaml_match_context);
+        arm_guard(mcontext);
+        struct dfa_workspace *workspace = workspace_of_option(ocaml_match_data);
+        PCRE2_SPTR subject_data = subject_pointer(subject);
+        size_t length = subject_size(subject);
+        if (prefilter_rejects(regex_of_value(ocaml_re)->prefilter, subject_data, length,
+                              subject_offset, options)) {
+                return 0;
+        }
+        int ret = run_match(re, engine, subject_data, length, subject_offset, options, match_data,
+                            workspace, mcontext);
+        return ret == PCRE2_ERROR_NOMATCH ? 0 : ret;
+}
+
+/// As [match_noalloc_partial], but a partial match counts as no match.
+static intnat match_noalloc(value ocaml_re, value ocaml_match_data, value ocaml_match_context,
+                            value subject, intnat subject_offset, uint32_t options,
+                            enum engine engine, pcre2_match_data **match_data_used) {
+        intnat ret = match_noalloc_partial(ocaml_re, ocaml_match_data, ocaml_match_context,
+                                           subject, subject_offset, options, engine,
+                                           match_data_used);
+        return ret == PCRE2_ERROR_PARTIAL ? 0 : ret;
+}
+
+/// Tests whether the provided pattern matches, without allocating on the OCaml
+/// heap.
+///
+/// @param[in] ocaml_re The compiled regex to use for matching.
+/// @param[in] ocaml_match_data The match data to use, if any.
+/// @param[in] ocaml_match_context The match context to use, if any, which sets
+/// the limits of matching.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_offset The byte index in the subject at which to begin.
+/// @param[in] options Matching options, specified via a bitvector. See `pcre2_match(3)`.
+/// @return A positive value if there is a match, 0 if there is none, or
+/// otherwise a negative error code.
+CAMLprim intnat is_match_unboxed(value ocaml_re /* : _ regex */,
+                                 value ocaml_match_data /* : match_data option */,
+                                 value ocaml_match_context /* : match_context option */,
+                                 value subject /* : subject */,
+                                 intnat subject_offset /* : int [@untagged] */,
+                                 uint32_t options /* : int32 [@unboxed] */
+                                 ) /* : -> int [@untagged] [@@noalloc] */ {
+        pcre2_match_data *match_data;
+        return match_noalloc(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                             subject_offset, options, ENGINE_INTERP, &match_data);
+}
+
+/// Boxed argument version of [is_match_unboxed] (for bytecode).
+CAMLprim value is_match(value *argv, int argc UNUSED) {
+        return Val_long(is_match_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                         Int32_val(argv[5])));
+}
+
+/// Tests whether the provided JIT compiled regex matches, without allocating on
+/// the OCaml heap. See [is_match_unboxed].
+CAMLprim intnat jit_is_match_unboxed(value ocaml_re /* : jit regex */,
+                                     value ocaml_match_data /* : match_data option */,
+                                     value ocaml_match_context /* : match_context option */,
+                                     value subject /* : subject */,
+                                     intnat subject_offset /* : int [@untagged] */,
+                                     uint32_t options /* : int32 [@unboxed] */
+                                     ) /* : -> int [@untagged] [@@noalloc] */ {
+        pcre2_match_data *match_data;
+        return match_noalloc(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                             subject_offset, options, ENGINE_JIT, &match_data);
+}
+
+/// Boxed argument version of [jit_is_match_unboxed] (for bytecode).
+CAMLprim value jit_is_match(value *argv, int argc UNUSED) {
+        return Val_long(jit_is_match_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                             Int32_val(argv[5])));
+}
+
+/// Tests whether the provided regex matches using the DFA, without allocating
+/// on the OCaml heap. See [is_match_unboxed]; the caller may pass
+/// PCRE2_DFA_SHORTEST, since any match will do.
+CAMLprim intnat dfa_is_match_unboxed(value ocaml_re /* : _ regex */,
+                                     value ocaml_match_data /* : match_data option */,
+                                     value ocaml_match_context /* : match_context option */,
+                                     value subject /* : subject */,
+                                     intnat subject_offset /* : int [@untagged] */,
+                                     uint32_t options /* : int32 [@unboxed] */
+                                     ) /* : -> int [@untagged] [@@noalloc] */ {
+        pcre2_match_data *match_data;
+        return match_noalloc(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                             subject_offset, options, ENGINE_DFA, &match_data);
+}
+
+/// Boxed argument version of [dfa_is_match_unboxed] (for bytecode).
+CAMLprim value dfa_is_match(value *argv, int argc UNUSED) {
+        return Val_long(dfa_is_match_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                             Int32_val(argv[5])));
+}
+
+/// Writes the range of the whole match (or of a partial match) into the first
+/// two elements of the provided buffer.
+static intnat store_range(intnat ret, pcre2_match_data *match_data, value buffer) {
+        if (ret <= 0 && ret != PCRE2_ERROR_PARTIAL) {
+                return ret;
+        }
+        if (Wosize_val(buffer) < 2) {
+                return PCRE2_ERROR_BADDATA;
+        }
+        PCRE2_SIZE *ovec = pcre2_get_ovector_pointer(match_data);
+        // SAFETY: Immediate values may be stored without caml_modify.
+        Field(buffer, 0) = Val_long(ovec[0]);
+        Field(buffer, 1) = Val_long(ovec[1]);
+        return ret;
+}
+
+/// Match with the provided pattern, without allocating on the OCaml heap.
+///
+/// @param[in] ocaml_re The compiled regex to use for matching.
+/// @param[in] ocaml_match_data The match data to use, if any.
+/// @param[in] ocaml_match_context The match context to use, if any, which sets
+/// the limits of matching.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_offset The byte index in the subject at which to begin.
+/// @param[in] options Matching options, specified via a bitvector. See `pcre2_match(3)`.
+/// @param[out] buffer An int array, of length at least 2, in which the start
+/// and end of the match are stored if there is one.
+/// @return As for [is_match_unboxed]. Additionally, PCRE2_ERROR_BADDATA is
+/// returned if the buffer is too small.
+CAMLprim intnat find_into_unboxed(value ocaml_re /* : _ regex */,
+                                  value ocaml_match_data /* : match_data option */,
+                                  value ocaml_match_context /* : match_context option */,
+                                  value subject /* : subject */,
+                                  intnat subject_offset /* : int [@untagged] */,
+                                  uint32_t options /* : int32 [@unboxed] */,
+                                  value buffer /* : int array */
+                                  ) /* : -> int [@untagged] [@@noalloc] */ {
+        pcre2_match_data *match_data;
+        intnat ret = match_noalloc(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                                   subject_offset, options, ENGINE_INTERP, &match_data);
+        return store_range(ret, match_data, buffer);
+}
+
+/// Boxed argument version of [find_into_unboxed] (for bytecode).
+CAMLprim value find_into(value *argv, int argc UNUSED) {
+        return Val_long(find_into_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                          Int32_val(argv[5]), argv[6]));
+}
+
+/// Match with the provided pattern, without allocating on the OCaml heap,
+/// reporting partial matches. See [find_into_unboxed].
+///
+/// @return As for [find_into_unboxed], except that if there is only a partial
+/// match (as requested with PCRE2_PARTIAL_SOFT or PCRE2_PARTIAL_HARD), its
+/// range is stored in the buffer and PCRE2_ERROR_PARTIAL is returned. The start
+/// of the range is the first byte which a complete match could start at; the
+/// end is the end of the subject.
+CAMLprim intnat find_partial_into_unboxed(value ocaml_re /* : _ regex */,
+                                          value ocaml_match_data /* : match_data option */,
+                                          value ocaml_match_context /* : match_context option */,
+                                          value subject /* : subject */,
+                                          intnat subject_offset /* : int [@untagged] */,
+                                          uint32_t options /* : int32 [@unboxed] */,
+                                          value buffer /* : int array */
+                                          ) /* : -> int [@untagged] [@@noalloc] */ {
+        // NOTE: pcre2_match uses the JIT only if the regex was JIT compiled for
+        // the partial mode requested, and otherwise interprets it. This is
+        // unlike pcre2_jit_match, which fails, so there is no JIT variant.
+        pcre2_match_data *match_data;
+        intnat ret = match_noalloc_partial(ocaml_re, ocaml_match_data, ocaml_match_context,
+                                           subject, subject_offset, options, ENGINE_INTERP,
+                                           &match_data);
+        return store_range(ret, match_data, buffer);
+}
+
+/// Boxed argument version of [find_partial_into_unboxed] (for bytecode).
+CAMLprim value find_partial_into(value *argv, int argc UNUSED) {
+        return Val_long(find_partial_into_unboxed(argv[0], argv[1], argv[2], argv[3],
+                                                  Long_val(argv[4]), Int32_val(argv[5]),
+                                                  argv[6]));
+}
+
+/// Match with the provided regex using the DFA, without allocating on the
+/// OCaml heap, reporting partial matches. See [find_partial_into_unboxed].
+CAMLprim intnat dfa_find_partial_into_unboxed(value ocaml_re /* : _ regex */,
+                                              value ocaml_match_data /* : match_data option */,
+                                              value ocaml_match_context
+                                              /* : match_context option */,
+                                              value subject /* : subject */,
+                                              intnat subject_offset /* : int [@untagged] */,
+                                              uint32_t options /* : int32 [@unboxed] */,
+                                              value buffer /* : int array */
+                                              ) /* : -> int [@untagged] [@@noalloc] */ {
+        pcre2_match_data *match_data;
+        intnat ret = match_noalloc_partial(ocaml_re, ocaml_match_data, ocaml_match_context,
+                                           subject, subject_offset, options, ENGINE_DFA,
+                                           &match_data);
+        return store_range(ret, match_data, buffer);
+}
+
+/// Boxed argument version of [dfa_find_partial_into_unboxed] (for bytecode).
+CAMLprim value dfa_find_partial_into(value *argv, int argc UNUSED) {
+        return Val_long(dfa_find_partial_into_unboxed(argv[0], argv[1], argv[2], argv[3],
+                                                      Long_val(argv[4]), Int32_val(argv[5]),
+                                                      argv[6]));
+}
+
+/// Match with the provided JIT compiled regex, without allocating on the OCaml
+/// heap. See [find_into_unboxed].
+CAMLprim intnat jit_find_into_unboxed(value ocaml_re /* : jit regex */,
+                                      value ocaml_match_data /* : match_data option */,
+                                      value ocaml_match_context /* : match_context option */,
+                                      value subject /* : subject */,
+                                      intnat subject_offset /* : int [@untagged] */,
+                                      uint32_t options /* : int32 [@unboxed] */,
+                                      value buffer /* : int array */
+                                      ) /* : -> int [@untagged] [@@noalloc] */ {
+        pcre2_match_data *match_data;
+        intnat ret = match_noalloc(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                                   subject_offset, options, ENGINE_JIT, &match_data);
+        return store_range(ret, match_data, buffer);
+}
+
+/// Boxed argument version of [jit_find_into_unboxed] (for bytecode).
+CAMLprim value jit_find_into(value *argv, int argc UNUSED) {
+        return Val_long(jit_find_into_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                              Int32_val(argv[5]), argv[6]));
+}
+
+/// Match with the provided regex using the DFA, without allocating on the
+/// OCaml heap. See [find_into_unboxed].
+CAMLprim intnat dfa_find_into_unboxed(value ocaml_re /* : _ regex */,
+                                      value ocaml_match_data /* : match_data option */,
+                                      value ocaml_match_context /* : match_context option */,
+                                      value subject /* : subject */,
+                                      intnat subject_offset /* : int [@untagged] */,
+                                      uint32_t options /* : int32 [@unboxed] */,
+                                      value buffer /* : int array */
+                                      ) /* : -> int [@untagged] [@@noalloc] */ {
+        pcre2_match_data *match_data;
+        intnat ret = match_noalloc(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                                   subject_offset, options, ENGINE_DFA, &match_data);
+        return store_range(ret, match_data, buffer);
+}
+
+/// Boxed argument version of [dfa_find_into_unboxed] (for bytecode).
+CAMLprim value dfa_find_into(value *argv, int argc UNUSED) {
+        return Val_long(dfa_find_into_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                              Int32_val(argv[5]), argv[6]));
+}
+
+/// Determines how to step past an empty match, as described in
+/// `pcre2demo(3)`.
+///
+/// @param[in] re The compiled regex being matched.
+/// @param[out] utf Whether the regex is in UTF mode (so that an entire
+/// character must be stepped over).
+/// @param[out] crlf_is_newline Whether CRLF is a valid newline sequence (so
+/// that it must be stepped over as a unit).
+static void empty_match_stepping(const pcre2_code *re, bool *utf, bool *crlf_is_newline) {
+        uint32_t all_options = 0;
+        uint32_t newline = 0;
+        pcre2_pattern_info(re, PCRE2_INFO_ALLOPTIONS, &all_options);
+        pcre2_pattern_info(re, PCRE2_INFO_NEWLINE, &newline);
+        *utf = (all_options & PCRE2_UTF) != 0;
+        *crlf_is_newline = newline == PCRE2_NEWLINE_ANY || newline == PCRE2_NEWLINE_CRLF
+                           || newline == PCRE2_NEWLINE_ANYCRLF;
+}
+
+/// Returns the offset of the next character after [offset] in [subject].
+static size_t next_char_offset(PCRE2_SPTR subject, size_t subject_length, size_t offset, bool utf,
+                               bool crlf_is_newline) {
+        if (crlf_is_newline && offset + 1 < subject_length && subject[offset] == '\r'
+            && subject[offset + 1] == '\n') {
+                return offset + 2;
+        }
+        ++offset;
+        if (utf) {
+                // Skip over continuation bytes (0b10xxxxxx).
+                while (offset < subject_length && (subject[offset] & 0xc0) == 0x80) {
+                        ++offset;
+                }
+        }
+        return offset;
+}
+
+/// A growable buffer of offsets.
+struct offset_buffer {
+        PCRE2_SIZE *offsets;
+        size_t length;
+        size_t capacity;
+};
+
+/// Appends [n] offsets to the buffer.
+///
+/// @return false if the buffer could not be grown.
+static bool offset_buffer_append(struct offset_buffer *buffer, const PCRE2_SIZE *offsets,
+                                 size_t n) {
+        if (buffer->length + n > buffer->capacity) {
+                size_t capacity = buffer->capacity ? buffer->capacity : 32;
+                while (buffer->length + n > capacity) {
+                        capacity *= 2;
+                }
+                PCRE2_SIZE *grown = realloc(buffer->offsets, capacity * sizeof(PCRE2_SIZE));
+                if (!grown) {
+                        return false;
+                }
+                buffer->offsets = grown;
+                buffer->capacity = capacity;
+        }
+        for (size_t i = 0; i < n; ++i) {
+                buffer->offsets[buffer->length++] = offsets[i];
+        }
+        return true;
+}
+
+/// Copies the contents of the buffer into a fresh OCaml int array.
+static value offset_buffer_to_array(const struct offset_buffer *buffer) /* : -> int array */ {
+        CAMLparam0();
+        CAMLlocal1(array);
+        if (buffer->length == 0) {
+                // SAFETY: There are no fields in the allocation, so it is
+                // trivially well-formed.
+                array = caml_alloc_tuple(0);
+                CAMLreturn(array);
+        }
+        // NOTE: caml_alloc initializes the fields, so immediates may then be
+        // stored directly.
+        array = caml_alloc(buffer->length, ARRAY_TAG);
+        for (size_t i = 0; i < buffer->length; ++i) {
+                PCRE2_SIZE offset = buffer->offsets[i];
+                Field(array, i) = offset == PCRE2_UNSET ? Val_long(-1) : Val_long(offset);
+        }
+        CAMLreturn(array);
+}
+
+/// Repeatedly matches a regex against a subject, collecting the ranges of
+/// every (non-overlapping) match, in the manner of `pcre2demo(3)`.
+///
+/// @param[in] re The compiled regex to use for matching.
+/// @param[in] prefilter The prefilter of the regex, or NULL, with which the
+/// subject is checked once before matching begins.
+/// @param[in] engine The matching function to use.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_length The length of the subject in bytes.
+/// @param[in] offset The byte index in the subject at which to begin.
+/// @param[in] options Matching options, specified via a bitvector.
+/// @param[in] max_count The maximum number of matches to collect, or a
+/// negative number for no maximum.
+/// @param[in] after_empty Whether [offset] is the end of an (earlier) empty
+/// match, in which case another empty match is not permitted there.
+/// @param[in,out] match_data The match data to use.
+/// @param[in,out] workspace The workspace to use for DFA matching.
+/// @param[in] pairs The number of pairs from the offset vector to collect for
+/// each match.
+/// @param[out] buffer The buffer to append the collected offsets to.
+/// @param[in] mcontext The match context to use for each match.
+/// @return 0 if matching completed (or [max_count] was reached), or otherwise
+/// the negative error code which ended matching.
+static int match_all(const pcre2_code *re, const struct prefilter *prefilter,
+                     enum engine engine, PCRE2_SPTR subject, size_t subject_length, size_t offset,
+                     uint32_t options, intnat max_count, bool after_empty,
+                     pcre2_match_data *match_data, struct dfa_workspace *workspace,
+                     uint32_t pairs, struct offset_buffer *buffer,
+                     const struct ocaml_match_context *mcontext) {
+        // NOTE: A later offset can only lack more, so there is no need to
+        // check again after each match.
+        if (!after_empty
+            && prefilter_rejects(prefilter, subject, subject_length, offset, options)) {
+                return 0;
+        }
+        bool utf, crlf_is_newline;
+        empty_match_stepping(re, &utf, &crlf_is_newline);
+
+        PCRE2_SIZE *ovec = pcre2_get_ovector_pointer(match_data);
+        intnat count = 0;
+        while (max_count < 0 || count < max_count) {
+                int ret;
+                if (after_empty) {
+                        // Look for a non-empty match at the same position.
+                        // NOTE: The JIT does not support PCRE2_ANCHORED at
+                        // match time, so this uses pcre2_match (which falls
+                        // back to the interpreter) in place of the JIT.
+                        enum engine anchored_engine = engine == ENGINE_JIT ? ENGINE_INTERP
+                                                                           : engine;
+                        ret = run_match(re, anchored_engine, subject, subject_length, offset,
+                                        options | PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED,
+                                        match_data, workspace, mcontext);
+                        if (ret == PCRE2_ERROR_NOMATCH) {
+                                if (offset >= subject_length) {
+                                        return 0;
+                                }
+                                offset = next_char_offset(subject, subject_length, offset, utf,
+                                                          crlf_is_newline);
+                                after_empty = false;
+                                continue;
+                        }
+                } else {
+                        ret = run_match(re, engine, subject, subject_length, offset, options,
+                                        match_data, workspace, mcontext);
+                }
+
+                if (ret == PCRE2_ERROR_NOMATCH || ret == PCRE2_ERROR_PARTIAL) {
+                        return 0;
+                } else if (ret < 0) {
+                        return ret;
+                }
+
+                PCRE2_SIZE start = ovec[0];
+                PCRE2_SIZE end = ovec[1];
+                if (end < start) {
+                        // \K was used in an assertion to set the start of the
+                        // match after its end; there is no sensible way to
+                        // continue (pcre2_substitute reports the same error).
+                        return PCRE2_ERROR_BADSUBSPATTERN;
+                }
+                // Unset groups beyond the number which matched are reported
+                // as PCRE2_UNSET.
+                for (uint32_t i = ret; i < pairs; ++i) {
+                        ovec[2 * i] = PCRE2_UNSET;
+                        ovec[2 * i + 1] = PCRE2_UNSET;
+                }
+                if (!offset_buffer_append(buffer, ovec, 2 * pairs)) {
+                        return PCRE2_ERROR_NOMEMORY;
+                }
+                ++count;
+                offset = end;
+                after_empty = start == end;
+        }
+        return 0;
+}
+
+/// Shared implementation of [find_all_unboxed], [jit_find_all_unboxed] and
+/// [dfa_find_all_unboxed].
+static value find_all_impl(value ocaml_re, value ocaml_match_data, value ocaml_match_context,
+                           value subject, intnat subject_offset, uint32_t options,
+                           intnat max_count, value after_empty,
+                           enum engine engine) /* : -> int array * int */ {
+        CAMLparam5(ocaml_re, ocaml_match_data, ocaml_match_context, subject, after_empty);
+        CAMLlocal2(offsets, result);
+
+        struct offset_buffer buffer = {NULL, 0, 0};
+        int status;
+        if (subject_offset < 0) {
+                // Need to handle this case manually since PCRE2 takes an unsigned value.
+                status = PCRE2_ERROR_BADOFFSET;
+        } else {
+                const pcre2_code *re = regex_of_value(ocaml_re)->regex;
+                const struct prefilter *prefilter = regex_of_value(ocaml_re)->prefilter;
+                pcre2_match_data *match_data = match_data_of_option(ocaml_match_data);
+                if (!match_data) {
+                        match_data = scratch_match_data();
+                }
+                // SAFETY: Passing in the value of subject_pointer(subject) here is
+                // fine since a GC cannot occur (and it is not on the OCaml heap
+                // if the lock is released).
+                PCRE2_SPTR subject_data = subject_pointer(subject);
+                size_t length = subject_size(subject);
+                bool resume_after_empty = Bool_val(after_empty);
+                const struct ocaml_match_context *mcontext =
+                    match_context_of_option(ocaml_match_context);
+                arm_guard(mcontext);
+                struct dfa_workspace *workspace = workspace_of_option(ocaml_match_data);
+                bool released = begin_matching(subject);
+                status = match_all(re, prefilter, engine, subject_data, length, subject_offset,
+                                   options, max_count, resume_after_empty, match_data,
+                                   workspace, 1, &buffer, mcontext);
+                end_matching(released);
+        }
+
+        offsets = offset_buffer_to_array(&buffer);
+        free(buffer.offsets);
+
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        result = caml_alloc_small(2, TUPLE_TAG);
+        Field(result, 0) = offsets;
+        Field(result, 1) = Val_int(status);
+        CAMLreturn(result);
+}
+
+/// Finds every match of the provided pattern in a single call.
+///
+/// @param[in] ocaml_re The compiled regex to use for matching.
+/// @param[in] ocaml_match_data The match data to use, if any.
+/// @param[in] ocaml_match_context The match context to use, if any, which sets
+/// the limits of matching.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_offset The byte index in the subject at which to begin.
+/// @param[in] options Matching options, specified via a bitvector. See `pcre2_match(3)`.
+/// @param[in] max_count The maximum number of matches to find, or a negative
+/// number for no maximum.
+/// @param[in] after_empty Whether [subject_offset] is the end of an earlier
+/// empty match (so that another empty match is not permitted there).
+/// @return A pair of the flattened ranges of the matches ([start0; end0;
+/// start1; end1; ...]) and either 0, or the error code which ended matching
+/// early (in which case the ranges are those found before the error).
+CAMLprim value find_all_unboxed(value ocaml_re /* : _ regex */,
+                                value ocaml_match_data /* : match_data option */,
+                                value ocaml_match_context /* : match_context option */,
+                                value subject /* : subject */,
+                                intnat subject_offset /* : int [@untagged] */,
+                                uint32_t options /* : int32 [@unboxed] */,
+                                intnat max_count /* : int [@untagged] */,
+                                value after_empty /* : bool */) /* : -> int array * int */ {
+        return find_all_impl(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                             subject_offset, options, max_count, after_empty, ENGINE_INTERP);
+}
+
+/// Boxed argument version of [find_all_unboxed] (for bytecode).
+CAMLprim value find_all(value *argv, int argc UNUSED) {
+        return find_all_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                Int32_val(argv[5]), Long_val(argv[6]), argv[7]);
+}
+
+/// Finds every match of the provided JIT compiled regex in a single call. See
+/// [find_all_unboxed].
+CAMLprim value jit_find_all_unboxed(value ocaml_re /* : jit regex */,
+                                    value ocaml_match_data /* : match_data option */,
+                                    value ocaml_match_context /* : match_context option */,
+                                    value subject /* : subject */,
+                                    intnat subject_offset /* : int [@untagged] */,
+                                    uint32_t options /* : int32 [@unboxed] */,
+                                    intnat max_count /* : int [@untagged] */,
+                                    value after_empty /* : bool */) /* : -> int array * int */ {
+        return find_all_impl(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                             subject_offset, options, max_count, after_empty, ENGINE_JIT);
+}
+
+/// Boxed argument version of [jit_find_all_unboxed] (for bytecode).
+CAMLprim value jit_find_all(value *argv, int argc UNUSED) {
+        return jit_find_all_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                    Int32_val(argv[5]), Long_val(argv[6]), argv[7]);
+}
+
+/// Finds every (longest) match of the provided regex using the DFA in a single
+/// call. See [find_all_unboxed].
+CAMLprim value dfa_find_all_unboxed(value ocaml_re /* : _ regex */,
+                                    value ocaml_match_data /* : match_data option */,
+                                    value ocaml_match_context /* : match_context option */,
+                                    value subject /* : subject */,
+                                    intnat subject_offset /* : int [@untagged] */,
+                                    uint32_t options /* : int32 [@unboxed] */,
+                                    intnat max_count /* : int [@untagged] */,
+                                    value after_empty /* : bool */) /* : -> int array * int */ {
+        return find_all_impl(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                             subject_offset, options, max_count, after_empty, ENGINE_DFA);
+}
+
+/// Boxed argument version of [dfa_find_all_unboxed] (for bytecode).
+CAMLprim value dfa_find_all(value *argv, int argc UNUSED) {
+        return dfa_find_all_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                    Int32_val(argv[5]), Long_val(argv[6]), argv[7]);
+}
 
-        // Need to handle this case manually since PCRE2 takes an unsigned value.
-        if (subject_offset < 0) {
-                // SAFETY: This allocation is immediately filled with
-                // well-formed values prior to returning.
-                result = caml_alloc_small(1, RESULT_ERROR_TAG);
-                Field(result, 0) = Val_int(PCRE2_ERROR_BADOFFSET);
-                CAMLreturn(result);
+/// Annotates the ranges of matches with the line and column at which each
+/// starts, both counted from 1 (columns in bytes).
+///
+/// The newlines of the subject are found with memchr, in a single pass over
+/// it as far as the start of the last match, rather than per match.
+///
+/// @param[in] subject The subject the matches were found in.
+/// @param[in] ranges The flattened ranges of the matches, in order.
+/// @param[out] located The buffer to append [start; end; line; column] to for
+/// each match.
+/// @return false if the buffer could not be grown.
+static bool locate_matches(PCRE2_SPTR subject, const struct offset_buffer *ranges,
+                           struct offset_buffer *located) {
+        size_t line = 1;
+        size_t line_start = 0;
+        size_t cursor = 0;
+        for (size_t i = 0; i + 1 < ranges->length; i += 2) {
+                size_t start = ranges->offsets[i];
+                while (cursor < start) {
+                        const PCRE2_UCHAR *newline = memchr(subject + cursor, '\n', start - cursor);
+                        if (!newline) {
+                                break;
+                        }
+                        cursor = newline - subject + 1;
+                        line_start = cursor;
+                        ++line;
+                }
+                cursor = start;
+                PCRE2_SIZE entry[4] = {start, ranges->offsets[i + 1], line,
+                                       start - line_start + 1};
+                if (!offset_buffer_append(located, entry, 4)) {
+                        return false;
+                }
         }
-        size_t offset = subject_offset;
-        size_t subject_length = caml_string_length(subject);
-
-        const pcre2_code *re = regex_of_value(ocaml_re)->regex;
-        // TODO: support match/depth limits. Or callouts. May need to be
-        // bundled with the compiled regex.
-        pcre2_match_context *mcontext = NULL;
-        pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(re, NULL);
+        return true;
+}
 
-        // SAFETY: Passing in the value of String_val(subject) here is fine
-        // since a GC cannot occur.
-        int ret = pcre2_jit_match(re, (PCRE2_SPTR)String_val(subject), subject_length, offset,
-                                  options, match_data, mcontext);
-        PCRE2_SIZE *ovec = pcre2_get_ovector_pointer(match_data);
+/// Shared implementation of [scan_file_unboxed], [jit_scan_file_unboxed] and
+/// [dfa_scan_file_unboxed].
+static value scan_file_impl(value ocaml_re, value ocaml_match_data, value ocaml_match_context,
+                            value path, uint32_t options, intnat max_count,
+                            enum engine engine) /* : -> int array * int */ {
+        CAMLparam4(ocaml_re, ocaml_match_data, ocaml_match_context, path);
+        CAMLlocal2(located_array, result);
+
+        if (!caml_string_is_c_safe(path)) {
+                errno = ENOENT;
+                caml_sys_error(path);
+        }
+        char *file = caml_stat_strdup(String_val(path));
 
-        if (ret == PCRE2_ERROR_NOMATCH || ret == PCRE2_ERROR_PARTIAL) {
-                pcre2_match_data_free(match_data);
-                // SAFETY: This allocation is immediately filled with
-                // well-formed values prior to returning.
-                result = caml_alloc_small(1, RESULT_OK_TAG);
-                Field(result, 0) = Val_none;
-                CAMLreturn(result);
-        } else if (ret <= 0) {
-                pcre2_match_data_free(match_data);
-                // SAFETY: This allocation is immediately filled with
-                // well-formed values prior to returning.
-                result = caml_alloc_small(1, RESULT_ERROR_TAG);
-                Field(result, 0) = Val_int(ret);
-                CAMLreturn(result);
+        const pcre2_code *re = regex_of_value(ocaml_re)->regex;
+        const struct prefilter *prefilter = regex_of_value(ocaml_re)->prefilter;
+        pcre2_match_data *match_data = match_data_of_option(ocaml_match_data);
+        if (!match_data) {
+                match_data = scratch_match_data();
+        }
+        const struct ocaml_match_context *mcontext = match_context_of_option(ocaml_match_context);
+        arm_guard(mcontext);
+        struct dfa_workspace *workspace = workspace_of_option(ocaml_match_data);
+
+        struct offset_buffer ranges = {NULL, 0, 0};
+        struct offset_buffer located = {NULL, 0, 0};
+        int status = 0;
+        int error = 0;
+        // NOTE: Nothing below refers to the OCaml heap until the lock is
+        // reacquired; the file is mapped outside of it.
+        caml_enter_blocking_section();
+        int fd = open(file, O_RDONLY);
+        struct stat info;
+        void *mapped = MAP_FAILED;
+        if (fd < 0 || fstat(fd, &info) < 0) {
+                error = errno;
+        } else if (info.st_size > 0) {
+                mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped == MAP_FAILED) {
+                        error = errno;
+                } else {
+                        madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+                }
+        }
+        if (!error) {
+                // An empty file cannot be mapped, but is searched all the
+                // same, since a pattern may match the empty string.
+                PCRE2_SPTR subject = mapped == MAP_FAILED ? (PCRE2_SPTR) "" : mapped;
+                size_t length = mapped == MAP_FAILED ? 0 : (size_t)info.st_size;
+                status = match_all(re, prefilter, engine, subject, length, 0, options,
+                                   max_count, false, match_data, workspace, 1, &ranges,
+                                   mcontext);
+                if (!locate_matches(subject, &ranges, &located)) {
+                        status = PCRE2_ERROR_NOMEMORY;
+                }
         }
+        if (mapped != MAP_FAILED) {
+                munmap(mapped, info.st_size);
+        }
+        if (fd >= 0) {
+                close(fd);
+        }
+        caml_leave_blocking_section();
+        caml_stat_free(file);
+        free(ranges.offsets);
+
+        if (error) {
+                free(located.offsets);
+                errno = error;
+                caml_sys_error(path);
+        }
+        located_array = offset_buffer_to_array(&located);
+        free(located.offsets);
 
-        // SAFETY: This allocation is immediately filled with well-formed values.
-        range = caml_alloc_small(2, TUPLE_TAG);
-        Field(range, 0) = Val_int(ovec[0]);
-        Field(range, 1) = Val_int(ovec[1]);
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        result = caml_alloc_small(2, TUPLE_TAG);
+        Field(result, 0) = located_array;
+        Field(result, 1) = Val_int(status);
+        CAMLreturn(result);
+}
 
-        pcre2_match_data_free(match_data);
+/// Finds every match of the provided pattern in a file, which is mapped into
+/// memory rather than read. The runtime lock is released meanwhile.
+///
+/// @param[in] ocaml_re The compiled regex to use for matching.
+/// @param[in] ocaml_match_data The match data to use, if any.
+/// @param[in] ocaml_match_context The match context to use, if any, which sets
+/// the limits of matching.
+/// @param[in] path The path of the file to be searched.
+/// @param[in] options Matching options, specified via a bitvector. See `pcre2_match(3)`.
+/// @param[in] max_count The maximum number of matches to find, or a negative
+/// number for no maximum.
+/// @return A pair of the matches, flattened as [start0; end0; line0; column0;
+/// start1; ...] (see [locate_matches]), and either 0 or the error code which
+/// ended matching early (in which case the matches are those found before the
+/// error). Raises [Sys_error] if the file cannot be opened or mapped.
+CAMLprim value scan_file_unboxed(value ocaml_re /* : _ regex */,
+                                 value ocaml_match_data /* : match_data option */,
+                                 value ocaml_match_context /* : match_context option */,
+                                 value path /* : string */,
+                                 uint32_t options /* : int32 [@unboxed] */,
+                                 intnat max_count /* : int [@untagged] */
+                                 ) /* : -> int array * int */ {
+        return scan_file_impl(ocaml_re, ocaml_match_data, ocaml_match_context, path, options,
+                              max_count, ENGINE_INTERP);
+}
 
-        // SAFETY: This allocation is immediately filled with well-formed values.
-        match = caml_alloc_small(1, OPTION_SOME_TAG);
-        Field(match, 0) = range;
+/// Boxed argument version of [scan_file_unboxed] (for bytecode).
+CAMLprim value scan_file(value *argv, int argc UNUSED) {
+        return scan_file_unboxed(argv[0], argv[1], argv[2], argv[3], Int32_val(argv[4]),
+                                 Long_val(argv[5]));
+}
 
-        // SAFETY: This allocation is immediately filled with
-        // well-formed values prior to returning.
-        result = caml_alloc_small(1, RESULT_OK_TAG);
-        Field(result, 0) = range;
+/// Finds every match of the provided JIT compiled regex in a file. See
+/// [scan_file_unboxed].
+CAMLprim value jit_scan_file_unboxed(value ocaml_re /* : jit regex */,
+                                     value ocaml_match_data /* : match_data option */,
+                                     value ocaml_match_context /* : match_context option */,
+                                     value path /* : string */,
+                                     uint32_t options /* : int32 [@unboxed] */,
+                                     intnat max_count /* : int [@untagged] */
+                                     ) /* : -> int array * int */ {
+        return scan_file_impl(ocaml_re, ocaml_match_data, ocaml_match_context, path, options,
+                              max_count, ENGINE_JIT);
+}
 
-        CAMLreturn(result);
+/// Boxed argument version of [jit_scan_file_unboxed] (for bytecode).
+CAMLprim value jit_scan_file(value *argv, int argc UNUSED) {
+        return jit_scan_file_unboxed(argv[0], argv[1], argv[2], argv[3], Int32_val(argv[4]),
+                                     Long_val(argv[5]));
 }
 
-/// Boxed argument version of [jit_match_unboxed] (for bytecode).
-CAMLprim value jit_match(value *argv, int argc UNUSED) {
-        return jit_match_unboxed(argv[0], argv[1], Int_val(argv[2]), Int32_val(argv[3]));
+/// Finds every match of the provided regex in a file using the DFA. See
+/// [scan_file_unboxed].
+CAMLprim value dfa_scan_file_unboxed(value ocaml_re /* : _ regex */,
+                                     value ocaml_match_data /* : match_data option */,
+                                     value ocaml_match_context /* : match_context option */,
+                                     value path /* : string */,
+                                     uint32_t options /* : int32 [@unboxed] */,
+                                     intnat max_count /* : int [@untagged] */
+                                     ) /* : -> int array * int */ {
+        return scan_file_impl(ocaml_re, ocaml_match_data, ocaml_match_context, path, options,
+                              max_count, ENGINE_DFA);
+}
+
+/// Boxed argument version of [dfa_scan_file_unboxed] (for bytecode).
+CAMLprim value dfa_scan_file(value *argv, int argc UNUSED) {
+        return dfa_scan_file_unboxed(argv[0], argv[1], argv[2], argv[3], Int32_val(argv[4]),
+                                     Long_val(argv[5]));
 }
 
 /// Returns the name table associated with a given regex.
@@ -423,6 +2991,205 @@ value make_capture_group_name_table(const pcre2_code *regex) /* -> (string * int
         CAMLreturn(array);
 }
 
+/// Returns the ASCII letter of the other case, or the byte itself if it is not
+/// an ASCII letter.
+static inline unsigned char other_ascii_case(unsigned char c) {
+        return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+/// Finds the first occurrence of a needle in a haystack, ignoring the case of
+/// ASCII letters (as PCRE2's default character tables do).
+static const unsigned char *find_caseless(const unsigned char *haystack, size_t haystack_length,
+                                          const unsigned char *needle, size_t needle_length) {
+        if (needle_length > haystack_length) {
+                return NULL;
+        }
+        // The positions at which the needle could start.
+        const unsigned char *end = haystack + haystack_length - needle_length + 1;
+        unsigned char first = needle[0];
+        unsigned char other = other_ascii_case(first);
+        for (const unsigned char *p = haystack; p < end;) {
+                const unsigned char *candidate = memchr(p, first, end - p);
+                if (other != first) {
+                        const unsigned char *limit = candidate ? candidate : end;
+                        const unsigned char *other_candidate = memchr(p, other, limit - p);
+                        candidate = other_candidate ? other_candidate : candidate;
+                }
+                if (!candidate) {
+                        return NULL;
+                }
+                size_t i = 1;
+                while (i < needle_length
+                       && (candidate[i] == needle[i]
+                           || candidate[i] == other_ascii_case(needle[i]))) {
+                        ++i;
+                }
+                if (i == needle_length) {
+                        return candidate;
+                }
+                p = candidate + 1;
+        }
+        return NULL;
+}
+
+/// Finds the first occurrence of a literal in a subject, without PCRE2.
+///
+/// @param[in] needle The literal to find, which must not be empty.
+/// @param[in] caseless Whether the case of ASCII letters is ignored.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_offset The byte index in the subject at which to begin,
+/// which must be within it.
+/// @return The byte index in the subject at which the literal starts, or -1 if
+/// it does not occur.
+CAMLprim intnat literal_find_unboxed(value needle /* : string */, value caseless /* : bool */,
+                                     value subject /* : string */,
+                                     intnat subject_offset /* : int [@untagged] */
+                                     ) /* : -> int [@untagged] [@@noalloc] */ {
+        const unsigned char *haystack = (const unsigned char *)String_val(subject) + subject_offset;
+        size_t haystack_length = caml_string_length(subject) - subject_offset;
+        const unsigned char *needle_bytes = (const unsigned char *)String_val(needle);
+        size_t needle_length = caml_string_length(needle);
+        // NOTE: memmem is vectorized by glibc (as memchr is, for the caseless
+        // search).
+        const unsigned char *found =
+            Bool_val(caseless)
+                ? find_caseless(haystack, haystack_length, needle_bytes, needle_length)
+                : memmem(haystack, haystack_length, needle_bytes, needle_length);
+        return found ? found - (const unsigned char *)String_val(subject) : -1;
+}
+
+/// Boxed argument version of [literal_find_unboxed] (for bytecode).
+CAMLprim value literal_find(value needle, value caseless, value subject, value subject_offset) {
+        return Val_long(literal_find_unboxed(needle, caseless, subject, Long_val(subject_offset)));
+}
+
+/// The state of a search for every pattern of a set, shared with
+/// [set_callout].
+struct set_search {
+        /// The range of the leftmost match of each pattern, or PCRE2_UNSET
+        /// while it has not matched.
+        PCRE2_SIZE *offsets;
+        uint32_t pattern_count;
+        /// The number of patterns which have yet to match.
+        uint32_t remaining;
+};
+
+/// The callout which follows each pattern of a set combined into one regex
+/// (see [Set] in pcre2.ml), and whose string is the index of the pattern.
+///
+/// Matching the pattern at a position records it, if it is the leftmost match
+/// of the pattern, then fails, so that matching goes on to the remaining
+/// patterns and positions. Once every pattern has matched, matching is ended
+/// with PCRE2_ERROR_CALLOUT. Callouts without a string, such as those
+/// inserted by PCRE2_AUTO_CALLOUT, are not ours, and matching goes on past
+/// them.
+static int set_callout(pcre2_callout_block *block, void *data) {
+        struct set_search *search = data;
+        if (!block->callout_string) {
+                return 0;
+        }
+        uint32_t index = 0;
+        for (PCRE2_SIZE i = 0; i < block->callout_string_length; ++i) {
+                index = 10 * index + (block->callout_string[i] - '0');
+        }
+        if (index < search->pattern_count && search->offsets[2 * index] == PCRE2_UNSET) {
+                search->offsets[2 * index] = block->start_match;
+                search->offsets[2 * index + 1] = block->current_position;
+                if (--search->remaining == 0) {
+                        return PCRE2_ERROR_CALLOUT;
+                }
+        }
+        return 1;
+}
+
+/// Returns the match context used for matching sets by the calling thread,
+/// whose callout data is set for each match.
+///
+/// NOTE: The context is never freed; it lives as long as the thread.
+static pcre2_match_context *set_match_context(void) {
+        static _Thread_local pcre2_match_context *context = NULL;
+        if (!context) {
+                context = pcre2_match_context_create(NULL);
+                if (context) {
+                        pcre2_jit_stack_assign(context, thread_jit_stack_callback, NULL);
+                }
+        }
+        return context;
+}
+
+/// Finds the leftmost match of every pattern of a set in a single pass, with
+/// the set combined into one regex (see [set_callout]).
+///
+/// @param[in] ocaml_re The combined regex.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_offset The byte index in the subject at which to begin.
+/// @param[in] pattern_count The number of patterns in the set.
+/// @return A pair of the ranges of the leftmost match of each pattern,
+/// flattened as for [find_all_unboxed] with -1 for those which did not match,
+/// and either 0 or the error code which ended matching early.
+CAMLprim value set_match_unboxed(value ocaml_re /* : _ regex */, value subject /* : subject */,
+                                 intnat subject_offset /* : int [@untagged] */,
+                                 intnat pattern_count /* : int [@untagged] */
+                                 ) /* : -> int array * int */ {
+        CAMLparam2(ocaml_re, subject);
+        CAMLlocal2(offsets, result);
+
+        struct offset_buffer buffer = {NULL, 0, 0};
+        int status = 0;
+        if (subject_offset < 0) {
+                status = PCRE2_ERROR_BADOFFSET;
+        } else if (pattern_count > 0) {
+                buffer.offsets = malloc(2 * pattern_count * sizeof(PCRE2_SIZE));
+                pcre2_match_context *context = set_match_context();
+                if (!buffer.offsets || !context) {
+                        free(buffer.offsets);
+                        caml_raise_out_of_memory();
+                }
+                buffer.length = buffer.capacity = 2 * pattern_count;
+                for (size_t i = 0; i < buffer.length; ++i) {
+                        buffer.offsets[i] = PCRE2_UNSET;
+                }
+                struct set_search search = {buffer.offsets, pattern_count, pattern_count};
+                pcre2_set_callout(context, set_callout, &search);
+
+                const pcre2_code *re = regex_of_value(ocaml_re)->regex;
+                // SAFETY: Passing in the value of subject_pointer(subject) here is
+                // fine since a GC cannot occur (and it is not on the OCaml heap
+                // if the lock is released).
+                PCRE2_SPTR subject_data = subject_pointer(subject);
+                size_t length = subject_size(subject);
+                bool released = begin_matching(subject);
+                int ret;
+                do {
+                        ret = pcre2_match(re, subject_data, length, subject_offset, 0,
+                                          scratch_match_data(), context);
+                } while (ret == PCRE2_ERROR_JIT_STACKLIMIT && grow_thread_jit_stack());
+                end_matching(released);
+                // Every path through the regex ends in a failing callout, so it
+                // never matches.
+                if (ret < 0 && ret != PCRE2_ERROR_NOMATCH && ret != PCRE2_ERROR_CALLOUT) {
+                        status = ret;
+                }
+        }
+
+        offsets = offset_buffer_to_array(&buffer);
+        free(buffer.offsets);
+
+        // SAFETY: This allocation is immediately filled with well-formed
+        // values prior to returning.
+        result = caml_alloc_small(2, TUPLE_TAG);
+        Field(result, 0) = offsets;
+        Field(result, 1) = Val_int(status);
+        CAMLreturn(result);
+}
+
+/// Boxed argument version of [set_match_unboxed] (for bytecode).
+CAMLprim value set_match(value ocaml_re, value subject, value subject_offset,
+                         value pattern_count) {
+        return set_match_unboxed(ocaml_re, subject, Long_val(subject_offset),
+                                 Long_val(pattern_count));
+}
+
 /// Wrapper for [make_capture_group_name_table] which takes a regex as an OCaml
 /// value, instead of directly.
 CAMLprim value get_capture_groups(value ocaml_regex /* : regex */) /* -> (string * int) array */ {
@@ -430,218 +3197,627 @@ CAMLprim value get_capture_groups(value ocaml_regex /* : regex */) /* -> (string
         CAMLreturn(make_capture_group_name_table(regex_of_value(ocaml_regex)->regex));
 }
 
-/// Match, with capture groups, the provided pattern.
+/// Returns the number of bytes before the start of a match which matching may
+/// examine, such as by a lookbehind or \b.
 ///
-/// @param[in] ocaml_re The compiled regex to use for matching.
-/// @param[in] subject The string to be searched.
-/// @param[in] subject_offset The byte index in the subject at which to begin.
-/// @param[in] options Matching options, specified via a bitvector . See `pcre2_match(3)`.
-// TODO: allow reusing the pcre2_match_data struct so that captures_iter can avoid a bunch of
-// allocations. Ideally this function doesn't allocate (except maybe a result).
-CAMLprim value capture_unboxed(
-    value ocaml_re /* : _ regex */, value subject /* : string */,
-    intnat subject_offset /* : int [@untagged] */, uint32_t options /* : int32 */
-    ) /* : -> (((int * int) array * (string * int) array) option, match_error) Result.t */ {
-        CAMLparam2(ocaml_re, subject);
-        CAMLlocal5(result, matches, match, name, name_table);
-        CAMLlocal2(matches_and_table, match_opt);
+/// @param[in] ocaml_re The compiled regex.
+/// @return The longest lookbehind of the regex, converted from characters to
+/// bytes (of which a character takes at most 4 in UTF-8 mode).
+CAMLprim intnat max_lookbehind_unboxed(value ocaml_re /* : _ regex */
+                                       ) /* : -> int [@untagged] [@@noalloc] */ {
+        const pcre2_code *re = regex_of_value(ocaml_re)->regex;
+        uint32_t lookbehind = 0;
+        uint32_t all_options = 0;
+        pcre2_pattern_info(re, PCRE2_INFO_MAXLOOKBEHIND, &lookbehind);
+        pcre2_pattern_info(re, PCRE2_INFO_ALLOPTIONS, &all_options);
+        return (all_options & PCRE2_UTF) ? 4 * (intnat)lookbehind : (intnat)lookbehind;
+}
+
+/// Boxed argument version of [max_lookbehind_unboxed] (for bytecode).
+CAMLprim value max_lookbehind(value ocaml_re) {
+        return Val_long(max_lookbehind_unboxed(ocaml_re));
+}
+
+/// Returns an ASCII code unit which every match of a regex contains, as
+/// reported by PCRE2 (preferring the first code unit to the last), or -1 if
+/// there is none. A caseless pattern may match it in either case.
+///
+/// @param[in] ocaml_re The compiled regex.
+CAMLprim intnat required_code_unit_unboxed(value ocaml_re /* : _ regex */
+                                           ) /* : -> int [@untagged] [@@noalloc] */ {
+        const struct prefilter *prefilter = regex_of_value(ocaml_re)->prefilter;
+        if (!prefilter) {
+                return -1;
+        }
+        return prefilter->first_code_unit >= 0 ? prefilter->first_code_unit
+                                               : prefilter->last_code_unit;
+}
+
+/// Boxed argument version of [required_code_unit_unboxed] (for bytecode).
+CAMLprim value required_code_unit(value ocaml_re) {
+        return Val_long(required_code_unit_unboxed(ocaml_re));
+}
+
+/// An Aho-Corasick automaton over the required literals of a set of rules,
+/// which finds every rule whose literal occurs in a subject in one pass.
+///
+/// The automaton is a DFA over classes of bytes: bytes which appear in no
+/// literal share a class, as do the cases of each ASCII letter, so that a row
+/// of the transition table is a few dozen entries rather than 256. Literals
+/// are thereby matched caselessly, and those which are not caseless are
+/// compared exactly when the automaton finds them.
+struct literal_set {
+        /// The class of each byte.
+        uint8_t byte_class[256];
+        uint32_t class_count;
+        uint32_t state_count;
+        /// The next state from each state on each class, by state then class.
+        uint32_t *next;
+        /// The first literal ending at each state, or -1.
+        int32_t *first_output;
+        /// The nearest state along the failure links of each state which has
+        /// a literal ending at it, or -1.
+        int32_t *output_link;
+        uint32_t literal_count;
+        /// The next literal ending at the same state as each literal, or -1.
+        int32_t *next_output;
+        /// The bytes of each literal, by offset into [bytes].
+        char *bytes;
+        size_t *offsets;
+        size_t *lengths;
+        bool *caseless;
+        /// The rule of each literal.
+        uint32_t *rules;
+        uint32_t rule_count;
+        /// The number of distinct rules among [rules].
+        uint32_t rules_with_literals;
+};
+
+static void literal_set_free(struct literal_set *set) {
+        if (!set) {
+                return;
+        }
+        free(set->next);
+        free(set->first_output);
+        free(set->output_link);
+        free(set->next_output);
+        free(set->bytes);
+        free(set->offsets);
+        free(set->lengths);
+        free(set->caseless);
+        free(set->rules);
+        free(set);
+}
+
+static void ocaml_literal_set_free(value ocaml_literal_set) {
+        literal_set_free(*(struct literal_set **)Data_custom_val(ocaml_literal_set));
+}
+
+static struct custom_operations literal_set_ops = {.identifier = "pcre2_ocaml_literal_set",
+                                                   .finalize = ocaml_literal_set_free,
+                                                   .compare = NULL,
+                                                   .hash = NULL,
+                                                   .serialize = NULL,
+                                                   .deserialize = NULL,
+                                                   .compare_ext = NULL,
+                                                   .fixed_length = NULL};
+
+static inline uint8_t fold_ascii(uint8_t byte) {
+        return byte >= 'A' && byte <= 'Z' ? byte - 'A' + 'a' : byte;
+}
+
+/// Builds the automaton, once [literal_count] literals have been copied into
+/// [bytes], [offsets], [lengths], [caseless] and [rules].
+///
+/// @return Whether memory could be allocated for it.
+static bool literal_set_build(struct literal_set *set) {
+        // Class 0 holds every byte which appears in no literal. There are at
+        // most 231 classes, since uppercase letters are folded.
+        memset(set->byte_class, 0, sizeof(set->byte_class));
+        set->class_count = 1;
+        size_t total_length = 0;
+        for (uint32_t i = 0; i < set->literal_count; ++i) {
+                const uint8_t *literal = (const uint8_t *)set->bytes + set->offsets[i];
+                for (size_t j = 0; j < set->lengths[i]; ++j) {
+                        uint8_t byte = fold_ascii(literal[j]);
+                        if (set->byte_class[byte] == 0) {
+                                set->byte_class[byte] = set->class_count++;
+                        }
+                }
+                total_length += set->lengths[i];
+        }
+        for (int byte = 'A'; byte <= 'Z'; ++byte) {
+                set->byte_class[byte] = set->byte_class[fold_ascii(byte)];
+        }
+
+        // NOTE: The states of the trie are at most one per byte of the
+        // literals, besides the root (state 0).
+        size_t max_states = total_length + 1;
+        uint32_t classes = set->class_count;
+        set->next = calloc(max_states * classes, sizeof(uint32_t));
+        set->first_output = malloc(max_states * sizeof(int32_t));
+        set->output_link = malloc(max_states * sizeof(int32_t));
+        set->next_output = malloc(set->literal_count * sizeof(int32_t));
+        uint32_t *failure = malloc(max_states * sizeof(uint32_t));
+        uint32_t *queue = malloc(max_states * sizeof(uint32_t));
+        if (!set->next || !set->first_output || !set->output_link
+            || (set->literal_count && !set->next_output) || !failure || !queue) {
+                free(failure);
+                free(queue);
+                return false;
+        }
+
+        // Build the trie, in which 0 (the root, which no edge leads back to)
+        // stands for no edge.
+        set->state_count = 1;
+        set->first_output[0] = -1;
+        for (uint32_t i = 0; i < set->literal_count; ++i) {
+                const uint8_t *literal = (const uint8_t *)set->bytes + set->offsets[i];
+                uint32_t state = 0;
+                for (size_t j = 0; j < set->lengths[i]; ++j) {
+                        uint32_t *edge = &set->next[state * classes + set->byte_class[literal[j]]];
+                        if (*edge == 0) {
+                                *edge = set->state_count;
+                                set->first_output[set->state_count++] = -1;
+                        }
+                        state = *edge;
+                }
+                set->next_output[i] = set->first_output[state];
+                set->first_output[state] = (int32_t)i;
+        }
+
+        // Complete the trie into a DFA breadth first, so that the failure
+        // state of each state (which is shallower) is complete before it.
+        size_t head = 0;
+        size_t tail = 0;
+        failure[0] = 0;
+        set->output_link[0] = -1;
+        queue[tail++] = 0;
+        while (head < tail) {
+                uint32_t state = queue[head++];
+                for (uint32_t c = 0; c < classes; ++c) {
+                        uint32_t *edge = &set->next[state * classes + c];
+                        uint32_t fallback =
+                            state == 0 ? 0 : set->next[failure[state] * classes + c];
+                        if (*edge == 0) {
+                                *edge = fallback;
+                                continue;
+                        }
+                        uint32_t child = *edge;
+                        failure[child] = fallback;
+                        set->output_link[child] = set->first_output[fallback] >= 0
+                                                      ? (int32_t)fallback
+                                                      : set->output_link[fallback];
+                        queue[tail++] = child;
+                }
+        }
+        free(failure);
+        free(queue);
+        return true;
+}
+
+/// Builds the automaton for the required literals of a set of rules.
+///
+/// @param[in] literals The literals, none of which is empty.
+/// @param[in] caseless Whether each literal is compared caselessly.
+/// @param[in] rules The index of the rule of each literal.
+/// @param[in] rule_count The number of rules.
+/// @return The automaton.
+CAMLprim value literal_set_create(value literals /* : string array */,
+                                  value caseless /* : bool array */, value rules /* : int array */,
+                                  value rule_count /* : int */) /* : -> literal_set */ {
+        CAMLparam4(literals, caseless, rules, rule_count);
+        CAMLlocal1(set_value);
+
+        struct literal_set *set = calloc(1, sizeof(struct literal_set));
+        if (!set) {
+                caml_raise_out_of_memory();
+        }
+        uint32_t count = Wosize_val(literals);
+        set->literal_count = count;
+        set->rule_count = Long_val(rule_count);
+        size_t total_length = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+                total_length += caml_string_length(Field(literals, i));
+        }
+        set->bytes = malloc(total_length + 1);
+        set->offsets = malloc((count + 1) * sizeof(size_t));
+        set->lengths = malloc((count + 1) * sizeof(size_t));
+        set->caseless = malloc((count + 1) * sizeof(bool));
+        set->rules = malloc((count + 1) * sizeof(uint32_t));
+        if (!set->bytes || !set->offsets || !set->lengths || !set->caseless || !set->rules) {
+                literal_set_free(set);
+                caml_raise_out_of_memory();
+        }
+        size_t offset = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+                size_t length = caml_string_length(Field(literals, i));
+                memcpy(set->bytes + offset, String_val(Field(literals, i)), length);
+                set->offsets[i] = offset;
+                set->lengths[i] = length;
+                set->caseless[i] = Bool_val(Field(caseless, i));
+                set->rules[i] = Long_val(Field(rules, i));
+                offset += length;
+        }
+        bool *seen = calloc(set->rule_count + 1, sizeof(bool));
+        if (!seen || !literal_set_build(set)) {
+                free(seen);
+                literal_set_free(set);
+                caml_raise_out_of_memory();
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+                if (!seen[set->rules[i]]) {
+                        seen[set->rules[i]] = true;
+                        ++set->rules_with_literals;
+                }
+        }
+        free(seen);
+
+        size_t size = sizeof(struct literal_set) + total_length
+                      + (size_t)set->state_count * (set->class_count * sizeof(uint32_t) + 8);
+        set_value = caml_alloc_custom_mem(&literal_set_ops, sizeof(struct literal_set *), size);
+        *(struct literal_set **)Data_custom_val(set_value) = set;
+        CAMLreturn(set_value);
+}
+
+/// Marks the rules of the literals ending at a state, at [end] in the subject.
+///
+/// @return The number of rules newly marked.
+static uint32_t literal_set_report(const struct literal_set *set, int32_t state,
+                                   PCRE2_SPTR subject, size_t end, bool *found) {
+        uint32_t marked = 0;
+        for (; state >= 0; state = set->output_link[state]) {
+                for (int32_t i = set->first_output[state]; i >= 0; i = set->next_output[i]) {
+                        uint32_t rule = set->rules[i];
+                        size_t length = set->lengths[i];
+                        if (found[rule]
+                            || (!set->caseless[i]
+                                && memcmp(subject + end + 1 - length,
+                                          set->bytes + set->offsets[i], length))) {
+                                continue;
+                        }
+                        found[rule] = true;
+                        ++marked;
+                }
+        }
+        return marked;
+}
+
+/// Finds the rules whose literals occur in a subject.
+///
+/// @param[in] ocaml_literal_set The automaton.
+/// @param[in] subject The subject to be searched.
+/// @return The indices of the rules found, in increasing order.
+CAMLprim value literal_set_scan(value ocaml_literal_set /* : literal_set */,
+                                value subject /* : subject */) /* : -> int array */ {
+        CAMLparam2(ocaml_literal_set, subject);
+        CAMLlocal1(result);
+
+        const struct literal_set *set = *(struct literal_set **)Data_custom_val(ocaml_literal_set);
+        bool *found = calloc(set->rule_count + 1, sizeof(bool));
+        if (!found) {
+                caml_raise_out_of_memory();
+        }
+        uint32_t marked = 0;
+
+        // SAFETY: Passing in the value of subject_pointer(subject) here is
+        // fine since a GC cannot occur (and it is not on the OCaml heap if the
+        // lock is released).
+        PCRE2_SPTR bytes = subject_pointer(subject);
+        size_t length = subject_size(subject);
+        bool released = begin_matching(subject);
+        uint32_t state = 0;
+        const uint32_t classes = set->class_count;
+        for (size_t i = 0; i < length && marked < set->rules_with_literals; ++i) {
+                state = set->next[state * classes + set->byte_class[bytes[i]]];
+                if (set->first_output[state] >= 0 || set->output_link[state] >= 0) {
+                        marked += literal_set_report(set, state, bytes, i, found);
+                }
+        }
+        end_matching(released);
+
+        // NOTE: caml_alloc initializes the fields, so immediates may then be
+        // stored directly.
+        result = marked == 0 ? caml_alloc_tuple(0) : caml_alloc(marked, ARRAY_TAG);
+        for (uint32_t rule = 0, i = 0; i < marked; ++rule) {
+                if (found[rule]) {
+                        Field(result, i++) = Val_long(rule);
+                }
+        }
+        free(found);
+        CAMLreturn(result);
+}
+
+/// Shared implementation of [capture_unboxed], [jit_capture_unboxed] and
+/// [dfa_capture_unboxed].
+static value match_captures(value ocaml_re, value ocaml_match_data, value ocaml_match_context,
+                            value subject, intnat subject_offset, uint32_t options,
+                            enum engine engine) /* : -> (int array option, int) Result.t */ {
+        CAMLparam4(ocaml_re, ocaml_match_data, ocaml_match_context, subject);
+        CAMLlocal1(offsets);
 
         if (subject_offset < 0) {
                 // Need to handle this case manually since PCRE2 takes an unsigned value.
-                // FIXME: result or option from this function? need to see if meaningful errors can
-                // occur
-                // SAFETY: This allocation is immediately filled with well-formed values prior to
-                // returning.
-                result = caml_alloc_small(1, RESULT_ERROR_TAG);
-                Field(result, 0) = Val_int(PCRE2_ERROR_BADOFFSET);
-                CAMLreturn(result);
+                CAMLreturn(alloc_error(PCRE2_ERROR_BADOFFSET));
         }
-        size_t offset = subject_offset;
-        size_t subject_length = caml_string_length(subject);
 
         const pcre2_code *re = regex_of_value(ocaml_re)->regex;
-        // TODO: support match/depth limits. Or callouts. May need to be
-        // bundled with the compiled regex.
-        pcre2_match_context *mcontext = NULL;
-        pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(re, NULL);
+        pcre2_match_data *match_data = match_data_of_option(ocaml_match_data);
+        // Without match data from the caller, use temporary match data with
+        // room for every capture group.
+        bool temporary = !match_data;
+        if (temporary) {
+                match_data = match_data_for_captures(re, engine);
+        }
 
         // NOTE: Really one more than number of captures since it includes the
         // full match.
-        // SAFETY: Passing in the value of String_val(subject) here is fine
-        // since a GC cannot occur.
-        int num_captures = pcre2_match(re, (PCRE2_SPTR)String_val(subject), subject_length, offset,
-                                       options, match_data, mcontext);
-        PCRE2_SIZE *ovec = pcre2_get_ovector_pointer(match_data);
+        // SAFETY: Passing in the value of subject_pointer(subject) here is fine
+        // since a GC cannot occur (and it is not on the OCaml heap if the lock
+        // is released).
+        PCRE2_SPTR subject_data = subject_pointer(subject);
+        size_t length = subject_size(subject);
+        const struct ocaml_match_context *mcontext =
+            match_context_of_option(ocaml_match_context);
+        arm_guard(mcontext);
+        struct dfa_workspace *workspace = workspace_of_option(ocaml_match_data);
+        const struct prefilter *prefilter = regex_of_value(ocaml_re)->prefilter;
+        bool released = begin_matching(subject);
+        int num_captures =
+            prefilter_rejects(prefilter, subject_data, length, subject_offset, options)
+                ? PCRE2_ERROR_NOMATCH
+                : run_match(re, engine, subject_data, length, subject_offset, options,
+                            match_data, workspace, mcontext);
+        end_matching(released);
 
         if (num_captures == PCRE2_ERROR_NOMATCH || num_captures == PCRE2_ERROR_PARTIAL) {
-                pcre2_match_data_free(match_data);
-                // SAFETY: This allocation is immediately filled with
-                // well-formed values prior to returning.
-                result = caml_alloc_small(1, RESULT_OK_TAG);
-                Field(result, 0) = Val_none;
-                CAMLreturn(result);
-        } else if (num_captures <= 0) {
-                pcre2_match_data_free(match_data);
-                // SAFETY: This allocation is immediately filled with
-                // well-formed values prior to returning.
-                result = caml_alloc_small(1, RESULT_ERROR_TAG);
-                Field(result, 0) = Val_int(num_captures);
-                CAMLreturn(result);
+                if (temporary) {
+                        pcre2_match_data_free(match_data);
+                }
+                CAMLreturn(alloc_ok(Val_none));
+        } else if (num_captures < 0) {
+                if (temporary) {
+                        pcre2_match_data_free(match_data);
+                }
+                CAMLreturn(alloc_error(num_captures));
         }
 
-        matches /* : (int * int) array */ = caml_alloc_tuple(num_captures);
-        for (int i = 0; i < num_captures; ++i) {
-                // SAFETY: This block must be filled with well-formed values
-                // before the next allocation. The next allocation is no
-                // earlier than the end of this loop iteration. All fields of
-                // this tuple are assigned to by the end of the loop.
-                match /* : int * int */ = caml_alloc_small(2, TUPLE_TAG);
+        // Every pair in the offset vector is returned, so that all matches
+        // from the same regex have the same layout. Groups which did not
+        // participate in the match are PCRE2_UNSET, which is mapped to -1.
+        // The DFA instead reports only the alternative matches it found.
+        uint32_t pairs = engine == ENGINE_DFA ? (uint32_t)num_captures
+                                              : pcre2_get_ovector_count(match_data);
+        PCRE2_SIZE *ovec = pcre2_get_ovector_pointer(match_data);
+        // NOTE: caml_alloc initializes the fields, so immediates may then be
+        // stored directly.
+        offsets /* : int array */ = caml_alloc(2 * pairs, ARRAY_TAG);
+        for (uint32_t i = 0; i < 2 * pairs; ++i) {
                 // The i-th capture group (the 0-th being the full match) is at
                 // [2i, 2i+1] in ovec.
-                int start = 2 * i;
-                int end = 2 * i + 1;
-                Field(match, 0) = Val_int(ovec[start]);
-                Field(match, 1) = Val_int(ovec[end]);
-                caml_modify(&Field(matches, i), match);
+                bool set = i / 2 < (uint32_t)num_captures && ovec[i] != PCRE2_UNSET;
+                Field(offsets, i) = set ? Val_long(ovec[i]) : Val_long(-1);
         }
 
-        // TODO: cache this? May not be that expensive, but if it is then probably worth since we'll
-        // match w/ capture many times.
-        name_table = make_capture_group_name_table(re);
-
-        pcre2_match_data_free(match_data);
-
-        // SAFETY: This allocation is immediately filled with well-formed
-        // values.
-        matches_and_table /* : (int * int) array * (string * int) array */ =
-            caml_alloc_small(2, TUPLE_TAG);
-        Field(matches_and_table, 0) = matches;
-        Field(matches_and_table, 1) = name_table;
-
-        // SAFETY: This allocation is immediately filled with well-formed
-        // values.
-        match_opt /* : ((int * int) array * (string * int) array) option */ =
-            caml_alloc_small(1, OPTION_SOME_TAG);
-        Field(match_opt, 0) = matches_and_table;
+        if (temporary) {
+                pcre2_match_data_free(match_data);
+        }
 
-        // SAFETY: This allocation is immediately filled with well-formed
-        // values prior to returning.
-        result /* : (((int * int) array * (string * int) array) option, _) Result.t */ =
-            caml_alloc_small(1, RESULT_OK_TAG);
-        Field(result, 0) = match_opt;
+        CAMLreturn(alloc_ok(alloc_some(offsets)));
+}
 
-        CAMLreturn(result);
+/// Match, with capture groups, the provided pattern.
+///
+/// @param[in] ocaml_re The compiled regex to use for matching.
+/// @param[in] ocaml_match_data The match data to use, if any. Only as many
+/// capture groups as fit in its offset vector are returned.
+/// @param[in] ocaml_match_context The match context to use, if any, which sets
+/// the limits of matching.
+/// @return The offsets of each capture group, flattened into an array
+/// ([start0; end0; start1; end1; ...]), with -1 for groups which are unset.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_offset The byte index in the subject at which to begin.
+/// @param[in] options Matching options, specified via a bitvector . See `pcre2_match(3)`.
+CAMLprim value capture_unboxed(
+    value ocaml_re /* : _ regex */, value ocaml_match_data /* : match_data option */,
+    value ocaml_match_context /* : match_context option */, value subject /* : subject */,
+    intnat subject_offset /* : int [@untagged] */,
+    uint32_t options /* : int32 */
+    ) /* : -> (int array option, int) Result.t */ {
+        return match_captures(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                              subject_offset, options, ENGINE_INTERP);
 }
 
 /// Boxed argument version of [capture_unboxed] (for bytecode).
 CAMLprim value capture(value *argv, int argc UNUSED) {
-        return match_unboxed(argv[0], argv[1], Nativeint_val(argv[2]), Int32_val(argv[3]));
+        return capture_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                               Int32_val(argv[5]));
 }
 
 /// Match, with capture groups, the provided JIT-enabled pattern.
 ///
 /// @param[in] ocaml_re The compiled regex to use for matching.
-/// @param[in] subject The string to be searched.
+/// @param[in] ocaml_match_data The match data to use, if any. Only as many
+/// capture groups as fit in its offset vector are returned.
+/// @param[in] ocaml_match_context The match context to use, if any, which sets
+/// the limits of matching.
+/// @return The offsets of each capture group, flattened into an array
+/// ([start0; end0; start1; end1; ...]), with -1 for groups which are unset.
+/// @param[in] subject The subject to be searched.
 /// @param[in] subject_offset The byte index in the subject at which to begin.
 /// @param[in] options Matching options, specified via a bitvector . See `pcre2_match(3)`.
-// TODO: allow reusing the pcre2_match_data struct so that captures_iter can avoid a bunch of
-// allocations. Ideally this function doesn't allocate (except maybe a result).
 CAMLprim value jit_capture_unboxed(
-    value ocaml_re /* : _ regex */, value subject /* : string */,
-    intnat subject_offset /* : int [@untagged] */, uint32_t options /* : int32 */
-    ) /* : -> (((int * int) array * (string * int) array) option, match_error) Result.t */ {
-        CAMLparam2(ocaml_re, subject);
-        CAMLlocal5(result, matches, match, name, name_table);
-        CAMLlocal2(matches_and_table, match_opt);
+    value ocaml_re /* : jit regex */, value ocaml_match_data /* : match_data option */,
+    value ocaml_match_context /* : match_context option */, value subject /* : subject */,
+    intnat subject_offset /* : int [@untagged] */,
+    uint32_t options /* : int32 */
+    ) /* : -> (int array option, int) Result.t */ {
+        return match_captures(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                              subject_offset, options, ENGINE_JIT);
+}
 
-        if (subject_offset < 0) {
-                // Need to handle this case manually since PCRE2 takes an unsigned value.
-                // FIXME: result or option from this function? need to see if meaningful errors can
-                // occur
-                // SAFETY: This allocation is immediately filled with well-formed values prior to
-                // returning.
-                result = caml_alloc_small(1, RESULT_ERROR_TAG);
-                Field(result, 0) = Val_int(PCRE2_ERROR_BADOFFSET);
-                CAMLreturn(result);
-        }
-        size_t offset = subject_offset;
-        size_t subject_length = caml_string_length(subject);
+/// Boxed argument version of [jit_capture_unboxed] (for bytecode).
+CAMLprim value jit_capture(value *argv, int argc UNUSED) {
+        return jit_capture_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                   Int32_val(argv[5]));
+}
 
-        const pcre2_code *re = regex_of_value(ocaml_re)->regex;
-        // TODO: support match/depth limits. Or callouts. May need to be
-        // bundled with the compiled regex.
-        pcre2_match_context *mcontext = NULL;
-        pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(re, NULL);
+/// Match with the provided regex using the DFA, reporting every alternative
+/// match at the position found (longest first) in place of capture groups,
+/// which the DFA does not support. See [capture_unboxed].
+CAMLprim value dfa_capture_unboxed(
+    value ocaml_re /* : _ regex */, value ocaml_match_data /* : match_data option */,
+    value ocaml_match_context /* : match_context option */, value subject /* : subject */,
+    intnat subject_offset /* : int [@untagged] */,
+    uint32_t options /* : int32 */
+    ) /* : -> (int array option, int) Result.t */ {
+        return match_captures(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                              subject_offset, options, ENGINE_DFA);
+}
 
-        // NOTE: Really one more than number of captures since it includes the
-        // full match.
-        // SAFETY: Passing in the value of String_val(subject) here is fine
-        // since a GC cannot occur.
-        int num_captures = pcre2_match(re, (PCRE2_SPTR)String_val(subject), subject_length, offset,
-                                       options, match_data, mcontext);
-        PCRE2_SIZE *ovec = pcre2_get_ovector_pointer(match_data);
+/// Boxed argument version of [dfa_capture_unboxed] (for bytecode).
+CAMLprim value dfa_capture(value *argv, int argc UNUSED) {
+        return dfa_capture_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                   Int32_val(argv[5]));
+}
 
-        if (num_captures == PCRE2_ERROR_NOMATCH || num_captures == PCRE2_ERROR_PARTIAL) {
-                pcre2_match_data_free(match_data);
-                // SAFETY: This allocation is immediately filled with
-                // well-formed values prior to returning.
-                result = caml_alloc_small(1, RESULT_OK_TAG);
-                Field(result, 0) = Val_none;
-                CAMLreturn(result);
-        } else if (num_captures <= 0) {
-                pcre2_match_data_free(match_data);
-                // SAFETY: This allocation is immediately filled with
-                // well-formed values prior to returning.
-                result = caml_alloc_small(1, RESULT_ERROR_TAG);
-                Field(result, 0) = Val_int(num_captures);
-                CAMLreturn(result);
+/// Shared implementation of [captures_all_unboxed],
+/// [jit_captures_all_unboxed] and [dfa_captures_all_unboxed].
+static value captures_all_impl(value ocaml_re, value ocaml_match_data,
+                               value ocaml_match_context, value subject, intnat subject_offset,
+                               uint32_t options, intnat max_count, value after_empty,
+                               enum engine engine) /* : -> int array * int * int */ {
+        CAMLparam5(ocaml_re, ocaml_match_data, ocaml_match_context, subject, after_empty);
+        CAMLlocal2(offsets, result);
+
+        const pcre2_code *re = regex_of_value(ocaml_re)->regex;
+        const struct prefilter *prefilter = regex_of_value(ocaml_re)->prefilter;
+        pcre2_match_data *match_data = match_data_of_option(ocaml_match_data);
+        bool temporary = !match_data;
+        if (temporary) {
+                match_data = match_data_for_captures(re, engine);
         }
+        uint32_t pairs = match_data ? pcre2_get_ovector_count(match_data) : 0;
 
-        matches /* : (int * int) array */ = caml_alloc_tuple(num_captures);
-        for (int i = 0; i < num_captures; ++i) {
-                // SAFETY: This block must be filled with well-formed values
-                // before the next allocation. The next allocation is no
-                // earlier than the end of this loop iteration. All fields of
-                // this tuple are assigned to by the end of the loop.
-                match /* : int * int */ = caml_alloc_small(2, TUPLE_TAG);
-                // The i-th capture group (the 0-th being the full match) is at
-                // [2i, 2i+1] in ovec.
-                int start = 2 * i;
-                int end = 2 * i + 1;
-                Field(match, 0) = Val_int(ovec[start]);
-                Field(match, 1) = Val_int(ovec[end]);
-                caml_modify(&Field(matches, i), match);
+        struct offset_buffer buffer = {NULL, 0, 0};
+        int status;
+        if (subject_offset < 0) {
+                // Need to handle this case manually since PCRE2 takes an unsigned value.
+                status = PCRE2_ERROR_BADOFFSET;
+        } else if (!match_data) {
+                status = PCRE2_ERROR_NOMEMORY;
+        } else {
+                // SAFETY: Passing in the value of subject_pointer(subject) here is
+                // fine since a GC cannot occur (and it is not on the OCaml heap
+                // if the lock is released).
+                PCRE2_SPTR subject_data = subject_pointer(subject);
+                size_t length = subject_size(subject);
+                bool resume_after_empty = Bool_val(after_empty);
+                const struct ocaml_match_context *mcontext =
+                    match_context_of_option(ocaml_match_context);
+                arm_guard(mcontext);
+                struct dfa_workspace *workspace = workspace_of_option(ocaml_match_data);
+                bool released = begin_matching(subject);
+                status = match_all(re, prefilter, engine, subject_data, length, subject_offset,
+                                   options, max_count, resume_after_empty, match_data,
+                                   workspace, pairs, &buffer, mcontext);
+                end_matching(released);
         }
 
-        // TODO: cache this? May not be that expensive, but if it is then probably worth since we'll
-        // match w/ capture many times.
-        name_table = make_capture_group_name_table(re);
+        if (temporary) {
+                pcre2_match_data_free(match_data);
+        }
 
-        pcre2_match_data_free(match_data);
+        offsets = offset_buffer_to_array(&buffer);
+        free(buffer.offsets);
 
         // SAFETY: This allocation is immediately filled with well-formed
-        // values.
-        matches_and_table /* : (int * int) array * (string * int) array */ =
-            caml_alloc_small(2, TUPLE_TAG);
-        Field(matches_and_table, 0) = matches;
-        Field(matches_and_table, 1) = name_table;
+        // values prior to returning.
+        result = caml_alloc_small(3, TUPLE_TAG);
+        Field(result, 0) = offsets;
+        Field(result, 1) = Val_int(pairs);
+        Field(result, 2) = Val_int(status);
+        CAMLreturn(result);
+}
 
-        // SAFETY: This allocation is immediately filled with well-formed
-        // values.
-        match_opt /* : ((int * int) array * (string * int) array) option */ =
-            caml_alloc_small(1, OPTION_SOME_TAG);
-        Field(match_opt, 0) = matches_and_table;
+/// Finds every match, with capture groups, of the provided pattern in a single
+/// call.
+///
+/// @param[in] ocaml_re The compiled regex to use for matching.
+/// @param[in] ocaml_match_data The match data to use, if any. Only as many
+/// capture groups as fit in its offset vector are returned.
+/// @param[in] ocaml_match_context The match context to use, if any, which sets
+/// the limits of matching.
+/// @param[in] subject The subject to be searched.
+/// @param[in] subject_offset The byte index in the subject at which to begin.
+/// @param[in] options Matching options, specified via a bitvector. See `pcre2_match(3)`.
+/// @param[in] max_count The maximum number of matches to find, or a negative
+/// number for no maximum.
+/// @param[in] after_empty Whether [subject_offset] is the end of an earlier
+/// empty match (so that another empty match is not permitted there).
+/// @return A triple of: the offsets of each capture group of each match,
+/// flattened into a single array (with -1 for unset groups); the number of
+/// pairs of offsets per match; and either 0, or the error code which ended
+/// matching early (in which case the offsets are those of the matches found
+/// before the error).
+CAMLprim value captures_all_unboxed(value ocaml_re /* : _ regex */,
+                                    value ocaml_match_data /* : match_data option */,
+                                    value ocaml_match_context /* : match_context option */,
+                                    value subject /* : subject */,
+                                    intnat subject_offset /* : int [@untagged] */,
+                                    uint32_t options /* : int32 [@unboxed] */,
+                                    intnat max_count /* : int [@untagged] */,
+                                    value after_empty /* : bool */
+                                    ) /* : -> int array * int * int */ {
+        return captures_all_impl(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                                 subject_offset, options, max_count, after_empty, ENGINE_INTERP);
+}
 
-        // SAFETY: This allocation is immediately filled with well-formed
-        // values prior to returning.
-        result /* : (((int * int) array * (string * int) array) option, _) Result.t */ =
-            caml_alloc_small(1, RESULT_OK_TAG);
-        Field(result, 0) = match_opt;
+/// Boxed argument version of [captures_all_unboxed] (for bytecode).
+CAMLprim value captures_all(value *argv, int argc UNUSED) {
+        return captures_all_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                    Int32_val(argv[5]), Long_val(argv[6]), argv[7]);
+}
 
-        CAMLreturn(result);
+/// Finds every match, with capture groups, of the provided JIT compiled regex
+/// in a single call. See [captures_all_unboxed].
+CAMLprim value jit_captures_all_unboxed(value ocaml_re /* : jit regex */,
+                                        value ocaml_match_data /* : match_data option */,
+                                        value ocaml_match_context /* : match_context option */,
+                                        value subject /* : subject */,
+                                        intnat subject_offset /* : int [@untagged] */,
+                                        uint32_t options /* : int32 [@unboxed] */,
+                                        intnat max_count /* : int [@untagged] */,
+                                        value after_empty /* : bool */
+                                        ) /* : -> int array * int * int */ {
+        return captures_all_impl(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                                 subject_offset, options, max_count, after_empty, ENGINE_JIT);
 }
 
-/// Boxed argument version of [capture_unboxed] (for bytecode).
-CAMLprim value jit_capture(value *argv, int argc UNUSED) {
-        return match_unboxed(argv[0], argv[1], Nativeint_val(argv[2]), Int32_val(argv[3]));
+/// Boxed argument version of [jit_captures_all_unboxed] (for bytecode).
+CAMLprim value jit_captures_all(value *argv, int argc UNUSED) {
+        return jit_captures_all_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                        Int32_val(argv[5]), Long_val(argv[6]), argv[7]);
+}
+
+/// Finds every match of the provided regex using the DFA in a single call,
+/// reporting every alternative at each position as for [dfa_capture_unboxed].
+/// See [captures_all_unboxed].
+CAMLprim value dfa_captures_all_unboxed(value ocaml_re /* : _ regex */,
+                                        value ocaml_match_data /* : match_data option */,
+                                        value ocaml_match_context /* : match_context option */,
+                                        value subject /* : subject */,
+                                        intnat subject_offset /* : int [@untagged] */,
+                                        uint32_t options /* : int32 [@unboxed] */,
+                                        intnat max_count /* : int [@untagged] */,
+                                        value after_empty /* : bool */
+                                        ) /* : -> int array * int * int */ {
+        return captures_all_impl(ocaml_re, ocaml_match_data, ocaml_match_context, subject,
+                                 subject_offset, options, max_count, after_empty, ENGINE_DFA);
+}
+
+/// Boxed argument version of [dfa_captures_all_unboxed] (for bytecode).
+CAMLprim value dfa_captures_all(value *argv, int argc UNUSED) {
+        return dfa_captures_all_unboxed(argv[0], argv[1], argv[2], argv[3], Long_val(argv[4]),
+                                        Int32_val(argv[5]), Long_val(argv[6]), argv[7]);
 }
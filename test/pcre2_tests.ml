@@ -89,6 +89,22 @@ let non_contiguous_named_capture ctxt =
           (Ok (Some { start = 1; end_ = 2 }))
           (c >>= (fun c -> named_match_of_captures c "C") >+= range_of_match))
 
+let duplicate_group_names ctxt =
+  Jit.(
+    match compile ~options:[ `DUPNAMES ] "(?<n>a)|(?<n>b)(?<m>c)" with
+    | Error e -> assert_failure ("failed to compile: " ^ show_compile_error e)
+    | Ok re ->
+        let printer = [%show: int option] in
+        assert_equal ~printer (Some 1) (group_index re "n");
+        assert_equal ~printer (Some 3) (group_index re "m");
+        assert_equal ~printer None (group_index re "o");
+        let printer = [%show: (range option, match_error) result] in
+        assert_equal ~printer
+          (Ok (Some { start = 1; end_ = 2 }))
+          (captures re "xbc"
+          >>= (fun c -> named_match_of_captures c "n")
+          >+= range_of_match))
+
 let bad_pattern ctxt =
   Interp.(
     match compile "ab(" with
@@ -118,6 +134,638 @@ let split_comma ctxt =
         assert_equal ~printer (Ok [ "a"; "b"; "c"; "" ]) (split re "a,b,c,");
         assert_equal ~printer (Ok [ "a"; "b,c," ]) (split ~limit:2 re "a,b,c,"))
 
+let handle_reuse ctxt =
+  Jit.(
+    match compile "(a)(b)?" with
+    | Error e -> assert_failure ("failed to compile: " ^ show_compile_error e)
+    | Ok re ->
+        let printer = [%show: (range option, match_error) result] in
+        let h = handle ~captures:false re in
+        assert_equal ~printer
+          (Ok (Some { start = 1; end_ = 3 }))
+          (find_with h "xab" >+= range_of_match);
+        assert_equal ~printer
+          (Ok (Some { start = 3; end_ = 4 }))
+          (find_with ~subject_offset:2 h "xabac" >+= range_of_match);
+        assert_equal ~printer (Ok None) (find_with h "xyz" >+= range_of_match);
+        let h = handle re in
+        let c = captures_with h "xab" in
+        assert_equal ~printer
+          (Ok (Some { start = 2; end_ = 3 }))
+          (c >>= (fun c -> match_of_captures c 2) >+= range_of_match);
+        let c = captures_with h "xa" in
+        assert_equal ~printer (Ok None)
+          (c >>= (fun c -> match_of_captures c 2) >+= range_of_match))
+
+let find_into_buffer ctxt =
+  Interp.(
+    match compile "b+" with
+    | Error e -> assert_failure ("failed to compile: " ^ show_compile_error e)
+    | Ok re ->
+        let printer = [%show: (bool, match_error) result] in
+        let h = handle ~captures:false re in
+        let buffer = [| -1; -1 |] in
+        assert_equal ~printer (Ok true) (find_into h "abbc" buffer);
+        assert_equal ~printer:[%show: int array] [| 1; 3 |] buffer;
+        assert_equal ~printer (Ok false) (find_into h "ac" buffer);
+        assert_equal ~printer:[%show: int array] [| 1; 3 |] buffer;
+        assert_equal ~printer (Ok true) (is_match_with h "abc");
+        assert_equal ~printer (Ok false) (is_match re "xyz");
+        assert_equal ~printer (Error BADOFFSET)
+          (is_match ~subject_offset:5 re "abc"))
+
+let find_all_empty_matches ctxt =
+  Interp.(
+    match compile "x*" with
+    | Error e -> assert_failure ("failed to compile: " ^ show_compile_error e)
+    | Ok re ->
+        let printer = [%show: (int array, match_error) result] in
+        assert_equal ~printer
+          (Ok [| 0; 0; 1; 2; 2; 2; 3; 3 |])
+          (find_all re "axb");
+        assert_equal ~printer (Ok [| 0; 0; 1; 2 |])
+          (find_all ~max_count:2 re "axb");
+        assert_equal ~printer:string_of_int 4
+          (find_iter re "axb" |> Seq.length);
+        assert_equal ~printer (Error BADOFFSET)
+          (find_all ~subject_offset:4 re "axb"))
+
+let captures_all_batch ctxt =
+  Interp.(
+    match compile "(a)(b)?" with
+    | Error e -> assert_failure ("failed to compile: " ^ show_compile_error e)
+    | Ok re -> (
+        let printer = [%show: range option] in
+        match captures_all re "abxa" with
+        | Error e -> assert_failure ("failed to match: " ^ show_match_error e)
+        | Ok b ->
+            assert_equal ~printer:string_of_int 2 (captures_batch_length b);
+            let c = captures_of_batch b 1 in
+            assert_equal ~printer:string_of_int 3 (captures_length c);
+            assert_equal ~printer
+              (Some { start = 3; end_ = 4 })
+              (match_of_captures c 1 |> Option.map range_of_match);
+            assert_equal ~printer None
+              (match_of_captures c 2 |> Option.map range_of_match);
+            assert_equal ~printer
+              (Some { start = 1; end_ = 2 })
+              (match_of_captures (captures_of_batch b 0) 2
+              |> Option.map range_of_match);
+            assert_equal ~printer:string_of_int 2
+              (captures_iter re "abxa" |> Seq.length)))
+
+let bigstring_window ctxt =
+  Jit.(
+    match compile "b+" with
+    | Error e -> assert_failure ("failed to compile: " ^ show_compile_error e)
+    | Ok re ->
+        let b = Bigarray.(Array1.create char c_layout 8) in
+        String.iteri (Bigarray.Array1.set b) "abbcabbb";
+        let printer = [%show: (range option, match_error) result] in
+        assert_equal ~printer
+          (Ok (Some { start = 1; end_ = 3 }))
+          (find_bigstring re b >+= range_of_match);
+        assert_equal ~printer
+          (Ok (Some { start = 1; end_ = 3 }))
+          (find_bigstring ~pos:4 ~len:3 re b >+= range_of_match);
+        assert_equal ~printer:[%show: (string option, match_error) result]
+          (Ok (Some "bb"))
+          (find_bigstring ~pos:4 ~len:3 re b >+= substring_of_match);
+        assert_equal ~printer:[%show: (int array, match_error) result]
+          (Ok [| 1; 3; 5; 8 |])
+          (find_all_bigstring re b);
+        assert_raises (Invalid_argument "is_match_bigstring: invalid window")
+          (fun () -> is_match_bigstring ~pos:6 ~len:3 re b);
+        (* Match the same without the runtime lock. *)
+        let threshold = release_lock_threshold () in
+        set_release_lock_threshold (Some 0);
+        assert_equal ~printer:[%show: int option] (Some 0)
+          (release_lock_threshold ());
+        assert_equal ~printer:[%show: (int array, match_error) result]
+          (Ok [| 1; 3; 5; 8 |])
+          (find_all_bigstring re b);
+        set_release_lock_threshold threshold)
+
+let parallel_in_order ctxt =
+  let pool = Parallel.create ~domains:2 () in
+  Fun.protect
+    ~finally:(fun () -> Parallel.shutdown pool)
+    (fun () ->
+      match (Jit.compile "a+", Jit.compile "b") with
+      | Ok a, Ok b ->
+          let subjects =
+            Array.init 100 (fun i -> String.make (i mod 5) 'a' ^ "b")
+          in
+          assert_equal ~printer:[%show: (bool, match_error) result array]
+            (Array.map (Jit.is_match a) subjects)
+            (Parallel.Jit.is_match pool a subjects);
+          assert_equal
+            ~printer:[%show: (int array, match_error) result array array]
+            (Array.map
+               (fun s -> [| Jit.find_all a s; Jit.find_all b s |])
+               subjects)
+            (Parallel.Jit.find_all_many pool [| a; b |] subjects)
+      | _ -> assert_failure "failed to compile")
+
+let jit_stack_growth ctxt =
+  assert_equal ~printer:[%show: int * int] (131072, 8388608)
+    (Jit.stack_sizes ());
+  assert_raises
+    (Invalid_argument "Jit.set_stack_sizes: require 0 < start <= max")
+    (fun () -> Jit.set_stack_sizes ~start:2 ~max:1);
+  (* Each repetition of the group takes space on the JIT stack, exhausting the
+     one PCRE2 provides by default. *)
+  match Jit.compile "^(a|b)*$" with
+  | Ok re ->
+      assert_equal ~printer:[%show: (bool, match_error) result] (Ok true)
+        (Jit.is_match re (String.make 100_000 'a'))
+  | Error _ -> assert_failure "failed to compile"
+
+let match_limits ctxt =
+  let printer = [%show: (bool, match_error) result] in
+  (* Backtracks through every way of splitting the run of a's. *)
+  let subject = String.make 16 'a' ^ "b" in
+  let limits = { no_limits with match_limit = Some 1000 } in
+  (match Interp.compile "^(a+)+$" with
+  | Ok re ->
+      let limited = Interp.with_limits limits re in
+      assert_equal ~printer (Ok false) (Interp.is_match re subject);
+      assert_equal ~printer (Error MATCHLIMIT)
+        (Interp.is_match limited subject);
+      assert_equal ~printer (Ok false)
+        (Interp.is_match_with
+           (Interp.handle ~limits:no_limits limited)
+           subject);
+      assert_equal ~printer (Error DEPTHLIMIT)
+        (Interp.is_match
+           (Interp.with_limits { no_limits with depth_limit = Some 2 } re)
+           subject)
+  | Error _ -> assert_failure "failed to compile");
+  match Jit.compile "^(a+)+$" with
+  | Ok re ->
+      let h = Jit.handle ~limits re in
+      assert_equal ~printer (Error MATCHLIMIT) (Jit.is_match_with h subject);
+      assert_equal ~printer:[%show: (int array, match_error) result]
+        (Error MATCHLIMIT)
+        (Jit.find_all (Jit.with_limits limits re) subject)
+  | Error _ -> assert_failure "failed to compile"
+
+let guarded_matching ctxt =
+  let printer = [%show: (bool, match_error) result] in
+  (* Would backtrack through 2^30 ways of splitting the run of a's. *)
+  let subject = String.make 30 'a' ^ "b" in
+  let timeout =
+    { no_limits with match_limit = Some max_int; timeout = Some 0.01 }
+  in
+  let cancel = Cancel.create () in
+  let cancellable = { no_limits with cancel = Some cancel } in
+  match (Interp.compile "^(a+)+$", Jit.compile "^(a+)+$") with
+  | Ok interp, Ok jit ->
+      assert_equal ~printer (Error TIMEOUT)
+        (Interp.is_match (Interp.with_limits timeout interp) subject);
+      assert_equal ~printer (Error TIMEOUT)
+        (Jit.is_match_with (Jit.handle ~limits:timeout jit) subject);
+      let jit = Jit.with_limits cancellable jit in
+      assert_equal ~printer (Ok true) (Jit.is_match jit "aa");
+      Cancel.cancel cancel;
+      assert_bool "cancelled" (Cancel.is_cancelled cancel);
+      assert_equal ~printer (Error CANCELLED) (Jit.is_match jit "aa");
+      assert_equal ~printer:[%show: (int array, match_error) result]
+        (Error CANCELLED) (Jit.find_all jit subject);
+      (* Each start position scans the rest of the subject without
+         backtracking, so no match limit is reached, yet the search would
+         take far longer than the timeout. *)
+      let subject = String.make 300_000 'a' in
+      let timeout = { no_limits with timeout = Some 0.05 } in
+      let started = Sys.time () in
+      (match Interp.compile "a*[bc]" with
+      | Ok re ->
+          assert_equal ~printer (Error TIMEOUT)
+            (Interp.is_match (Interp.with_limits timeout re) subject)
+      | Error _ -> assert_failure "failed to compile");
+      assert_bool "timely" (Sys.time () -. started < 1.);
+      (* [(*COMMIT)] fails the whole search at the first [a], so a pattern
+         using it is not searched in chunks, which would find the later [ab]. *)
+      let subject = "ac" ^ String.make 998 'x' ^ "ab" in
+      (match Interp.compile "a(*COMMIT)b" with
+      | Ok re ->
+          assert_equal ~printer (Ok false) (Interp.is_match re subject);
+          assert_equal ~printer (Ok false)
+            (Interp.is_match (Interp.with_limits timeout re) subject)
+      | Error _ -> assert_failure "failed to compile");
+      (* A match found by searching in chunks is at the same offsets. *)
+      let subject = String.make 100_000 'x' ^ "\xc3\xa9b" in
+      (match Interp.compile ~options:[ `UTF ] "\\x{e9}b" with
+      | Ok re ->
+          assert_equal
+            ~printer:[%show: (range option, match_error) result]
+            (Ok (Some { start = 100_000; end_ = 100_003 }))
+            (Interp.find (Interp.with_limits timeout re) subject
+            |> Result.map (Option.map range_of_match))
+      | Error _ -> assert_failure "failed to compile")
+  | _ -> assert_failure "failed to compile"
+
+let dfa_alternatives ctxt =
+  Dfa.(
+    match compile "a|ab|abc" with
+    | Error e -> assert_failure ("failed to compile: " ^ show_compile_error e)
+    | Ok re ->
+        (* The longest match, rather than the first alternative to match. *)
+        assert_equal ~printer:[%show: (range option, match_error) result]
+          (Ok (Some { start = 1; end_ = 4 }))
+          (find re "xabc" >+= range_of_match);
+        (* Every alternative match, longest first. *)
+        assert_equal ~printer:[%show: (string list option, match_error) result]
+          (Ok (Some [ "abc"; "ab"; "a" ]))
+          (captures re "abc"
+          >+= fun c ->
+          List.init (captures_length c) (fun i ->
+              match match_of_captures c i with
+              | Some m -> substring_of_match m
+              | None -> ""));
+        assert_equal ~printer:[%show: (bool, match_error) result] (Ok true)
+          (is_match_with (handle re) "zzab"))
+
+let stream_matching ctxt =
+  Interp.(
+    let printer = [%show: (range list, match_error) result] in
+    let feed_all s chunks =
+      List.fold_left
+        (fun acc chunk ->
+          Result.bind acc (fun acc ->
+              feed s chunk |> Result.map (fun ranges -> acc @ ranges)))
+        (Ok []) chunks
+    in
+    match
+      ( compile "abc",
+        compile "a+",
+        compile "(?<=x)y",
+        compile ~options:[ `MULTILINE ] "^a",
+        compile "(*CRLF)(?m)^a" )
+    with
+    | Ok abc, Ok a_plus, Ok after_x, Ok line_start, Ok crlf_line_start ->
+        let s = stream abc in
+        assert_equal ~printer
+          (Ok [ { start = 2; end_ = 5 }; { start = 7; end_ = 10 } ])
+          (feed_all s [ "xxab"; "cxxa"; "bc" ]);
+        assert_equal ~printer:string_of_int 10 (stream_position s);
+        (* Nothing is left which a match could start in, only the bytes
+           before it which a newline may need. *)
+        assert_equal ~printer:string_of_int 2 (stream_retained s);
+        (* Likewise after a chunk in which nothing matches. *)
+        let s = stream abc in
+        assert_equal ~printer (Ok []) (feed_all s [ "xyz"; "zzz" ]);
+        assert_equal ~printer:string_of_int 2 (stream_retained s);
+        let chunks = ref [ "xxab"; "cxxa"; "bc" ] in
+        let read buf pos _ =
+          match !chunks with
+          | [] -> 0
+          | chunk :: rest ->
+              chunks := rest;
+              Bytes.blit_string chunk 0 buf pos (String.length chunk);
+              String.length chunk
+        in
+        let found = ref [] in
+        assert_equal
+          ~printer:[%show: (unit, match_error) result]
+          (Ok ())
+          (scan_reader abc read (fun r -> found := r :: !found));
+        assert_equal ~printer:[%show: range list]
+          [ { start = 2; end_ = 5 }; { start = 7; end_ = 10 } ]
+          (List.rev !found);
+        (* A match reaching the end of a chunk waits for the next. *)
+        let s = stream a_plus in
+        assert_equal ~printer (Ok []) (feed_all s [ "ba"; "aa" ]);
+        assert_equal ~printer (Ok [ { start = 1; end_ = 4 } ]) (feed s "ba");
+        assert_equal ~printer (Ok [ { start = 5; end_ = 6 } ]) (finish s);
+        (* The lookbehind sees the end of the previous chunk. *)
+        let s = stream after_x in
+        assert_equal ~printer
+          (Ok [ { start = 1; end_ = 2 } ])
+          (feed_all s [ "x"; "yy" ]);
+        (* A multiline [^] sees the newline ending the previous chunk. *)
+        let s = stream line_start in
+        assert_equal ~printer
+          (Ok [ { start = 2; end_ = 3 } ])
+          (feed_all s [ "x\n"; "a" ]);
+        let s = stream crlf_line_start in
+        assert_equal ~printer
+          (Ok [ { start = 3; end_ = 4 } ])
+          (feed_all s [ "x\r\n"; "a" ])
+    | _ -> assert_failure "failed to compile")
+
+let file_scanning ctxt =
+  Jit.(
+    match compile "foo" with
+    | Error e -> assert_failure ("failed to compile: " ^ show_compile_error e)
+    | Ok re ->
+        let path = Filename.temp_file "pcre2" ".txt" in
+        let oc = open_out_bin path in
+        output_string oc "foo\nbar foo\n\nfoo";
+        close_out oc;
+        let at start line column =
+          { range = { start; end_ = start + 3 }; line; column }
+        in
+        assert_equal
+          ~printer:[%show: (located_match array, match_error) result]
+          (Ok [| at 0 1 1; at 8 2 5; at 13 4 1 |])
+          (scan_file re path);
+        Sys.remove path;
+        assert_raises (Sys_error (path ^ ": No such file or directory"))
+          (fun () -> scan_file re path))
+
+let prefiltering ctxt =
+  let printer = [%show: (bool, match_error) result] in
+  match Interp.compile "abc+d" with
+  | Error _ -> assert_failure "failed to compile"
+  | Ok re ->
+      Prefilter.reset_stats ();
+      assert_equal ~printer (Ok false) (Interp.is_match re "abc");
+      assert_equal ~printer (Ok false) (Interp.is_match re "xbcccd");
+      assert_equal ~printer (Ok false) (Interp.is_match re "xxxxxabcc");
+      assert_equal ~printer (Ok true) (Interp.is_match re "xxabcccd");
+      assert_equal ~printer:Prefilter.show_stats
+        { too_short = 1; no_first_code_unit = 1; no_last_code_unit = 1 }
+        (Prefilter.stats ())
+
+let literal_matching ctxt =
+  Literal.(
+    match (compile "ab", compile ~options:[ `CASELESS ] "ab", compile "a.") with
+    | Ok exact, Ok caseless, Ok pcre ->
+        assert_bool "literal" (is_literal exact && is_literal caseless);
+        assert_bool "not literal" (not (is_literal pcre));
+        let printer = [%show: (int array, match_error) result] in
+        assert_equal ~printer (Ok [| 2; 4; 5; 7 |]) (find_all exact "xAabxab");
+        assert_equal ~printer
+          (Ok [| 1; 3; 3; 5 |])
+          (find_all ~max_count:2 caseless "xAbaBab");
+        assert_equal ~printer (Ok [| 1; 3 |]) (find_all pcre "xab");
+        assert_equal ~printer:[%show: (string list, match_error) result]
+          (Ok [ "x"; "y"; "" ])
+          (split caseless "xAByab");
+        assert_equal ~printer:[%show: (bool, match_error) result]
+          (Error BADOFFSET)
+          (is_match ~subject_offset:4 exact "abc")
+    | _ -> assert_failure "failed to compile")
+
+let pattern_sets ctxt =
+  (* The second pattern recurses, so is matched apart from the others. *)
+  match Set.compile [| "b+"; "a(b)(?1)"; "z"; "(a)\\1" |] with
+  | Error _ -> assert_failure "failed to compile"
+  | Ok set ->
+      assert_equal ~printer:string_of_int 4 (Set.length set);
+      assert_equal ~printer:[%show: (int list, match_error) result]
+        (Ok [ 0; 1; 3 ])
+        (Set.matches set "xaabbb");
+      let ranges =
+        Result.map
+          (Array.map (Option.map (fun (_, start, end_) -> (start, end_))))
+          (Set.leftmost set "xaabbb")
+      in
+      assert_equal
+        ~printer:[%show: ((int * int) option array, match_error) result]
+        (Ok [| Some (3, 6); Some (2, 5); None; Some (1, 3) |])
+        ranges;
+      assert_equal ~printer:[%show: (int list, match_error) result] (Ok [ 0 ])
+        (Set.matches ~subject_offset:3 set "xaabbb");
+      assert_bool "bad pattern index"
+        (match Set.compile [| "a"; "(" |] with
+        | Error (1, _) -> true
+        | _ -> false);
+      let matches ?options patterns subject =
+        match Set.compile ?options patterns with
+        | Ok set -> Set.matches set subject
+        | Error _ -> assert_failure "failed to compile"
+      in
+      let printer = [%show: (int list, match_error) result] in
+      (* The callouts inserted before each item are passed over. *)
+      assert_equal ~printer (Ok [ 0; 1 ])
+        (matches ~options:[ `AUTO_CALLOUT ] [| "a+"; "b"; "c" |] "xaab");
+      (* Literal patterns are quoted, even where they contain [\E]. *)
+      assert_equal ~printer (Ok [ 0; 2 ])
+        (matches ~options:[ `LITERAL ] [| "a+("; "b"; "\\E|" |] "a+(\\E|");
+      (* [(?-1)] would call the group of the first pattern if combined. *)
+      assert_equal ~printer (Ok [ 1 ])
+        (matches [| "(x)"; "a(b)(?-1)"; "(y)(?+1)(z)" |] "abb");
+      assert_equal ~printer (Ok [ 0 ])
+        (matches [| "(x)"; "a(b)(?-1)"; "(y)(?+1)(z)" |] "abx");
+      (* Groups of the same number named otherwise would fail to combine, so
+         patterns naming groups are matched apart, and the rest together. *)
+      let patterns = [| "(?<x>a)"; "(?<y>b)"; "(?P<z>c)"; "(?<=d)e"; "f" |] in
+      match Set.compile patterns with
+      | Ok set ->
+          assert_equal ~printer:[%show: int list] [ 0; 1; 2 ]
+            (Set.separate set);
+          assert_equal ~printer (Ok [ 0; 1; 3; 4 ])
+            (Set.matches set "abdef")
+      | Error _ -> assert_failure "failed to compile"
+
+let literal_prefiltering ctxt =
+  let compile options p =
+    match Jit.compile ~options p with
+    | Ok re -> re
+    | Error _ -> assert_failure ("failed to compile " ^ p)
+  in
+  (* The third rule has no literal but the first code unit [x], and the fourth
+     has neither. *)
+  let rules =
+    [|
+      compile [] "foo\\d+barbaz";
+      compile [ `CASELESS ] "eval\\s*\\(";
+      compile [] "x(a|b)";
+      compile [] "a|b";
+    |]
+  in
+  let p = Literal_prefilter.of_jit rules in
+  let printer = [%show: int list] in
+  assert_equal ~printer:string_of_int 4 (Literal_prefilter.length p);
+  assert_equal ~printer [ 3 ] (Literal_prefilter.candidates p "foo1bar");
+  assert_equal ~printer [ 0; 3 ]
+    (Literal_prefilter.candidates p "foo12barbaz");
+  assert_equal ~printer [ 1; 2; 3 ]
+    (Literal_prefilter.candidates p "EVAL (x)");
+  assert_equal ~printer [ 3 ] (Literal_prefilter.candidates p "Barbaz");
+  (* A leading [(*UTF)] folds [k] with the Kelvin sign, as [`UTF] does. *)
+  let p =
+    Literal_prefilter.of_jit
+      [| compile [] "(*UTF)(?i)ok"; compile [ `UTF ] "(?i)ok" |]
+  in
+  assert_equal ~printer [ 0; 1 ]
+    (Literal_prefilter.candidates p "o\xe2\x84\xaa");
+  (* Comments and callouts match nothing, so a quantifier after them makes the
+     [b] before them optional. *)
+  let p =
+    Literal_prefilter.of_jit
+      [|
+        compile [] "ab(?#x)?"; compile [] "ab(?C1)?"; compile [] "a(?C'(')b";
+      |]
+  in
+  assert_equal ~printer [ 0; 1 ] (Literal_prefilter.candidates p "a");
+  assert_equal ~printer [ 0; 1; 2 ] (Literal_prefilter.candidates p "xab")
+
+let compile_cache ctxt =
+  let cache = Cache.create ~capacity:2 in
+  let jit p =
+    match Cache.jit cache p with
+    | Ok re -> re
+    | Error _ -> assert_failure "failed to compile"
+  in
+  let a = jit "a" in
+  assert_bool "cached" (jit "a" == a);
+  assert_bool "distinct from the interpreter"
+    (Result.is_ok (Cache.interp cache "a"));
+  (* The JIT "a" is the least recently used, so is evicted, and then the
+     interpreter "a". *)
+  ignore (jit "b");
+  assert_bool "evicted" (jit "a" != a);
+  assert_equal ~printer:Cache.show_stats
+    Cache.{ hits = 1; misses = 4; evictions = 2 }
+    (Cache.stats cache);
+  assert_equal ~printer:string_of_int 2 (Cache.length cache);
+  match (Interp.compile "a+", Interp.compile "a+", Interp.compile "b+") with
+  | Ok x, Ok y, Ok z ->
+      assert_bool "equal" (compare x y = 0 && Hashtbl.hash x = Hashtbl.hash y);
+      assert_bool "not equal" (compare x z <> 0)
+  | _ -> assert_failure "failed to compile"
+
+let bulk_compilation ctxt =
+  let results, timings = Jit.compile_many ~threads:2 [| "a+"; "("; "b" |] in
+  assert_equal ~printer:string_of_int 3 (Array.length timings);
+  assert_bool "timings" (Array.for_all (fun t -> t >= 0.) timings);
+  match results with
+  | [| Ok a; Error _; Ok b |] ->
+      let printer = [%show: (bool, match_error) result] in
+      assert_equal ~printer (Ok true) (Jit.is_match a "xaa");
+      assert_equal ~printer (Ok false) (Jit.is_match b "xaa")
+  | _ -> assert_failure "unexpected results"
+
+let disk_cache ctxt =
+  let path, oc = bracket_tmpfile ctxt in
+  close_out oc;
+  let printer = string_of_int in
+  (* The file is empty, so not a valid cache. *)
+  let cache = Disk_cache.load path in
+  assert_equal ~printer 0 (Disk_cache.loaded cache);
+  assert_bool "compiled" (Result.is_ok (Disk_cache.interp cache "a+b"));
+  assert_bool "compiled" (Result.is_ok (Disk_cache.jit cache "(c|d)\\d"));
+  assert_bool "error" (Result.is_error (Disk_cache.interp cache "("));
+  Disk_cache.save cache;
+  let cache = Disk_cache.load path in
+  assert_equal ~printer 2 (Disk_cache.loaded cache);
+  let printer = [%show: (bool, match_error) result] in
+  (match Disk_cache.interp cache "a+b" with
+  | Ok re -> assert_equal ~printer (Ok true) (Interp.is_match re "xaab")
+  | Error _ -> assert_failure "failed to load");
+  (match Disk_cache.jit cache "(c|d)\\d" with
+  | Ok re -> assert_equal ~printer (Ok true) (Jit.is_match re "d7")
+  | Error _ -> assert_failure "failed to load");
+  assert_equal ~printer:string_of_int 2 (Disk_cache.length cache)
+
+(* Changes the version of PCRE2 recorded in the serialized code of the regex
+   marshalled in [s], as though it had been marshalled by another version. The
+   code follows the [pattern] of the regex and its size, and starts with a
+   magic number and then the version. *)
+let bump_pcre2_version (s : string) (pattern : string) : string =
+  let rec find i =
+    if String.sub s i (String.length pattern) = pattern then i
+    else find (i + 1)
+  in
+  let version = find 0 + String.length pattern + 8 + 4 in
+  let b = Bytes.of_string s in
+  Bytes.set b version (Char.chr ((Char.code s.[version] + 1) land 0xff));
+  Bytes.to_string b
+
+let marshalling ctxt =
+  let printer = [%show: (bool, match_error) result] in
+  match (Interp.compile "(?<x>a+)b", Jit.compile "c+d") with
+  | Ok interp, Ok jit ->
+      let interp', jit' =
+        Marshal.from_string (Marshal.to_string (interp, jit) []) 0
+      in
+      assert_bool "equal" (compare interp interp' = 0 && compare jit jit' = 0);
+      assert_equal ~printer (Ok true) (Interp.is_match interp' "xaab");
+      assert_equal ~printer (Ok true) (Jit.is_match jit' "xccd");
+      assert_equal ~printer:[%show: int option] (Some 1)
+        (Interp.group_index interp' "x");
+      (* Code serialized by another version of PCRE2 is compiled again. *)
+      let jit' =
+        Marshal.from_string
+          (bump_pcre2_version (Marshal.to_string jit []) "c+d")
+          0
+      in
+      assert_bool "equal" (compare jit jit' = 0);
+      assert_equal ~printer (Ok true) (Jit.is_match jit' "xccd")
+  | _ -> assert_failure "failed to compile"
+
+let embedded ctxt =
+  let printer = [%show: (bool, match_error) result] in
+  let interp = [%pcre2.interp "(?i)(?<x>a+)b"] in
+  let jit = [%pcre2 "c+d"] in
+  assert_equal ~printer (Ok true) (Interp.is_match interp "xAab");
+  assert_equal ~printer (Ok true) (Jit.is_match jit "xccd");
+  assert_equal ~printer:[%show: int option] (Some 1)
+    (Interp.group_index interp "x");
+  (* Decoded once, rather than each time it is evaluated. *)
+  let re () = [%pcre2 "e+f"] in
+  assert_bool "decoded once" (re () == re ());
+  (* A program run with another version of PCRE2 than it was built with
+     compiles its patterns again. *)
+  match Interp.compile "g+h" with
+  | Ok re ->
+      let compiled = bump_pcre2_version (Marshal.to_string re []) "g+h" in
+      assert_equal ~printer (Ok true)
+        (Interp.is_match (Embedded.interp compiled) "xggh");
+      assert_equal ~printer (Ok true)
+        (Jit.is_match (Embedded.jit compiled) "xggh")
+  | Error _ -> assert_failure "failed to compile"
+
+let tiered_compilation ctxt =
+  let printer = [%show: (bool, match_error) result] in
+  let thresholds = Tiered.thresholds () in
+  Tiered.set_thresholds ~uses:2 ~bytes:max_int;
+  let re = Tiered.compile "(?<x>a+)b" in
+  Tiered.set_thresholds ~uses:(fst thresholds) ~bytes:(snd thresholds);
+  match re with
+  | Ok re ->
+      assert_equal ~printer (Ok true) (Tiered.is_match re "xaab");
+      assert_bool "interpreted" (not (Tiered.is_jit re));
+      assert_equal ~printer (Ok false) (Tiered.is_match re "xaa");
+      assert_bool "JIT compiled" (Tiered.is_jit re);
+      assert_equal ~printer (Ok true) (Tiered.is_match re "xaab");
+      assert_equal ~printer:[%show: int option] (Some 1)
+        (Tiered.group_index re "x")
+  | Error _ -> assert_failure "failed to compile"
+
+let jit_memory ctxt =
+  let thresholds = Tiered.thresholds () in
+  Tiered.set_thresholds ~uses:1 ~bytes:max_int;
+  let compiled =
+    (Interp.compile "(a|b)+c", Tiered.compile "d+e", Tiered.compile "f+g")
+  in
+  Tiered.set_thresholds ~uses:(fst thresholds) ~bytes:(snd thresholds);
+  match compiled with
+  | Ok interp, Ok d, Ok f ->
+      let before = memory_usage () in
+      assert_bool "counted" (before.regexes >= 3 && before.code_bytes > 0);
+      assert_bool "JIT compiled" (Result.is_ok (Jit.of_interp interp));
+      assert_bool "JIT counted"
+        ((memory_usage ()).jit_bytes > before.jit_bytes);
+      ignore (Tiered.is_match d "dde");
+      assert_bool "JIT compiled" (Tiered.is_jit d && Tiered.jit_size d > 0);
+      Tiered.release_jit d;
+      assert_bool "released" (not (Tiered.is_jit d));
+      ignore (Tiered.is_match d "dde");
+      (* With no budget to spare, JIT compiling [f] releases [d]. *)
+      Tiered.set_jit_budget (Some 0);
+      ignore (Tiered.is_match f "ffg");
+      Tiered.set_jit_budget None;
+      assert_bool "evicted" (Tiered.is_jit f && not (Tiered.is_jit d));
+      assert_equal
+        ~printer:[%show: (bool, match_error) result]
+        (Ok true) (Tiered.is_match d "dde");
+      Jit.free_unused_memory ()
+  | _ -> assert_failure "failed to compile"
+
 let check_version ctxt =
   let major, minor = Pcre2.version in
   assert_equal ~printer:string_of_int 10 major;
@@ -131,8 +779,32 @@ let suite =
          "split_comma" >:: split_comma;
          "non_contiguous_capture" >:: non_contiguous_capture;
          "non_contiguous_named_capture" >:: non_contiguous_named_capture;
+         "duplicate_group_names" >:: duplicate_group_names;
          "bad_pattern" >:: bad_pattern;
          "bad_offset" >:: bad_offset;
+         "handle_reuse" >:: handle_reuse;
+         "find_into_buffer" >:: find_into_buffer;
+         "find_all_empty_matches" >:: find_all_empty_matches;
+         "captures_all_batch" >:: captures_all_batch;
+         "bigstring_window" >:: bigstring_window;
+         "parallel_in_order" >:: parallel_in_order;
+         "jit_stack_growth" >:: jit_stack_growth;
+         "match_limits" >:: match_limits;
+         "guarded_matching" >:: guarded_matching;
+         "dfa_alternatives" >:: dfa_alternatives;
+         "stream_matching" >:: stream_matching;
+         "file_scanning" >:: file_scanning;
+         "prefiltering" >:: prefiltering;
+         "literal_matching" >:: literal_matching;
+         "pattern_sets" >:: pattern_sets;
+         "literal_prefiltering" >:: literal_prefiltering;
+         "compile_cache" >:: compile_cache;
+         "bulk_compilation" >:: bulk_compilation;
+         "disk_cache" >:: disk_cache;
+         "marshalling" >:: marshalling;
+         "embedded" >:: embedded;
+         "tiered_compilation" >:: tiered_compilation;
+         "jit_memory" >:: jit_memory;
          "version" >:: check_version;
        ]
 